@@ -110,13 +110,11 @@ int main(int argc, char** argv) {
     while (ros::ok()) {
         ROS_INFO("looping");
         ros::Time tic = ros::Time::now();
-        std::list<LinkPairDistance> results = distance_comp->getLinkDistances();
+        std::list<LinkPairDistance> results = distance_comp->getClosestLinkPairs(15);
         ros::Time toc = ros::Time::now();
 
         ROS_INFO("minimum_distance computed, results found %d distances in %fs", results.size(), toc.toSec()-tic.toSec());
 
-        while(results.size() > 15) results.pop_back();
-
         std::list<LinkPairDistance>::iterator it = results.begin();
         ROS_INFO("first distance result: %f, p0={%f, %f, %f} p1={%f, %f, %f}",
                  it->getDistance(),
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef ROBOTSENSINGTHREAD_H
+#define ROBOTSENSINGTHREAD_H
+
+#include <idynutils/RobotUtils.h>
+#include <yarp/os/RateThread.h>
+#include <yarp/sig/Vector.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The RobotStateSnapshot class is the whole body state sensed by a RobotSensingThread at one tick
+ */
+class RobotStateSnapshot
+{
+public:
+    /// @brief q, qdot, tau joint positions, velocities and torques, in model order
+    yarp::sig::Vector q;
+    yarp::sig::Vector qdot;
+    yarp::sig::Vector tau;
+    /// @brief joints_timestamp the encoders timestamp of the last chain read, in \f$[s]\f$
+    double joints_timestamp;
+    /// @brief joints_skew the time skew between the chain reads, see RobotUtils::getSenseSkew
+    double joints_skew;
+
+    /// @brief ft_readings the wrench of each ft sensor, by reference frame
+    RobotUtils::ftReadings ft_readings;
+    /// @brief ft_timestamp the time at which the ft sensors have been read, in \f$[s]\f$
+    double ft_timestamp;
+
+    /// @brief imu the IMU output, see yarp_IMU_interface::sense. It is empty if the robot has no IMU
+    yarp::sig::Vector imu;
+    /// @brief imu_timestamp the time at which the IMU has been read, in \f$[s]\f$
+    double imu_timestamp;
+
+    /// @brief sequence the number of the snapshot, starting from 1
+    unsigned long sequence;
+
+    RobotStateSnapshot();
+};
+
+/**
+ * @brief The RobotSensingThread class senses the whole robot at a fixed rate, and publishes each
+ *        tick as a RobotStateSnapshot, so that several consumers at different rates (estimators,
+ *        planners, loggers) share one set of reads instead of each calling RobotUtils::sense.
+ *        Snapshots are published with a seqlock: the thread never waits for readers, and readers
+ *        never take a lock, they only copy again the snapshot if it has been published while they
+ *        were copying it.
+ *        While the thread is running the RobotUtils sense methods must not be called by others,
+ *        while move can still be called by one control thread if RobotUtils uses 1 I/O thread.
+ */
+class RobotSensingThread : public yarp::os::RateThread
+{
+public:
+    /**
+     * @brief IMU_OUTPUT_SIZE the size of the IMU output in the snapshot
+     */
+    static const unsigned int IMU_OUTPUT_SIZE = 12;
+
+    /**
+     * @brief RobotSensingThread creates the sensing thread, which is started with start()
+     * @param robot the robot, which must outlive the thread
+     * @param period the sensing period in \f$[ms]\f$
+     */
+    RobotSensingThread(RobotUtils& robot, const int period);
+
+    ~RobotSensingThread();
+
+    /**
+     * @brief getSnapshot copies the latest snapshot. After the first call, it does not allocate
+     *        if the snapshot is always the same object. It can be called from any thread
+     * @param snapshot the latest snapshot
+     * @return false if no snapshot has been published yet
+     */
+    bool getSnapshot(RobotStateSnapshot& snapshot) const;
+
+    /**
+     * @brief getNumberOfSnapshots returns the number of published snapshots
+     * @return the number of published snapshots
+     */
+    unsigned long getNumberOfSnapshots() const;
+
+    virtual void run();
+
+private:
+    RobotUtils& robot;
+
+    /// @brief ft_frames the ft sensors reference frames, in RobotUtils::ftPtrMap order
+    std::vector<std::string> ft_frames;
+    /// @brief ft_sensors the ft sensors, in ft_frames order
+    std::vector<RobotUtils::ftPtr> ft_sensors;
+
+    /* The snapshot is stored in a flat block of doubles with layout
+       q, qdot, tau, ft wrenches (6 per sensor), imu, joints_timestamp, joints_skew, ft_timestamp, imu_timestamp
+       so that it is copied without allocations */
+
+    unsigned int number_of_joints;
+    unsigned int ft_offset;
+    unsigned int imu_offset;
+    unsigned int timestamps_offset;
+    unsigned int block_size;
+
+    /// @brief q, qdot, tau, wrench, imu_output the sensing buffers of the thread
+    yarp::sig::Vector q;
+    yarp::sig::Vector qdot;
+    yarp::sig::Vector tau;
+    yarp::sig::Vector wrench;
+    yarp::sig::Vector imu_output;
+
+    /// @brief sensed the block sensed at the current tick
+    std::vector<double> sensed;
+
+    /// @brief published the published block, protected by sequence
+    std::vector<double> published;
+
+    /**
+     * @brief sequence the seqlock sequence, which is odd while the thread is publishing.
+     *        The number of published snapshots is sequence / 2
+     */
+    volatile unsigned long sequence;
+
+    void publish();
+};
+
+#endif // ROBOTSENSINGTHREAD_H
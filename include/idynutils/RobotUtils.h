@@ -62,6 +62,8 @@ public:
 	        const std::string urdf_path = "",
 	        const std::string srdf_path = "" );
 
+    ~RobotUtils();
+
     walkman::yarp_single_chain_interface right_hand, left_hand;
     walkman::yarp_single_chain_interface right_arm, left_arm;
     walkman::yarp_single_chain_interface torso;
@@ -102,7 +104,10 @@ public:
     IMUPtr getIMU();
 
     /**
-     * @brief sense returns position, velocities, torques sensed by the robot
+     * @brief sense returns position, velocities, torques sensed by the robot.
+     * Each chain is visited once, reading positions with their timestamps, velocities and torques together,
+     * and the three vectors are written in a single pass. The time skew between the chain reads
+     * is available from getSenseSkew
      * @param q
      * @param qdot
      * @param tau
@@ -111,6 +116,19 @@ public:
                yarp::sig::Vector& qdot,
                yarp::sig::Vector& tau);
 
+    /**
+     * @brief getSenseSkew returns the time skew of the last sense, i.e. the difference between the
+     * encoders timestamps of the last and the first chain read
+     * @return the time skew in \f$[s]\f$
+     */
+    double getSenseSkew() const;
+
+    /**
+     * @brief getSenseTimestamp returns the encoders timestamp of the last chain read by the last sense
+     * @return the timestamp in \f$[s]\f$
+     */
+    double getSenseTimestamp() const;
+
     /**
      * @brief sensePosition returns the position of the robot's joints
      * @return
@@ -136,11 +154,45 @@ public:
     yarp::sig::Vector& sensePositionRefFeedback();
 
     /**
-     * @brief senseftSensors senses all available ft sensors
+     * @brief senseftSensors senses all available ft sensors. The map is filled in place,
+     * so it does not allocate
      * @return a map <std::string chain name, yarp::sig::Vector ft Reading>
      */
     ftReadings& senseftSensors();
 
+    /**
+     * @brief senseftTable senses all available ft sensors in a preallocated table, without allocations
+     * @return the ft readings, where reading i is measured in ft_reference_frames[i]
+     */
+    const std::vector<yarp::sig::Vector>& senseftTable();
+
+    /**
+     * @brief getftIndex returns the index of a ft sensor in the ft table
+     * @param ft_frame the ft sensor reference frame
+     * @return the index in the table returned by senseftTable, or -1 if there is no ft sensor in ft_frame
+     */
+    int getftIndex(const std::string& ft_frame) const;
+
+    /**
+     * @brief updateiDyn3Model senses all available ft sensors in the ft table, and feeds them directly to
+     * iDynUtils::updateiDyn3Model, with the FT sensor indices of the model precomputed at construction.
+     * No ft_measure is built and no allocation is performed
+     * @param model the model to update. It must be loaded from the same URDF of idynutils
+     * @param q robot configuration
+     * @param set_world_pose do we update the base link pose wrt the world frame?
+     */
+    void updateiDyn3Model(iDynUtils& model,
+                          const yarp::sig::Vector& q,
+                          const bool set_world_pose = false);
+
+    /**
+     * @brief updateiDyn3Model senses all available ft sensors and updates idynutils, see updateiDyn3Model(model, q, set_world_pose)
+     * @param q robot configuration
+     * @param set_world_pose do we update the base link pose wrt the world frame?
+     */
+    void updateiDyn3Model(const yarp::sig::Vector& q,
+                          const bool set_world_pose = false);
+
     /**
      * @brief senseftSensor senses the ft sensor on specified chain
      * @param chain the yarp single chain interface corresponding to
@@ -392,64 +444,144 @@ public:
      * @return a list of kinematic chains for this robot
      */
     KinematicChains getKinematicChains();
+
+    /**
+     * @brief setNumberOfIOThreads sets the number of threads used by sense, sensePosition, senseVelocity,
+     * senseTorque, sensePositionRefFeedback and move to talk to the chains (except hands).
+     * Chains are split among a persistent pool of threads, each pinned to a cpu, which read or write
+     * their chains concurrently and then wait for each other, so that the whole body latency is about
+     * the one of the slowest chain instead of the sum of all chains. Default is 1, i.e. chains are
+     * read and written in sequence by the calling thread. With more than 1 thread, the workers are shared,
+     * so sense and move must be called from the same thread
+     * @param number_of_threads the number of threads, including the calling thread.
+     *        It is limited to the number of chains
+     */
+    void setNumberOfIOThreads(const unsigned int number_of_threads);
+
+    /**
+     * @brief getNumberOfIOThreads returns the number of threads used to talk to the chains
+     * @return the number of threads, including the calling thread
+     */
+    unsigned int getNumberOfIOThreads() const;
+
+    class ChainIOWorker;
+    friend class RobotUtils::ChainIOWorker;
+
 private:
     unsigned int number_of_joints;
     /// @brief q_commanded_right_arm q sento to the right hand, in robot joint ordering
     yarp::sig::Vector q_commanded_right_hand;
     /// @brief q_commanded_left_arm q sent to the left hand, in robot joint ordering
     yarp::sig::Vector q_commanded_left_hand;
-    /// @brief q_commanded_left_arm q sent to the left arm, in robot joint ordering
-    yarp::sig::Vector q_commanded_left_arm;
-    /// @brief q_commanded_right_arm q sento to the right arm, in robot joint ordering
-    yarp::sig::Vector q_commanded_right_arm;
-    /// @brief q_commanded_left_leg q sento to the left leg, in robot joint ordering
-    yarp::sig::Vector q_commanded_left_leg;
-    /// @brief q_commanded_right_leg q sento to the right leg, in robot joint ordering
-    yarp::sig::Vector q_commanded_right_leg;
-    /// @brief q_commanded_torso q sento to the torso, in robot joint ordering
-    yarp::sig::Vector q_commanded_torso;
-
-    yarp::sig::Vector q_commanded_head;
-
     yarp::sig::Vector q_sensed;
 
     yarp::sig::Vector q_sensed_left_hand;
     yarp::sig::Vector q_sensed_right_hand;
-    yarp::sig::Vector q_sensed_left_arm;
-    yarp::sig::Vector q_sensed_right_arm;
-    yarp::sig::Vector q_sensed_left_leg;
-    yarp::sig::Vector q_sensed_right_leg;
-    yarp::sig::Vector q_sensed_torso;
-    yarp::sig::Vector q_sensed_head;
 
     yarp::sig::Vector qdot_sensed;
 
-    yarp::sig::Vector qdot_sensed_left_arm;
-    yarp::sig::Vector qdot_sensed_right_arm;
-    yarp::sig::Vector qdot_sensed_left_leg;
-    yarp::sig::Vector qdot_sensed_right_leg;
-    yarp::sig::Vector qdot_sensed_torso;
-    yarp::sig::Vector qdot_sensed_head;
-
     yarp::sig::Vector tau_sensed;
-
-    yarp::sig::Vector tau_sensed_left_arm;
-    yarp::sig::Vector tau_sensed_right_arm;
-    yarp::sig::Vector tau_sensed_left_leg;
-    yarp::sig::Vector tau_sensed_right_leg;
-    yarp::sig::Vector tau_sensed_torso;
-    yarp::sig::Vector tau_sensed_head;
     
     yarp::sig::Vector q_ref_feedback_sensed;
 
-    yarp::sig::Vector q_ref_feedback_sensed_left_hand;
-    yarp::sig::Vector q_ref_feedback_sensed_right_hand;
-    yarp::sig::Vector q_ref_feedback_sensed_left_arm;
-    yarp::sig::Vector q_ref_feedback_sensed_right_arm;
-    yarp::sig::Vector q_ref_feedback_sensed_left_leg;
-    yarp::sig::Vector q_ref_feedback_sensed_right_leg;
-    yarp::sig::Vector q_ref_feedback_sensed_torso;
-    yarp::sig::Vector q_ref_feedback_sensed_head;
+    /**
+     * @brief The ChainMapping struct is a segment of the whole body joint permutation table:
+     *        the chain driver writes its joints in driver_sensed[offset, offset + number_of_driver_joints),
+     *        and driver joint offset + i, for i < number_of_mapped_joints, is model joint model_indices[offset + i]
+     */
+    struct ChainMapping {
+        walkman::yarp_single_chain_interface* chain;
+        unsigned int offset;
+        unsigned int number_of_driver_joints;
+        unsigned int number_of_mapped_joints;
+    };
+
+    typedef bool (walkman::yarp_single_chain_interface::*RawSenseFunction)(double*);
+
+    /// @brief chain_mappings the available chains, except hands, in the whole body permutation table
+    std::vector<ChainMapping> chain_mappings;
+    /// @brief model_indices the whole body permutation table, from driver order to model order
+    std::vector<unsigned int> model_indices;
+    /// @brief driver_sensed the sensed joints of all chains, in driver order and units
+    std::vector<double> driver_sensed;
+    /// @brief driver_sensed_qdot, driver_sensed_tau the sensed velocities and torques of all chains, in driver order and units
+    std::vector<double> driver_sensed_qdot;
+    std::vector<double> driver_sensed_tau;
+    /// @brief driver_timestamps the encoders timestamps of all chains, in driver order
+    std::vector<double> driver_timestamps;
+    /// @brief sense_skew, sense_timestamp the time skew between the chain reads of the last sense,
+    /// and the timestamp of the last chain read
+    double sense_skew;
+    double sense_timestamp;
+    /// @brief driver_commanded the commanded joints of all chains, in driver order and units
+    std::vector<double> driver_commanded;
+
+    /**
+     * @brief The ChainIO enum is the operation that the I/O threads perform on each chain
+     */
+    enum ChainIO {
+        CHAIN_IO_SENSE_RAW,
+        CHAIN_IO_SENSE_TIMED,
+        CHAIN_IO_MOVE
+    };
+
+    /// @brief chain_io, chain_io_sense_raw, chain_io_command the current operation of the I/O workers
+    ChainIO chain_io;
+    RawSenseFunction chain_io_sense_raw;
+    const yarp::sig::Vector* chain_io_command;
+
+    /**
+     * @brief chain_io_workers the persistent I/O threads. The calling thread works as well,
+     * so there is one worker less than the number of I/O threads
+     */
+    std::vector< boost::shared_ptr<ChainIOWorker> > chain_io_workers;
+
+    /// @brief chain_io_bins the indices in chain_mappings of the chains assigned to each I/O thread
+    std::vector< std::vector<unsigned int> > chain_io_bins;
+
+    /**
+     * @brief doChainIO performs an operation on the chains of an I/O thread
+     * @param bin the I/O thread
+     * @param io the operation
+     * @param senseRaw the chain function which reads the driver, for CHAIN_IO_SENSE_RAW
+     * @param command the command in model order, for CHAIN_IO_MOVE
+     */
+    void doChainIO(const unsigned int bin,
+                   const ChainIO io,
+                   const RawSenseFunction senseRaw,
+                   const yarp::sig::Vector* command);
+
+    /**
+     * @brief runChainIO performs an operation on all chains, in parallel if there are I/O workers,
+     * and returns when all chains are done
+     * @param io the operation
+     * @param senseRaw the chain function which reads the driver, for CHAIN_IO_SENSE_RAW
+     * @param command the command in model order, for CHAIN_IO_MOVE
+     */
+    void runChainIO(const ChainIO io,
+                    const RawSenseFunction senseRaw = NULL,
+                    const yarp::sig::Vector* command = NULL);
+
+    /**
+     * @brief buildJointPermutation precomputes the whole body permutation table from the kinematic chains
+     */
+    void buildJointPermutation();
+
+    /**
+     * @brief gather reads all chains in driver_sensed and permutes them in model order, in a single pass
+     * @param senseRaw the chain function which reads the driver
+     * @param convertToSI true if the readings are positions or velocities, which are converted to SI units
+     * @param q the sensed vector, in model order
+     */
+    void gather(const RawSenseFunction senseRaw,
+                const bool convertToSI,
+                yarp::sig::Vector& q);
+
+    /**
+     * @brief scatter permutes a command from model order in driver_commanded, in a single pass, and sends it to all chains
+     * @param q the command, in model order
+     */
+    void scatter(const yarp::sig::Vector& q);
 
     std::string _moduleName;
 
@@ -459,6 +591,18 @@ private:
 
     ftReadings ft_readings;
 
+    /// @brief ft_table_sensors the ft sensors, in ft_reference_frames order
+    std::vector<ftPtr> ft_table_sensors;
+    /// @brief ft_table_readings the preallocated ft readings, in ft_reference_frames order
+    std::vector<yarp::sig::Vector> ft_table_readings;
+    /// @brief ft_table_model_indices the iDyn3 FT sensor index of each ft sensor, in ft_reference_frames order
+    std::vector<int> ft_table_model_indices;
+
+    /**
+     * @brief buildftTable preallocates the ft table and the ft_readings map from the loaded ft sensors
+     */
+    void buildftTable();
+
     walkman::yarp_single_chain_interface* const getChainByName(const std::string chain_name);
 
     bool bodyIsInPositionMode();
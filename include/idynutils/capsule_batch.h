@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CAPSULE_BATCH_H_
+#define _CAPSULE_BATCH_H_
+
+#include <Eigen/Core>
+#include <kdl/frames.hpp>
+#include <vector>
+
+/**
+ * @brief The CapsuleBatch class is a structure-of-arrays store of capsules, together with a list
+ *        of capsule pairs whose distances are computed all at once with a vectorized
+ *        segment-segment kernel (AVX when compiled with -mavx, SSE2 otherwise, with a scalar fallback).
+ *        All buffers are aligned and padded to the SIMD width.
+ */
+class CapsuleBatch
+{
+public:
+    typedef std::vector<double, Eigen::aligned_allocator<double> > AlignedArray;
+
+    CapsuleBatch();
+
+    /**
+     * @brief addCapsule adds a capsule to the store
+     * @param radius the capsule radius
+     * @return the capsule index
+     */
+    unsigned int addCapsule(const double radius);
+
+    /**
+     * @brief setEndPoints updates the endpoints of a capsule axis
+     * @param capsule the capsule index
+     * @param endPoint1 the first endpoint
+     * @param endPoint2 the second endpoint
+     */
+    void setEndPoints(const unsigned int capsule,
+                      const KDL::Vector& endPoint1,
+                      const KDL::Vector& endPoint2);
+
+    /**
+     * @brief addPair adds a pair of capsules whose distance will be computed
+     * @param capsuleA the index of the first capsule
+     * @param capsuleB the index of the second capsule
+     * @return the pair index
+     */
+    unsigned int addPair(const unsigned int capsuleA, const unsigned int capsuleB);
+
+    /**
+     * @brief clearPairs removes all the pairs, capsules are kept
+     */
+    void clearPairs();
+
+    /**
+     * @brief computeDistances computes distances and closest points for all pairs in one vectorized pass
+     */
+    void computeDistances();
+
+    /**
+     * @brief computeDistancesScalar computes distances and closest points for all pairs without SIMD.
+     *        Results are the same of computeDistances, up to rounding
+     */
+    void computeDistancesScalar();
+
+    unsigned int getNrOfCapsules() const;
+    unsigned int getNrOfPairs() const;
+
+    /**
+     * @brief getDistance returns the distance between the capsules of a pair, negative if they intersect
+     * @param pair the pair index
+     * @return the distance computed by the last computeDistances
+     */
+    double getDistance(const unsigned int pair) const;
+
+    /**
+     * @brief getClosestPoints returns the closest points on the surface of the capsules of a pair
+     * @param pair the pair index
+     * @param closestPointA the closest point on the first capsule
+     * @param closestPointB the closest point on the second capsule
+     */
+    void getClosestPoints(const unsigned int pair,
+                          KDL::Vector& closestPointA,
+                          KDL::Vector& closestPointB) const;
+
+    /**
+     * @brief segmentsDistance computes the closest points between segments [A1,A2] and [B1,B2]
+     *        with the scalar version of the batch kernel. It is the segment-segment routine
+     *        shared by the analytic distance kernels and the capsule fitting
+     * @param A1 the first endpoint of the first segment
+     * @param A2 the second endpoint of the first segment
+     * @param B1 the first endpoint of the second segment
+     * @param B2 the second endpoint of the second segment
+     * @param closestPointA the closest point on the first segment
+     * @param closestPointB the closest point on the second segment
+     * @return the distance between the two segments
+     */
+    static double segmentsDistance(const KDL::Vector& A1, const KDL::Vector& A2,
+                                   const KDL::Vector& B1, const KDL::Vector& B2,
+                                   KDL::Vector& closestPointA, KDL::Vector& closestPointB);
+
+    /**
+     * @brief getSIMDWidth returns the number of pairs processed by each instruction
+     * @return 4 with AVX, 2 with SSE2, 1 otherwise
+     */
+    static unsigned int getSIMDWidth();
+
+private:
+    /* capsule store */
+    AlignedArray ep1_x, ep1_y, ep1_z;
+    AlignedArray ep2_x, ep2_y, ep2_z;
+    AlignedArray radius;
+
+    /* pairs */
+    std::vector<unsigned int> pair_a, pair_b;
+
+    /* per-pair inputs, gathered from the capsule store, padded to the SIMD width */
+    AlignedArray a1_x, a1_y, a1_z, a2_x, a2_y, a2_z, r_a;
+    AlignedArray b1_x, b1_y, b1_z, b2_x, b2_y, b2_z, r_b;
+
+    /* per-pair outputs */
+    AlignedArray distance;
+    AlignedArray pa_x, pa_y, pa_z, pb_x, pb_y, pb_z;
+
+    void resizePairBuffers();
+    void gatherPairs();
+    void computePair(const unsigned int i);
+};
+
+#endif
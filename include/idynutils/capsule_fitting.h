@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CAPSULE_FITTING_H_
+#define _CAPSULE_FITTING_H_
+
+#include <kdl/frames.hpp>
+#include <urdf/model.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The CapsuleFitting class fits capsules to the collision geometry of the links of a robot,
+ *        and generates the <robot>_capsules.urdf and <robot>_capsules.srdf models which are
+ *        loaded by ComputeLinksDistance in place of the original ones.
+ *        Box and mesh geometries are replaced by a minimum volume capsule, spheres and cylinders
+ *        (which ComputeLinksDistance already treats as capsules) are kept.
+ */
+class CapsuleFitting
+{
+public:
+    /**
+     * @brief The Capsule class is a capsule, i.e. the set of points within radius from the segment
+     *        between two endpoints
+     */
+    class Capsule
+    {
+    public:
+        KDL::Vector endPoint1;
+        KDL::Vector endPoint2;
+        double radius;
+
+        Capsule();
+
+        Capsule(const KDL::Vector& endPoint1,
+                const KDL::Vector& endPoint2,
+                const double radius);
+
+        double getLength() const;
+
+        double getVolume() const;
+
+        /**
+         * @brief getOrigin returns a frame in the middle of the capsule axis, with z-axis along the axis,
+         *        which is the origin of the equivalent URDF cylinder
+         * @return the capsule origin
+         */
+        KDL::Frame getOrigin() const;
+
+        /**
+         * @brief contains tells whether a point is inside the capsule
+         * @param point the point
+         * @param tolerance the tolerance on the distance from the capsule axis
+         * @return true if the point is inside the capsule
+         */
+        bool contains(const KDL::Vector& point,
+                      const double tolerance = 1E-9) const;
+    };
+
+    /**
+     * @brief fitCapsule fits a capsule of (locally) minimum volume which contains all the points.
+     *        For each candidate axis direction the axis is placed in the center of the minimum enclosing
+     *        circle of the projected points, and the radius is chosen to minimize the volume;
+     *        directions are sampled on the unit hemisphere and then refined
+     * @param points the points, at least one
+     * @param capsule the fitted capsule
+     * @return false if there are no points
+     */
+    static bool fitCapsule(const std::vector<KDL::Vector>& points,
+                           Capsule& capsule);
+
+    /**
+     * @brief getCollisionPoints returns the vertices of the collision geometry of a link,
+     *        loaded the same way ComputeLinksDistance does. Only boxes and meshes are supported
+     * @param link the link
+     * @param points the vertices, in link frame
+     * @return false if the link has no box or mesh collision geometry, or the mesh cannot be loaded
+     */
+    static bool getCollisionPoints(const boost::shared_ptr<const urdf::Link>& link,
+                                   std::vector<KDL::Vector>& points);
+
+    /**
+     * @brief generateCapsuleModel fits a capsule to the collision geometry of each link and writes the capsule models.
+     *        The capsule SRDF is the original one, plus the disabled collisions between the capsules
+     *        which intersect in the zero configuration
+     * @param robot_urdf_path the original URDF
+     * @param robot_srdf_path the original SRDF
+     * @param capsule_urdf_path the capsule URDF to write
+     * @param capsule_srdf_path the capsule SRDF to write
+     * @return true on success
+     */
+    static bool generateCapsuleModel(const std::string& robot_urdf_path,
+                                     const std::string& robot_srdf_path,
+                                     const std::string& capsule_urdf_path,
+                                     const std::string& capsule_srdf_path);
+
+    /**
+     * @brief generateCapsuleModel fits a capsule to the collision geometry of each link and writes the
+     *        capsule models next to the original ones, with the _capsules suffix
+     * @param robot_urdf_path the original URDF
+     * @param robot_srdf_path the original SRDF
+     * @return true on success
+     */
+    static bool generateCapsuleModel(const std::string& robot_urdf_path,
+                                     const std::string& robot_srdf_path);
+
+    /**
+     * @brief getCapsuleModelPath returns the path of the capsule model of a URDF or SRDF,
+     *        i.e. <robot>_capsules.urdf for <robot>.urdf
+     * @param robot_model_path the original URDF or SRDF
+     * @return the capsule model path
+     */
+    static std::string getCapsuleModelPath(const std::string& robot_model_path);
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _COLLISION_GEOMETRY_CACHE_H_
+#define _COLLISION_GEOMETRY_CACHE_H_
+
+#include <fcl/BVH/BVH_model.h>
+#include <kdl/frames.hpp>
+#include <urdf/model.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The CollisionGeometryCache class is a binary cache of the mesh collision geometries of a robot,
+ *        i.e. vertices, triangles and link_T_shape of each mesh link, so that meshes are not loaded
+ *        with shapes::createMeshFromResource at every start.
+ *        The cache is keyed by a hash of the content of the URDF and of the meshes, and it is loaded with mmap.
+ *        Data is stored in native byte order, so the cache is not meant to be shared between machines.
+ */
+class CollisionGeometryCache
+{
+public:
+    /**
+     * @brief CACHE_VERSION is increased every time the cache layout changes
+     */
+    static const uint32_t CACHE_VERSION = 1;
+
+    /**
+     * @brief The Mesh class points to the data of a mesh in the cache
+     */
+    class Mesh {
+    public:
+        KDL::Frame link_T_shape;
+        const double* vertices;
+        uint32_t numberOfVertices;
+        const uint32_t* triangles;
+        uint32_t numberOfTriangles;
+    };
+
+    CollisionGeometryCache();
+
+    ~CollisionGeometryCache();
+
+    /**
+     * @brief computeKey hashes the content of the URDF and of the meshes of its links
+     * @param robot_urdf_path the URDF path
+     * @param robot_urdf the parsed URDF
+     * @return the cache key
+     */
+    static uint64_t computeKey(const std::string& robot_urdf_path,
+                               const urdf::Model& robot_urdf);
+
+    /**
+     * @brief getCachePath returns the path of the cache of a URDF, i.e. <robot>_collision_geometry.cache next to it
+     * @param robot_urdf_path the URDF path
+     * @return the cache path
+     */
+    static std::string getCachePath(const std::string& robot_urdf_path);
+
+    /**
+     * @brief load maps a cache file in memory
+     * @param path the cache path
+     * @param key the expected key
+     * @return false if the file does not exist, is corrupted, or has a different version or key
+     */
+    bool load(const std::string& path, const uint64_t key);
+
+    /**
+     * @brief getMesh returns the mesh of a link from the loaded cache. The mesh data is valid until the cache is destroyed
+     * @param linkName the link name
+     * @param mesh the mesh
+     * @return false if the link is not in the cache
+     */
+    bool getMesh(const std::string& linkName, Mesh& mesh) const;
+
+    /**
+     * @brief addMesh adds the mesh of a link to the cache which will be written by save
+     * @param linkName the link name
+     * @param link_T_shape the shape pose in link frame
+     * @param vertices the mesh vertices, in shape frame
+     * @param triangles the mesh triangles
+     */
+    void addMesh(const std::string& linkName,
+                 const KDL::Frame& link_T_shape,
+                 const std::vector<fcl::Vec3f>& vertices,
+                 const std::vector<fcl::Triangle>& triangles);
+
+    /**
+     * @brief getNrOfAddedMeshes returns the number of meshes added since construction
+     * @return the number of added meshes
+     */
+    unsigned int getNrOfAddedMeshes() const;
+
+    /**
+     * @brief save writes the added meshes in a cache file, atomically
+     * @param path the cache path
+     * @param key the cache key
+     * @return true on success
+     */
+    bool save(const std::string& path, const uint64_t key) const;
+
+private:
+    /**
+     * @brief mapped_data, mapped_size the memory mapped cache file
+     */
+    void* mapped_data;
+    size_t mapped_size;
+
+    /**
+     * @brief meshes the meshes of the loaded cache, by link name
+     */
+    std::map<std::string, Mesh> meshes;
+
+    /**
+     * @brief records the records of the added meshes, which are written by save
+     */
+    std::vector<char> records;
+    unsigned int number_of_records;
+
+    void unload();
+};
+
+#endif
@@ -21,11 +21,17 @@
 #define _COLLISION_UTILS_H_
 
 #include <kdl/frames.hpp>
+#include <idynutils/capsule_batch.h>
 #include <idynutils/idynutils.h>
 #include <limits>
 #include <list>
+#include <map>
+#include <stdint.h>
 #include <string>
 #include <utility>
+#include <vector>
+
+class IncrementalForwardKinematics;
 
 /**
  * @brief The LinkPairDistance class represents the minimum distance information between two links.
@@ -56,6 +62,11 @@ private:
      * ||w_T_closestPoint1.p - w_T_closesPoint2.p||
      */
     double distance;
+    /**
+     * @brief distance_jacobian the 1 x nDOF jacobian of the distance w.r.t. the joint positions,
+     *        empty if it was not computed
+     */
+    yarp::sig::Matrix distance_jacobian;
 
 public:
     /**
@@ -70,6 +81,20 @@ public:
                      const KDL::Frame& link1_T_closestPoint1, const KDL::Frame& link2_T_closestPoint2,
                      const double& distance);
 
+    /**
+     * @brief LinkPairDistance creates an instance of a link pair distance data structure, with distance jacobian
+     * @param link1 the first link name
+     * @param link2 the second link name
+     * @param link1_T_closestPoint1 the transform from the first link frame to the closest point on its shape
+     * @param link2_T_closesPoint2 the transform from the second link frame to the closest point on its shape
+     * @param distance the distance between the two minimum distance points
+     * @param distance_jacobian the 1 x nDOF jacobian of the distance w.r.t. the joint positions
+     */
+    LinkPairDistance(const std::string& link1, const std::string& link2,
+                     const KDL::Frame& link1_T_closestPoint1, const KDL::Frame& link2_T_closestPoint2,
+                     const double& distance,
+                     const yarp::sig::Matrix& distance_jacobian);
+
     /**
      * @brief getDistance returns the minimum distance between the two link shapes
      * @return a double representing the minimum distance
@@ -84,6 +109,14 @@ public:
      */
     const std::pair<KDL::Frame, KDL::Frame>& getLink_T_closestPoint() const;
 
+    /**
+     * @brief getDistanceJacobian returns the jacobian of the distance w.r.t. the joint positions,
+     *        i.e. n^T (J_closestPoint1 - J_closestPoint2), n being the normalized distance vector.
+     *        It is computed only if enabled with ComputeLinksDistance::setDistanceJacobians
+     * @return a 1 x nDOF matrix, empty if the jacobian was not computed
+     */
+    const yarp::sig::Matrix& getDistanceJacobian() const;
+
     /**
      * @brief getLinkNames returns the pair of links between which we want express the distance information
      * @return a pair of strings
@@ -101,10 +134,64 @@ public:
     bool operator <(const LinkPairDistance& second) const;
 };
 
+/**
+ * @brief The LinkPairDistanceRecord struct is a plain data version of LinkPairDistance,
+ *        used to return distances in a caller owned buffer without any allocation.
+ *        Link names can be retrieved through ComputeLinksDistance::getLinkName
+ */
+struct LinkPairDistanceRecord {
+    /**
+     * @brief pairId the index of the pair among the pairs checked by ComputeLinksDistance
+     */
+    unsigned int pairId;
+    /**
+     * @brief linkA, linkB the link IDs of the two links
+     */
+    unsigned int linkA;
+    unsigned int linkB;
+    /**
+     * @brief distance the minimum distance between the two link shapes
+     */
+    double distance;
+    /**
+     * @brief linkA_closestPoint the closest point on the first link shape, in the first link frame
+     */
+    double linkA_closestPoint[3];
+    /**
+     * @brief linkB_closestPoint the closest point on the second link shape, in the second link frame
+     */
+    double linkB_closestPoint[3];
+};
+
 class ComputeLinksDistance {
 public:
     friend class TestCapsuleLinksDistance;
 
+    /**
+     * @brief The ConvexHullReport class reports the accuracy and speed trade-off of replacing the mesh of a link
+     *        with its convex hull, measured with probe spheres just outside the faces of the mesh, so that
+     *        concave regions, where the hull is farther from the mesh, are measured too
+     */
+    class ConvexHullReport {
+    public:
+        std::string linkName;
+        unsigned int meshVertices;
+        unsigned int meshTriangles;
+        unsigned int hullVertices;
+        unsigned int hullTriangles;
+        /**
+         * @brief meanDistanceError, maxDistanceError the mesh distance minus the hull distance from the probes,
+         *        which is not negative since the hull contains the mesh
+         */
+        double meanDistanceError;
+        double maxDistanceError;
+        /**
+         * @brief meshDistanceTime, hullDistanceTime the mean time of a distance query with the mesh and with the hull
+         */
+        double meshDistanceTime;
+        double hullDistanceTime;
+    };
+
     /**
      * @brief The Capsule class represents a capsule shape expressed in an arbitrary frame
      */
@@ -134,29 +221,58 @@ public:
 
     class LinksPair {
     public:
-        std::string linkA;
-        std::string linkB;
+        /**
+         * @brief linkA, linkB the link IDs of the two links in the pair
+         */
+        unsigned int linkA;
+        unsigned int linkB;
         boost::shared_ptr<fcl::CollisionObject> collisionObjectA;
         boost::shared_ptr<fcl::CollisionObject> collisionObjectB;
         boost::shared_ptr<ComputeLinksDistance::Capsule> capsuleA;
         boost::shared_ptr<ComputeLinksDistance::Capsule> capsuleB;
+        /**
+         * @brief capsulePairIndex the index of the pair in the capsule batch, -1 if the pair is not capsule-capsule
+         */
+        int capsulePairIndex;
+        /**
+         * @brief cacheValid true if cachedDistance has been computed for this pair
+         */
+        bool cacheValid;
+        /**
+         * @brief cachedDistance the distance computed by the last getLinkDistances which checked this pair
+         */
+        double cachedDistance;
+        /**
+         * @brief cached_w_T_shapeA, cached_w_T_shapeB the shape poses used to compute cachedDistance
+         */
+        fcl::Transform3f cached_w_T_shapeA, cached_w_T_shapeB;
+        /**
+         * @brief cost the estimated cost of the narrow phase of the pair, used to balance the worker threads
+         */
+        double cost;
 
-        LinksPair(ComputeLinksDistance* const father, std::string linkA, std::string linkB) :
-            linkA(linkA), linkB(linkB)
+        LinksPair(ComputeLinksDistance* const father, unsigned int linkA, unsigned int linkB) :
+            linkA(linkA), linkB(linkB), capsulePairIndex(-1),
+            cacheValid(false), cachedDistance(0.0), cost(1.0)
         {
-            collisionObjectA = father->collision_objects_[linkA];
-            collisionObjectB = father->collision_objects_[linkB];
-            if(father->custom_capsules_.count(linkA) > 0)
-                capsuleA = father->custom_capsules_[linkA];
+            const std::string& linkAName = father->link_names[linkA];
+            const std::string& linkBName = father->link_names[linkB];
+            collisionObjectA = father->collision_objects_[linkAName];
+            collisionObjectB = father->collision_objects_[linkBName];
+            if(father->custom_capsules_.count(linkAName) > 0)
+                capsuleA = father->custom_capsules_[linkAName];
 
-            if(father->custom_capsules_.count(linkB) > 0)
-                capsuleB = father->custom_capsules_[linkB];
+            if(father->custom_capsules_.count(linkBName) > 0)
+                capsuleB = father->custom_capsules_[linkBName];
         }
 
     };
 
     friend class ComputeLinksDistance::LinksPair;
 
+    class NarrowPhaseWorker;
+    friend class ComputeLinksDistance::NarrowPhaseWorker;
+
 private:
     collision_detection::AllowedCollisionMatrixPtr allowed_collision_matrix;
 
@@ -167,9 +283,10 @@ private:
     iDynUtils& model;
 
     /**
-     * @brief robot_srdf is used to load the ACM every time a whiteList or blackList is generated
+     * @brief robot_srdf is used to load the ACM every time a whiteList or blackList is generated.
+     *        It is shared with the model, unless a capsule srdf is loaded
      */
-    srdf::Model robot_srdf;
+    boost::shared_ptr<srdf::Model> robot_srdf;
 
     /**
      * @brief shapes_ is a map of collision geometries
@@ -181,6 +298,18 @@ private:
      */
     std::map<std::string,boost::shared_ptr<ComputeLinksDistance::Capsule> > custom_capsules_;
 
+    /**
+     * @brief capsule_batch a structure-of-arrays store of all custom capsules, used to compute
+     *        the distances of all capsule-capsule pairs in one vectorized pass
+     */
+    CapsuleBatch capsule_batch;
+
+
+    /**
+     * @brief updateCapsuleBatch updates the capsule endpoints in capsule_batch from the collision objects
+     */
+    void updateCapsuleBatch();
+
     /**
      * @brief collision_objects_ a map of collision objects
      */
@@ -188,11 +317,44 @@ private:
 
     /**
      * @brief link_T_shape a map of transforms from link frame to shape frame.
-     *        Notice how the shape frame is always the center of the shape,
-     *        except for the capsule, where it lies on one endpoint
+     *        Notice how the shape frame is always the center of the shape, as fcl assumes,
+     *        while custom_capsules_ have their frame on one endpoint
      */
     std::map<std::string,KDL::Frame> link_T_shape;
 
+    /* The maps above are keyed by link name and are only used at the API boundary.
+       Per-tick computations use the following arrays, indexed by a dense link ID */
+
+    /**
+     * @brief link_ids maps link names to link IDs
+     */
+    std::map<std::string,unsigned int> link_ids;
+
+    /**
+     * @brief link_names the link name of each link ID
+     */
+    std::vector<std::string> link_names;
+
+    /**
+     * @brief link_collision_objects the collision object of each link ID
+     */
+    std::vector<fcl::CollisionObject*> link_collision_objects;
+
+    /**
+     * @brief link_T_shapes the transform from link frame to shape frame of each link ID
+     */
+    std::vector<KDL::Frame> link_T_shapes;
+
+    /**
+     * @brief link_model_indices the iDyn3 link index of each link ID
+     */
+    std::vector<int> link_model_indices;
+
+    /**
+     * @brief link_capsule_indices the capsule index in capsule_batch of each link ID, -1 if the shape is not a capsule
+     */
+    std::vector<int> link_capsule_indices;
+
     /**
      * @brief globalToLinkCoordinates transforms a fcl::Transform3f frame to a KDL::Frame in the link reference frame
      * @param linkName the link name representing a link reference frame
@@ -204,6 +366,17 @@ private:
                                  const fcl::Transform3f& w_T_f,
                                  KDL::Frame& link_T_f);
 
+    /**
+     * @brief globalToLinkCoordinates transforms a fcl::Transform3f frame to a KDL::Frame in the link reference frame
+     * @param link the link ID
+     * @param w_T_f fcl::Transform3f representing a frame in a global reference frame
+     * @param link_T_f a KDL::Frame representing a frame in link reference frame
+     * @return true on success
+     */
+    bool globalToLinkCoordinates(const unsigned int link,
+                                 const fcl::Transform3f& w_T_f,
+                                 KDL::Frame& link_T_f);
+
     /**
      * @brief shapeToLinkCoordinates transforms a fcl::Transform3f frame to a KDL::Frame in the link reference frame
      * @param linkName the link name representing a link reference frame
@@ -215,6 +388,17 @@ private:
                                 const fcl::Transform3f &fcl_shape_T_f,
                                 KDL::Frame &link_T_f);
 
+    /**
+     * @brief shapeToLinkCoordinates transforms a fcl::Transform3f frame to a KDL::Frame in the link reference frame
+     * @param link the link ID
+     * @param fcl_shape_T_f fcl::Transform3f representing a frame in the shape reference frame
+     * @param link_T_f a KDL::Frame representing a frame in link reference frame
+     * @return true on success
+     */
+    bool shapeToLinkCoordinates(const unsigned int link,
+                                const fcl::Transform3f &fcl_shape_T_f,
+                                KDL::Frame &link_T_f);
+
 
     /* FOLLOWING FUNCTIONS WILL LOAD AND UPDATE GEOMETRIES. NOTICE THAT A VALID ALTERNATIVE TO THIS
        IS TO USE MOVEIT. Since Moveit does not support capsules ATM, one idea could be to update the interal
@@ -224,12 +408,12 @@ private:
        moveit equivalents to parseCollisionObjects and updateCollisionObjects*/
     /**
      * @brief parseCollisionObjects
-     * @param robot_urdf_path a string representing the robot urdf with collision information
-     * @param robot_srdf_path a string representing the robot srdf with collision information (i.e. ACM)
+     * @param robot_urdf the robot urdf with collision information
+     * @param robot_urdf_path the path of robot_urdf, next to which the collision geometry caches are stored
      * @return true on success
      */
-    bool parseCollisionObjects(const std::string& robot_urdf_path,
-                               const std::string &robot_srdf_path);
+    bool parseCollisionObjects(const urdf::Model& robot_urdf,
+                               const std::string& robot_urdf_path);
 
     /**
      * @brief updateCollisionObjects updates all collision objects with correct transforms (link_T_shape)
@@ -237,6 +421,14 @@ private:
      */
     bool updateCollisionObjects();
 
+    /**
+     * @brief updateCollisionObjects updates all collision objects with link poses computed by fk
+     *        instead of the model, so that the model state is not modified
+     * @param fk the forward kinematics used to compute w_T_link
+     * @return true on success
+     */
+    bool updateCollisionObjects(const IncrementalForwardKinematics& fk);
+
     /**
      * @brief KDL2fcl ceonverts a kdl transform into a fcl transform
      * @param in a KDL::Frame
@@ -252,29 +444,470 @@ private:
     KDL::Frame fcl2KDL(const fcl::Transform3f &in);
 
     /**
-     * @brief generateLinksToUpdate generates a list of links for which we query w_T_link
+     * @brief generateLinksToUpdate generates a list of links for which we query w_T_link,
+     *        i.e. the links in pairsToCheck. It must be called after generatePairsToCheck
      */
     void generateLinksToUpdate();
 
     /**
-     * @brief linksToUpdate a list of links to update
+     * @brief linksToUpdate the sorted IDs of the links to update
+     */
+    std::vector<unsigned int> linksToUpdate;
+
+    /**
+     * @brief broad_phase if true, getLinkDistances skips the narrow phase for pairs
+     *        whose bounding boxes are farther apart than the detection threshold
+     */
+    bool broad_phase;
+
+    /**
+     * @brief broad_phase_min, broad_phase_max the world axis aligned bounding box of each link ID,
+     *        inflated by half the detection threshold
+     */
+    std::vector<KDL::Vector> broad_phase_min, broad_phase_max;
+
+    /**
+     * @brief broad_phase_order the IDs in linksToUpdate sorted by broad_phase_min.x().
+     *        The order is kept between calls, so that sorting is almost linear for small motions
+     */
+    std::vector<unsigned int> broad_phase_order;
+
+    /**
+     * @brief broad_phase_overlaps a matrix whose element (i,j) is true if the inflated bounding boxes
+     *        of link IDs i and j overlap
+     */
+    std::vector<bool> broad_phase_overlaps;
+
+    /**
+     * @brief culled_pairs the number of pairs rejected by the broad phase during the last getLinkDistances
+     */
+    unsigned int culled_pairs;
+
+    /**
+     * @brief shape_reach for each link ID, an upper bound of the distance between
+     *        the shape frame origin and any point of the shape
+     */
+    std::vector<double> shape_reach;
+
+    /**
+     * @brief getShapeReach computes an upper bound of the distance between the shape frame origin
+     *        and any point of the shape
+     * @param link the link ID
+     * @return the bound
+     */
+    double getShapeReach(const unsigned int link);
+
+    /**
+     * @brief distance_cache if true, getLinkDistances skips pairs whose cached distance, minus
+     *        the maximum displacement of both shapes since it was computed, is above the detection threshold
+     */
+    bool distance_cache;
+
+    /**
+     * @brief cache_queries the number of pairs tested against the cache during the last getLinkDistances
+     */
+    unsigned int cache_queries;
+
+    /**
+     * @brief cache_hits the number of pairs skipped thanks to the cache during the last getLinkDistances
+     */
+    unsigned int cache_hits;
+
+    /**
+     * @brief cache_time_saved an estimate of the narrow phase time saved by the cache
+     *        during the last getLinkDistances, in seconds
+     */
+    double cache_time_saved;
+
+    /**
+     * @brief getShapeDisplacement computes an upper bound of the displacement of any point of a shape
+     *        between two poses
+     * @param w_T_shape0 the first shape pose
+     * @param w_T_shape1 the second shape pose
+     * @param reach the shape reach, as computed by getShapeReach
+     * @return the bound
      */
-    std::set<std::string> linksToUpdate;
+    static double getShapeDisplacement(const fcl::Transform3f& w_T_shape0,
+                                       const fcl::Transform3f& w_T_shape1,
+                                       const double reach);
 
     /**
-     * @brief generatePairsToCheck generates a list of pairs to check for distance
+     * @brief link_distances_tic the time at which the last distance computation started
+     */
+    double link_distances_tic;
+
+    /**
+     * @brief broad_phase_inflation the inflation of the bounding boxes computed by the last updateBroadPhase
+     */
+    double broad_phase_inflation;
+
+    /**
+     * @brief closest_pairs_bounds a preallocated buffer of (distance lower bound, pair index), used by getClosestLinkPairs
+     */
+    std::vector< std::pair<double,unsigned int> > closest_pairs_bounds;
+
+    /**
+     * @brief closest_pairs_heap a preallocated max-heap of (distance, pair index) of the k closest pairs
+     *        found so far, used by getClosestLinkPairs
+     */
+    std::vector< std::pair<double,unsigned int> > closest_pairs_heap;
+
+    /**
+     * @brief beginLinkDistances updates collision objects, broad phase and capsule batch,
+     *        and resets the statistics, before the pairs are checked
+     * @param detectionThreshold the detection threshold
+     * @param compute_bounding_boxes if true, the link bounding boxes are computed even if the broad phase is not used
+     */
+    void beginLinkDistances(const double detectionThreshold,
+                            const bool compute_bounding_boxes = false);
+
+    /**
+     * @brief endLinkDistances computes the statistics after the pairs have been checked
+     */
+    void endLinkDistances();
+
+    /**
+     * @brief computeLinksPairDistance computes the distance of a pair, unless the pair is culled by the
+     *        broad phase or skipped thanks to the distance cache
+     * @param pair the pair to check
+     * @param detectionThreshold the detection threshold
+     * @param distance the pair distance
+     * @param linkA_pA the closest point on the first shape, in the first link frame
+     * @param linkB_pB the closest point on the second shape, in the second link frame
+     * @return true if the distance is smaller than the detection threshold. If false, the closest points are not computed
+     */
+    bool computeLinksPairDistance(ComputeLinksDistance::LinksPair& pair,
+                                  const double detectionThreshold,
+                                  double& distance,
+                                  KDL::Frame& linkA_pA,
+                                  KDL::Frame& linkB_pB);
+
+    /**
+     * @brief isPairSkipped tells whether a pair is culled by the broad phase or skipped thanks to the distance cache,
+     *        and updates the broad phase and cache statistics
+     * @param pair the pair to check
+     * @param detectionThreshold the detection threshold
+     * @return true if the pair distance is surely not smaller than the detection threshold
+     */
+    bool isPairSkipped(const ComputeLinksDistance::LinksPair& pair,
+                       const double detectionThreshold);
+
+    /**
+     * @brief computeNarrowPhase computes the distance of a pair, and stores it in the distance cache
+     * @param pair the pair to check
+     * @param detectionThreshold the detection threshold
+     * @param distance the pair distance
+     * @param linkA_pA the closest point on the first shape, in the first link frame
+     * @param linkB_pB the closest point on the second shape, in the second link frame
+     * @return true if the distance is smaller than the detection threshold. If false, the closest points are not computed
+     */
+    bool computeNarrowPhase(ComputeLinksDistance::LinksPair& pair,
+                            const double detectionThreshold,
+                            double& distance,
+                            KDL::Frame& linkA_pA,
+                            KDL::Frame& linkB_pB);
+
+    /**
+     * @brief getCachedLowerBound computes a lower bound of the pair distance from its cached distance
+     * @param pair a pair with a valid cached distance
+     * @return the lower bound
+     */
+    double getCachedLowerBound(const ComputeLinksDistance::LinksPair& pair);
+
+    /**
+     * @brief getBoundingBoxesDistance computes the distance between the bounding boxes of two links,
+     *        which is a lower bound of the distance between their shapes.
+     *        Bounding boxes must have been computed by updateBroadPhase
+     * @param linkA the first link ID
+     * @param linkB the second link ID
+     * @return the distance between the bounding boxes, 0 if they overlap
+     */
+    double getBoundingBoxesDistance(const unsigned int linkA, const unsigned int linkB);
+
+    /**
+     * @brief updateBroadPhase computes the bounding boxes of all links, inflated by half the detection threshold,
+     *        and finds the overlapping ones by sweep and prune along the x-axis
+     * @param detectionThreshold the detection threshold used by getLinkDistances
+     */
+    void updateBroadPhase(const double detectionThreshold);
+
+    /**
+     * @brief generatePairsToCheck generates a list of pairs to check for distance,
+     *        with a single scan of the allowed collision matrix
      */
     void generatePairsToCheck();
 
     /**
-     * @brief pairsToCheck a list of pairs to check for collision detection
+     * @brief pairsToCheck the pairs to check for collision detection
+     */
+    std::vector< ComputeLinksDistance::LinksPair > pairsToCheck;
+
+    /**
+     * @brief generateLinkMotionBounds generates, for each link with a collision object, the list of
+     *        DOFs which move the link together with an upper bound on the distance between each joint axis
+     *        and any point of the link shape. The bounds do not depend on the robot configuration
+     */
+    void generateLinkMotionBounds();
+
+    /**
+     * @brief link_motion_bounds for each link ID, pairs of (DOF index, distance bound). For prismatic joints
+     *        the bound is 1.0, since every point of the link moves as much as the joint does
+     */
+    std::vector< std::vector< std::pair<int,double> > > link_motion_bounds;
+
+    /**
+     * @brief ccd_max_iterations the maximum number of conservative advancement steps of checkContinuousCollision
      */
-    std::list< ComputeLinksDistance::LinksPair > pairsToCheck;
+    unsigned int ccd_max_iterations;
+
+    /**
+     * @brief ccd_iterations the number of conservative advancement steps of the last checkContinuousCollision
+     */
+    unsigned int ccd_iterations;
+
+    /**
+     * @brief ccd_converged false if the last checkContinuousCollision hit ccd_max_iterations
+     */
+    bool ccd_converged;
+
+    /**
+     * @brief The LinkJoint struct describes a joint on the kinematic path from the root to a link
+     */
+    struct LinkJoint {
+        /**
+         * @brief dof the DOF index of the joint
+         */
+        int dof;
+        /**
+         * @brief parent_index the iDyn3 index of the link the joint is attached to
+         */
+        int parent_index;
+        /**
+         * @brief origin the joint origin, in the parent link frame
+         */
+        KDL::Vector origin;
+        /**
+         * @brief axis the joint axis, in the parent link frame
+         */
+        KDL::Vector axis;
+        /**
+         * @brief prismatic true if the joint is prismatic
+         */
+        bool prismatic;
+    };
+
+    /**
+     * @brief link_joints for each link ID, the movable joints on the path from the root to the link
+     */
+    std::vector< std::vector<LinkJoint> > link_joints;
+
+    /**
+     * @brief generateLinkJoints generates link_joints
+     */
+    void generateLinkJoints();
+
+    /**
+     * @brief distance_jacobians if true, getLinkDistances and getClosestLinkPairs compute the distance jacobian
+     *        of each returned pair
+     */
+    bool distance_jacobians;
+
+    /**
+     * @brief joint_axes, joint_origins world joint axis and origin of each DOF. They are computed at most
+     *        once per query, and shared by all pairs whose kinematic paths contain the joint
+     */
+    std::vector<KDL::Vector> joint_axes, joint_origins;
+
+    /**
+     * @brief joint_stamps the query in which joint_axes and joint_origins were computed for each DOF
+     */
+    std::vector<unsigned int> joint_stamps;
+
+    /**
+     * @brief query_stamp the current query, incremented by beginLinkDistances
+     */
+    unsigned int query_stamp;
+
+    /**
+     * @brief updateJoint computes the world axis and origin of a joint, if not already done in the current query
+     * @param joint the joint
+     */
+    void updateJoint(const LinkJoint& joint);
+
+    /**
+     * @brief computeDistanceJacobian computes the jacobian of the distance of a pair w.r.t. the joint positions,
+     *        using only the joints on the kinematic paths of the two links
+     * @param pair the pair
+     * @param linkA_pA the closest point on the first shape, in the first link frame
+     * @param linkB_pB the closest point on the second shape, in the second link frame
+     * @param distance the pair distance
+     * @param distance_jacobian a 1 x nDOF matrix, zero for joints not on the two paths
+     */
+    void computeDistanceJacobian(const ComputeLinksDistance::LinksPair& pair,
+                                 const KDL::Frame& linkA_pA,
+                                 const KDL::Frame& linkB_pB,
+                                 const double distance,
+                                 yarp::sig::Matrix& distance_jacobian);
+
+    /**
+     * @brief analytic_kernels if true, capsule and sphere pairs use closed-form distance kernels
+     *        instead of fcl::distance
+     */
+    bool analytic_kernels;
+
+    /**
+     * @brief analyticDistance computes the distance between a pair of capsules and/or spheres
+     *        with closed-form kernels
+     * @param pair the link pair
+     * @param distance the distance between the two shapes
+     * @param w_pA the closest point on the first shape, in world frame
+     * @param w_pB the closest point on the second shape, in world frame
+     * @return false if the pair contains a shape which is not a capsule or a sphere
+     */
+    bool analyticDistance(const ComputeLinksDistance::LinksPair& pair,
+                          double& distance,
+                          KDL::Vector& w_pA,
+                          KDL::Vector& w_pB);
+
+    /**
+     * @brief pair_in_threshold, pair_distances, pair_linkA_pA, pair_linkB_pB the results of
+     *        computePairsDistances, indexed by pair. Closest points are valid only for pairs in threshold.
+     *        getClosestLinkPairs stores its narrow phase results in pair_distances, pair_linkA_pA and pair_linkB_pB
+     */
+    std::vector<char> pair_in_threshold;
+    std::vector<double> pair_distances;
+    std::vector<KDL::Frame> pair_linkA_pA;
+    std::vector<KDL::Frame> pair_linkB_pB;
+
+    /**
+     * @brief pairs_by_cost the pair indices, sorted by decreasing LinksPair::cost
+     */
+    std::vector<unsigned int> pairs_by_cost;
+
+    /**
+     * @brief narrow_phase_workers the persistent worker threads. The calling thread works as well,
+     *        so there is one worker less than the number of threads
+     */
+    std::vector< boost::shared_ptr<NarrowPhaseWorker> > narrow_phase_workers;
+
+    /**
+     * @brief narrow_phase_bins, narrow_phase_bin_costs the pairs assigned to each thread, and their total cost
+     */
+    std::vector< std::vector<unsigned int> > narrow_phase_bins;
+    std::vector<double> narrow_phase_bin_costs;
+
+    /**
+     * @brief narrow_phase_threshold the detection threshold used by the worker threads
+     */
+    double narrow_phase_threshold;
+
+    /**
+     * @brief estimatePairCost estimates the relative cost of the narrow phase of a pair from its shapes
+     * @param pair the link pair
+     * @return the estimated cost
+     */
+    double estimatePairCost(const ComputeLinksDistance::LinksPair& pair);
+
+    /**
+     * @brief computePairsDistances runs the broad phase test, the cache test and the narrow phase of all pairs,
+     *        on the narrow phase worker threads if more than one thread is used,
+     *        and stores the results in pair_in_threshold, pair_distances, pair_linkA_pA and pair_linkB_pB
+     * @param detectionThreshold the detection threshold
+     */
+    void computePairsDistances(const double detectionThreshold);
+
+    /**
+     * @brief computeNarrowPhaseBin computes the narrow phase of the pairs assigned to a thread
+     * @param bin the thread index
+     */
+    void computeNarrowPhaseBin(const unsigned int bin);
+
+    /**
+     * @brief convex_hulls if true, meshes are replaced by their convex hulls
+     */
+    bool convex_hulls;
+
+    /**
+     * @brief report_convex_hulls if true, each convex hull is compared with its mesh when loaded
+     */
+    bool report_convex_hulls;
+
+    /**
+     * @brief convex_hulls_report the report of each mesh replaced by its convex hull
+     */
+    std::vector<ConvexHullReport> convex_hulls_report;
+
+    /**
+     * @brief generateConvexHull loads the convex hull of a link mesh from the cache, computing and caching it
+     *        if it is missing or was computed from different meshes. If report_convex_hulls is true,
+     *        the hull is compared with the mesh and the link is added to the convex hulls report
+     * @param linkName the link name
+     * @param robot_urdf_path the URDF, the cache is in the <robot>_convex_hulls directory next to it
+     * @param key the hash of the URDF and of the meshes, see CollisionGeometryCache::computeKey
+     * @param vertices the mesh vertices, in shape frame
+     * @param triangles the mesh triangles
+     * @return the convex hull, or an empty pointer if it cannot be computed
+     */
+    boost::shared_ptr<fcl::CollisionGeometry> generateConvexHull(const std::string& linkName,
+                                                                 const std::string& robot_urdf_path,
+                                                                 const uint64_t key,
+                                                                 const std::vector<fcl::Vec3f>& vertices,
+                                                                 const std::vector<fcl::Triangle>& triangles);
+
+    /**
+     * @brief reportConvexHull compares a convex hull with its mesh, and adds the link to the convex hulls report
+     * @param linkName the link name
+     * @param vertices the mesh vertices, in shape frame
+     * @param triangles the mesh triangles
+     * @param hull the convex hull
+     */
+    void reportConvexHull(const std::string& linkName,
+                          const std::vector<fcl::Vec3f>& vertices,
+                          const std::vector<fcl::Triangle>& triangles,
+                          const boost::shared_ptr<fcl::CollisionGeometry>& hull);
+
+    /**
+     * @brief loadConvexHull loads a convex hull from an OFF file
+     * @param path the file path
+     * @param key the expected key, written in the OFF file as a comment
+     * @param vertices the hull vertices
+     * @param triangles the hull triangles, as triplets of vertex indices
+     * @return false if the file does not exist, is corrupted, or has a different key
+     */
+    static bool loadConvexHull(const std::string& path,
+                               const uint64_t key,
+                               std::vector<KDL::Vector>& vertices,
+                               std::vector<unsigned int>& triangles);
+
+    /**
+     * @brief saveConvexHull saves a convex hull to an OFF file
+     * @param path the file path
+     * @param key the key of the meshes the hull has been computed from
+     * @param vertices the hull vertices
+     * @param triangles the hull triangles, as triplets of vertex indices
+     * @return true on success
+     */
+    static bool saveConvexHull(const std::string& path,
+                               const uint64_t key,
+                               const std::vector<KDL::Vector>& vertices,
+                               const std::vector<unsigned int>& triangles);
 
 public:
     /* NOTICE THAT BY USING MOVEIT WE CAN PASS JUST THE MOVEIT_COLLISION_ROBOT TO THE CONSTRUCTOR. At that point
        we must make sure that the collision robot has an updated state before calling getLinkDistances */
-    ComputeLinksDistance(iDynUtils& model);
+    /**
+     * @brief ComputeLinksDistance loads the collision geometries of the robot, from <robot>_capsules.urdf if it exists
+     * @param model the robot model
+     * @param convex_hulls if true, link meshes are replaced by their convex hulls, so that distances are computed
+     *                     with GJK instead of BVH traversal. Hulls are cached in the <robot>_convex_hulls directory
+     *                     next to the URDF
+     * @param report_convex_hulls if true, each convex hull is compared with its mesh, see getConvexHullsReport.
+     *                            This builds the mesh BVH and runs distance queries at construction
+     */
+    ComputeLinksDistance(iDynUtils& model, const bool convex_hulls = false,
+                         const bool report_convex_hulls = false);
+
+    ~ComputeLinksDistance();
 
     /**
      * @brief getLinkDistances returns a list of distances between all link pairs which are enabled for checking.
@@ -285,6 +918,255 @@ public:
      */
     std::list<LinkPairDistance> getLinkDistances(double detectionThreshold = std::numeric_limits<double>::infinity());
 
+    /**
+     * @brief getLinkDistances computes the distances between all link pairs which are enabled for checking,
+     *                         and writes the pairs closer than the detection threshold in a caller owned buffer.
+     *                         If more than capacity pairs are closer than the threshold, only the capacity
+     *                         closest pairs are written. Nothing is allocated.
+     * @param records a buffer of at least capacity records
+     * @param capacity the buffer size, i.e. the maximum number of closest pairs to return
+     * @param detectionThreshold the maximum distance which we use to look for link pairs
+     * @param sorted if true, records are sorted by increasing distance
+     * @return the number of records written
+     */
+    unsigned int getLinkDistances(LinkPairDistanceRecord* records,
+                                  const unsigned int capacity,
+                                  double detectionThreshold = std::numeric_limits<double>::infinity(),
+                                  const bool sorted = true);
+
+    /**
+     * @brief setDistanceJacobians enables or disables the computation of the distance jacobian of each pair
+     *        returned by getLinkDistances and getClosestLinkPairs, see LinkPairDistance::getDistanceJacobian.
+     *        The jacobian is w.r.t. the joint positions only, and it is computed assuming the closest points
+     *        fixed on their links. Disabled by default
+     * @param enabled true to compute the distance jacobians
+     */
+    void setDistanceJacobians(const bool enabled);
+
+    /**
+     * @brief getDistanceJacobians tells whether the distance jacobians are computed
+     * @return true if the distance jacobians are computed
+     */
+    bool getDistanceJacobians() const;
+
+    /**
+     * @brief getConvexHullsReport returns the accuracy and speed of the convex hull of each mesh link,
+     *        if ComputeLinksDistance was constructed with convex hulls and report_convex_hulls
+     * @return the convex hulls report
+     */
+    const std::vector<ConvexHullReport>& getConvexHullsReport() const;
+
+    /**
+     * @brief setNumberOfThreads sets the number of threads used by getLinkDistances to compute the pairs
+     *        distances. Pairs are split among the threads by their estimated cost, and results do not depend
+     *        on the number of threads. getClosestLinkPairs is always single threaded. Default is 1
+     * @param number_of_threads the number of threads, including the calling thread
+     */
+    void setNumberOfThreads(const unsigned int number_of_threads);
+
+    /**
+     * @brief getNumberOfThreads returns the number of threads used by getLinkDistances
+     * @return the number of threads, including the calling thread
+     */
+    unsigned int getNumberOfThreads() const;
+
+    /**
+     * @brief getClosestLinkPairs returns the k closest link pairs among the pairs enabled for checking.
+     *                            Pairs are checked by increasing lower bound of their distance, and the k-th
+     *                            smallest distance found so far is used as detection threshold, so that
+     *                            most pairs are pruned without computing their distance
+     * @param k the number of pairs to return
+     * @param detectionThreshold the maximum distance which we use to look for link pairs
+     * @return a list of at most k linkPairDistances, sorted by increasing distance
+     */
+    std::list<LinkPairDistance> getClosestLinkPairs(const unsigned int k,
+                                                    double detectionThreshold = std::numeric_limits<double>::infinity());
+
+    /**
+     * @brief getNrOfPairs returns the number of link pairs enabled for checking, i.e. the buffer size
+     *        needed by getLinkDistances to return all pairs
+     * @return the number of pairs
+     */
+    unsigned int getNrOfPairs() const;
+
+    /**
+     * @brief getLinkName returns the name of a link from its link ID
+     * @param link the link ID, as in LinkPairDistanceRecord
+     * @return the link name
+     */
+    const std::string& getLinkName(const unsigned int link) const;
+
+    /**
+     * @brief checkContinuousCollision checks the link pairs enabled for checking for collision along the
+     *        joint space linear motion q(t) = q0 + t*(q1 - q0), t in [0,1], using conservative advancement:
+     *        at each step t is advanced by the pair distance divided by an upper bound of the
+     *        pair relative motion, so that no contact can be skipped.
+     *        Pair distances are computed by the same narrow phase used by getLinkDistances.
+     *        If the motion is not certified within getMaxContinuousCollisionIterations() steps,
+     *        contact is reported at the last reached t, and getContinuousCollisionConverged() is false.
+     *        The model state is not modified.
+     * @param q0 the configuration at the beginning of the motion
+     * @param q1 the configuration at the end of the motion
+     * @param time_of_contact the time t at which the first contact happens, -1.0 if there is no contact
+     * @param collidingPair if not NULL, it will contain the first pair which comes into contact
+     * @param tolerance the distance under which two links are considered in contact
+     * @return true if a contact happens during the motion
+     */
+    bool checkContinuousCollision(const yarp::sig::Vector& q0,
+                                  const yarp::sig::Vector& q1,
+                                  double& time_of_contact,
+                                  LinkPairDistance::LinksPair* collidingPair = NULL,
+                                  const double tolerance = 1e-3);
+
+    /**
+     * @brief setMaxContinuousCollisionIterations sets the maximum number of conservative advancement
+     *        steps of checkContinuousCollision. By default 1000
+     * @param max_iterations the maximum number of steps
+     */
+    void setMaxContinuousCollisionIterations(const unsigned int max_iterations);
+
+    unsigned int getMaxContinuousCollisionIterations() const;
+
+    /**
+     * @brief getContinuousCollisionIterations returns the number of conservative advancement steps
+     *        of the last checkContinuousCollision
+     * @return the number of steps
+     */
+    unsigned int getContinuousCollisionIterations() const;
+
+    /**
+     * @brief getContinuousCollisionConverged tells whether the last checkContinuousCollision certified its
+     *        result. When false, the maximum number of steps was hit and the reported contact is only conservative
+     * @return false if the last checkContinuousCollision hit the maximum number of steps
+     */
+    bool getContinuousCollisionConverged() const;
+
+    /**
+     * @brief setAnalyticKernels enables or disables the closed-form distance kernels for
+     *        capsule-capsule, capsule-sphere and sphere-sphere pairs. When disabled, fcl::distance
+     *        is used for all pairs. Box and mesh pairs always use fcl::distance. Enabled by default
+     * @param enabled true to use the closed-form kernels
+     */
+    void setAnalyticKernels(const bool enabled);
+
+    /**
+     * @brief getAnalyticKernels tells whether the closed-form distance kernels are enabled
+     * @return true if capsule and sphere pairs use closed-form kernels
+     */
+    bool getAnalyticKernels() const;
+
+    /**
+     * @brief setBroadPhase enables or disables the broad phase culling in getLinkDistances.
+     *        When enabled and the detection threshold is finite, pairs whose bounding boxes are farther
+     *        apart than the threshold are not passed to the narrow phase. Enabled by default
+     * @param enabled true to use the broad phase
+     */
+    void setBroadPhase(const bool enabled);
+
+    /**
+     * @brief getBroadPhase tells whether the broad phase culling is enabled
+     * @return true if the broad phase is enabled
+     */
+    bool getBroadPhase() const;
+
+    /**
+     * @brief getNrOfCulledPairs returns the number of pairs rejected by the broad phase
+     *        during the last call to getLinkDistances
+     * @return the number of culled pairs
+     */
+    unsigned int getNrOfCulledPairs() const;
+
+    /**
+     * @brief getCullingRatio returns the fraction of the pairs to check which were rejected by the broad phase
+     *        during the last call to getLinkDistances
+     * @return a number in [0,1]
+     */
+    double getCullingRatio() const;
+
+    /**
+     * @brief setDistanceCache enables or disables the temporal coherence cache in getLinkDistances.
+     *        When enabled and the detection threshold is finite, every pair stores its last distance and the
+     *        shape poses it was computed with. A pair is skipped if its last distance, minus the maximum
+     *        displacement of any point of the two shapes since then, is still above the threshold.
+     *        Enabled by default
+     * @param enabled true to use the cache
+     */
+    void setDistanceCache(const bool enabled);
+
+    /**
+     * @brief getDistanceCache tells whether the temporal coherence cache is enabled
+     * @return true if the cache is enabled
+     */
+    bool getDistanceCache() const;
+
+    /**
+     * @brief resetDistanceCache invalidates all cached distances
+     */
+    void resetDistanceCache();
+
+    /**
+     * @brief getCacheHitRate returns the fraction of the pairs tested against the cache which were skipped
+     *        during the last call to getLinkDistances
+     * @return a number in [0,1]
+     */
+    double getCacheHitRate() const;
+
+    /**
+     * @brief getCacheTimeSaved returns an estimate of the time saved by the cache during the last call
+     *        to getLinkDistances, computed as the number of skipped pairs times the average time
+     *        spent on each computed pair
+     * @return the time saved in seconds
+     */
+    double getCacheTimeSaved() const;
+
+    /**
+     * @brief capsuleCapsuleDistance computes the distance between two capsules
+     * @param endPointA1 the first endpoint of the first capsule axis
+     * @param endPointA2 the second endpoint of the first capsule axis
+     * @param radiusA the first capsule radius
+     * @param endPointB1 the first endpoint of the second capsule axis
+     * @param endPointB2 the second endpoint of the second capsule axis
+     * @param radiusB the second capsule radius
+     * @param closestPointA the closest point on the first capsule surface
+     * @param closestPointB the closest point on the second capsule surface
+     * @return the distance between the two capsules, negative if they intersect
+     */
+    static double capsuleCapsuleDistance(const KDL::Vector& endPointA1, const KDL::Vector& endPointA2,
+                                         const double radiusA,
+                                         const KDL::Vector& endPointB1, const KDL::Vector& endPointB2,
+                                         const double radiusB,
+                                         KDL::Vector& closestPointA, KDL::Vector& closestPointB);
+
+    /**
+     * @brief capsuleSphereDistance computes the distance between a capsule and a sphere
+     * @param endPointA1 the first endpoint of the capsule axis
+     * @param endPointA2 the second endpoint of the capsule axis
+     * @param radiusA the capsule radius
+     * @param centerB the sphere center
+     * @param radiusB the sphere radius
+     * @param closestPointA the closest point on the capsule surface
+     * @param closestPointB the closest point on the sphere surface
+     * @return the distance between the capsule and the sphere, negative if they intersect
+     */
+    static double capsuleSphereDistance(const KDL::Vector& endPointA1, const KDL::Vector& endPointA2,
+                                        const double radiusA,
+                                        const KDL::Vector& centerB, const double radiusB,
+                                        KDL::Vector& closestPointA, KDL::Vector& closestPointB);
+
+    /**
+     * @brief sphereSphereDistance computes the distance between two spheres
+     * @param centerA the first sphere center
+     * @param radiusA the first sphere radius
+     * @param centerB the second sphere center
+     * @param radiusB the second sphere radius
+     * @param closestPointA the closest point on the first sphere surface
+     * @param closestPointB the closest point on the second sphere surface
+     * @return the distance between the two spheres, negative if they intersect
+     */
+    static double sphereSphereDistance(const KDL::Vector& centerA, const double radiusA,
+                                       const KDL::Vector& centerB, const double radiusB,
+                                       KDL::Vector& closestPointA, KDL::Vector& closestPointB);
+
     /**
      * @brief setCollisionWhiteList resets the allowed collision matrix by setting all collision pairs as disabled.
      *        It then enables all collision pairs specified in the whiteList. Lastly it will disable all collision pairs
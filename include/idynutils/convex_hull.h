@@ -51,6 +51,18 @@ public:
      */
     bool getConvexHull(const std::list<KDL::Vector>& points,
                              std::vector<KDL::Vector>& ch);
+
+    /**
+     * @brief getConvexHull3D computes the 3D convex hull of a set of points
+     * @param points the points
+     * @param vertices the vertices of the convex hull
+     * @param triangles the faces of the convex hull, as triplets of indices of vertices,
+     *                  counterclockwise when seen from outside
+     * @return false if the points do not span a volume
+     */
+    bool getConvexHull3D(const std::vector<KDL::Vector>& points,
+                         std::vector<KDL::Vector>& vertices,
+                         std::vector<unsigned int>& triangles);
     //void setRansacDistanceThr(const double x){_ransac_distance_thr = x;}
 
 private:
@@ -47,6 +47,22 @@ public:
 
     }
 
+    /**
+     * @brief kinematic_chain copy constructor, index refers to the new chain end effector index
+     * @param other the kinematic chain to copy
+     */
+    kinematic_chain(const kinematic_chain& other) :
+        chain_name(other.chain_name),
+        end_effector_name(other.end_effector_name),
+        joint_names(other.joint_names),
+        fixed_joint_names(other.fixed_joint_names),
+        end_effector_index(other.end_effector_index),
+        index(end_effector_index),
+        joint_numbers(other.joint_numbers)
+    {
+
+    }
+
     /**
      * @brief getNrOfDOFs return # of dofs of the kinematic chain
      * @return # of dofs of the kinematic chain
@@ -84,6 +100,59 @@ public:
   std::vector<unsigned int> joint_numbers;
 };
 
+/**
+ * @brief The batch_kinematics struct holds link poses and CoM positions computed
+ *        over a batch of robot configurations, stored as structure of arrays:
+ *        every scalar component is contiguous across configurations, so that
+ *        results can be streamed without reshuffling.
+ */
+struct batch_kinematics
+{
+    /**
+     * @brief number of components stored for each link pose:
+     *        the position (x,y,z) followed by the rotation matrix in row-major order
+     */
+    static const unsigned int pose_size = 12;
+
+    /**
+     * @brief number_of_configurations the number of configurations in the batch, N
+     */
+    unsigned int number_of_configurations;
+
+    /**
+     * @brief link_indices the iDyn3 indices of the links whose pose has been computed
+     */
+    std::vector<int> link_indices;
+
+    /**
+     * @brief poses component c of the pose of link_indices[l] at configuration n is
+     *        poses[(l*pose_size + c)*N + n]
+     */
+    std::vector<double> poses;
+
+    /**
+     * @brief com component c (x,y,z) of the CoM at configuration n is com[c*N + n]
+     */
+    std::vector<double> com;
+
+    /**
+     * @brief getPositionKDL returns the world_T_link pose at a configuration
+     * @param configuration the configuration index n (row of the batch)
+     * @param link the position l of the link in link_indices
+     * @return the world_T_link frame
+     */
+    KDL::Frame getPositionKDL(const unsigned int configuration, const unsigned int link) const;
+
+    /**
+     * @brief getCOM returns the CoM position in world frame at a configuration
+     * @param configuration the configuration index n (row of the batch)
+     * @return the CoM position
+     */
+    KDL::Vector getCOM(const unsigned int configuration) const;
+};
+
+class IncrementalForwardKinematics;
+
 class iDynUtils
 {
 public:
@@ -119,6 +188,23 @@ public:
               const std::string urdf_path,
               const std::string srdf_path);
 
+    /**
+     * @brief iDynUtils copy constructor creates a lightweight worker of an existing model.
+     *        Immutable data (urdf, srdf, moveit robot model, collision geometries, KDL tree,
+     *        joint limits and kinematic chains) is shared or copied without parsing any file,
+     *        while the worker owns its state (iDyn3 model, moveit robot state, ACM, world pose).
+     *        Each worker can then be used by a different thread. The worker starts from the
+     *        same joint state and world pose of the original model.
+     * @param other the model to copy. It should not be modified while the copy is being made
+     */
+    iDynUtils(const iDynUtils& other);
+
+    /**
+     * @brief clone creates a lightweight worker of this model, see iDynUtils(const iDynUtils&)
+     * @return a pointer to the new worker
+     */
+    boost::shared_ptr<iDynUtils> clone() const;
+
     kinematic_chain left_leg, left_arm,right_leg,right_arm,torso,head;
     iCub::iDynTree::DynTree iDyn3_model;
 
@@ -251,6 +337,135 @@ public:
                           const std::vector<ft_measure> &force_torque_measurement,
                           const bool set_world_pose = false);
 
+    /**
+     * @brief updateiDyn3Model updates the underlying robot model (uses both Kinematic and Dynamic RNEA),
+     *        then sets the FT measurements from an index-addressed table, so that no ft_measure is built
+     *        and no link is looked up by name
+     * @param q robot configuration
+     * @param ft_indices the iDyn3 FT sensor index of each measurement, see getFTSensorIndex.
+     *        Measurements with a negative index are skipped
+     * @param ft_wrenches the measured wrenches, in the same order of ft_indices
+     * @param set_world_pose do we update the base link pose wrt the world frame?
+     */
+    void updateiDyn3Model(const yarp::sig::Vector &q,
+                          const std::vector<int> &ft_indices,
+                          const std::vector<yarp::sig::Vector> &ft_wrenches,
+                          const bool set_world_pose = false);
+
+    /**
+     * @brief updateForceTorqueMeasurement sets the measurement of a FT sensor by index
+     * @param ft_index the iDyn3 FT sensor index, see getFTSensorIndex
+     * @param wrench the measured wrench
+     * @return true on success
+     */
+    bool updateForceTorqueMeasurement(const int ft_index,
+                                      const yarp::sig::Vector& wrench);
+
+    /**
+     * @brief getFTSensorIndex returns the iDyn3 index of the FT sensor measuring in a reference frame
+     * @param ft_reference_frame the FT sensor reference frame, i.e. the child link of the FT joint
+     * @return the FT sensor index, or -1 if there is no FT sensor in that frame
+     */
+    int getFTSensorIndex(const ft_reference_frame& ft_reference_frame);
+
+    /**
+     * @brief The UpdateStages enum lists the computation stages performed by updateiDyn3Model.
+     *        Stages can be or-ed together to request a partial update of the model.
+     *        Stages which are not requested are flagged as stale and are computed
+     *        lazily by the getters which need them (see getPositionKDL, getCOM, getTorques).
+     *        Reading iDyn3_model directly bypasses the lazy stages: after a partial update
+     *        or a world pose change, call updateStaleStages before reading it
+     */
+    enum UpdateStages {
+        UPDATE_POSITIONS  = 0x0001, ///< link poses and CoM (computePositions)
+        UPDATE_VELOCITIES = 0x0002, ///< link velocities and accelerations (kinematicRNEA)
+        UPDATE_GRAVITY    = 0x0004, ///< gravity vector in base link coordinates (inertial measure)
+        UPDATE_DYNAMICS   = 0x0008, ///< link wrenches and joint torques (dynamicRNEA)
+        UPDATE_ALL        = 0x000F
+    };
+
+    /**
+     * @brief updateiDyn3ModelStages updates the underlying robot model, computing only the requested stages
+     * @param q robot configuration
+     * @param update_stages an or-ed combination of UpdateStages, e.g. UPDATE_POSITIONS
+     * @param set_world_pose do we update the base link pose wrt the world frame?
+     */
+    void updateiDyn3ModelStages(const yarp::sig::Vector& q,
+                                const int update_stages,
+                                const bool set_world_pose = false);
+
+    /**
+     * @brief updateiDyn3ModelStages updates the underlying robot model, computing only the requested stages.
+     *        Joint velocities and accelerations are always stored in the model, so that stale stages
+     *        can be computed later on.
+     * @param q robot configuration
+     * @param dq_ref robot joint velocities
+     * @param ddq_ref robot joint accelerations
+     * @param update_stages an or-ed combination of UpdateStages, e.g. UPDATE_POSITIONS | UPDATE_VELOCITIES
+     * @param set_world_pose do we update the base link pose wrt the world frame?
+     */
+    void updateiDyn3ModelStages(const yarp::sig::Vector& q,
+                                const yarp::sig::Vector& dq_ref,
+                                const yarp::sig::Vector& ddq_ref,
+                                const int update_stages,
+                                const bool set_world_pose = false);
+
+    /**
+     * @brief updateStaleStages computes the requested stages which are stale,
+     *        together with the stale stages they depend on
+     * @param update_stages an or-ed combination of UpdateStages
+     */
+    void updateStaleStages(const int update_stages = UPDATE_ALL);
+
+    /**
+     * @brief getStaleStages returns the stages which have not been computed since the last update
+     * @return an or-ed combination of UpdateStages
+     */
+    int getStaleStages() const;
+
+    /**
+     * @brief getPositionKDL returns the pose of a link in world frame. Link poses are computed by an
+     *        IncrementalForwardKinematics, which only recomputes the links downstream of the joints
+     *        moved since the last call, and does not need the UPDATE_POSITIONS stage
+     * @param link_index the link index
+     * @return the world_T_link frame
+     */
+    KDL::Frame getPositionKDL(const int link_index);
+
+    /**
+     * @brief getPositionKDL returns the relative pose between two links, see getPositionKDL(link_index)
+     * @param first_link the index of the link in which the pose is expressed
+     * @param second_link the index of the link whose pose we want
+     * @return the first_T_second frame
+     */
+    KDL::Frame getPositionKDL(const int first_link, const int second_link);
+
+    /**
+     * @brief getCOM returns the CoM position in world frame, computing link poses if stale
+     * @return the CoM position
+     */
+    yarp::sig::Vector getCOM();
+
+    /**
+     * @brief getTorques returns the joint torques from inverse dynamics, computing them if stale
+     * @return the joint torques vector
+     */
+    yarp::sig::Vector getTorques();
+
+    /**
+     * @brief computeBatchKinematics computes link poses and CoM positions for a batch of configurations.
+     *        The model state (iDyn3_model, moveit_robot_state, worldT) is only read, never modified:
+     *        poses are expressed in world frame using the current world base pose,
+     *        as updateiDyn3Model(q, false) would do.
+     * @param Q a N x nDOF matrix, each row is a robot configuration
+     * @param link_indices the iDyn3 indices of the links whose pose we want
+     * @param result the batch results, resized to fit N configurations
+     * @return true on success, false if Q has the wrong number of columns or a link index is invalid
+     */
+    bool computeBatchKinematics(const yarp::sig::Matrix& Q,
+                                const std::vector<int>& link_indices,
+                                batch_kinematics& result);
+
 
     boost::shared_ptr<urdf::Model> urdf_model; // A URDF Model
     boost::shared_ptr<srdf::Model> robot_srdf; // A SRDF description
@@ -392,6 +607,35 @@ public:
    bool checkSelfCollisionAt(const yarp::sig::Vector &q,
                              std::list< std::pair<std::string,std::string> > * collisionPairs = NULL);
 
+   /**
+    * @brief The SelfCollisionStatus enum is the per-configuration result of checkSelfCollisionBatch
+    */
+   enum SelfCollisionStatus {
+       SELF_COLLISION_NOT_CHECKED = -1, ///< skipped because of an early stop
+       SELF_COLLISION_FREE = 0,
+       SELF_COLLISION_DETECTED = 1
+   };
+
+   /**
+    * @brief checkSelfCollisionBatch checks a batch of configurations for self collision, splitting them
+    *        across a pool of threads. Each thread owns its own moveit robot state and collision robot,
+    *        so that the internal model state is never modified.
+    * @param configurations the robot joint configuration vectors to check
+    * @param results the per-configuration SelfCollisionStatus, resized to the number of configurations
+    * @param collisionPairs if not NULL, it is resized to the number of configurations and will contain,
+    *                       for each configuration, the list of link pairs in contact
+    * @param stop_at_first_collision if true, the check stops as soon as the first colliding configuration
+    *                                (i.e. the one with the smallest index) is found. All configurations
+    *                                before it are checked, the ones after it may be SELF_COLLISION_NOT_CHECKED
+    * @param number_of_threads the number of threads to use, 1 runs the check in the calling thread
+    * @return the index of the first configuration in self collision, or -1 if no collision was found
+    */
+   int checkSelfCollisionBatch(const std::vector<yarp::sig::Vector>& configurations,
+                               std::vector<int>& results,
+                               std::vector< std::list< std::pair<std::string,std::string> > >* collisionPairs = NULL,
+                               const bool stop_at_first_collision = false,
+                               const unsigned int number_of_threads = 4);
+
    /**
     * @brief loadDisabledCollisionsFromSRDF disabled collisions between links as specified in the robot srdf.
     *        Notice this function will not reset the acm, rather just disable collisions that are flagged as
@@ -519,6 +763,12 @@ protected:
      */
     bool iDyn3Model();
 
+    /**
+     * @brief initiDyn3Model setup iDynTree from the already loaded urdf, srdf and KDL tree
+     * @return true if the model is loaded in iDynTree
+     */
+    bool initiDyn3Model();
+
     /**
      * @brief setWorldPose updates the transformation bTw from the world frame {W} to the base link {B},
      *                     which corresponds to the floating base configuration. This is done by taking a link,
@@ -577,6 +827,12 @@ protected:
      */
     yarp::sig::Vector g;
 
+    /**
+     * @brief o zero vector used as angular velocity and acceleration of the fake inertial measure.
+     *        It is preallocated so that updateiDyn3Model does not allocate memory
+     */
+    yarp::sig::Vector o;
+
     /**
      * @brief base_link_name is the link to which the floating base is attached during robot loading
      * Notice that, while the floating base link can be changed, the base_link_name will remain constant
@@ -588,6 +844,29 @@ protected:
     std::string robot_srdf_folder;
 
     bool world_is_inited;
+
+    /**
+     * @brief stale_stages the UpdateStages which have not been computed since the last update
+     */
+    int stale_stages;
+
+    /**
+     * @brief link_poses the incremental forward kinematics used by getPositionKDL
+     */
+    boost::shared_ptr<IncrementalForwardKinematics> link_poses;
+
+    /**
+     * @brief link_poses_q the configuration of the last update, which link_poses is updated to
+     *        lazily by getPositionKDL
+     */
+    yarp::sig::Vector link_poses_q;
+
+    bool link_poses_are_stale;
+
+    /**
+     * @brief updateLinkPoses updates link_poses to link_poses_q if they are stale
+     */
+    void updateLinkPoses();
     
     std::vector<std::string> _ft_sensor_frames;
 };
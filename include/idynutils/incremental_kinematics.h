@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _INCREMENTAL_KINEMATICS_H_
+#define _INCREMENTAL_KINEMATICS_H_
+
+#include <idynutils/idynutils.h>
+#include <kdl/frames.hpp>
+#include <kdl/tree.hpp>
+#include <yarp/sig/Vector.h>
+#include <vector>
+
+/**
+ * @brief The IncrementalForwardKinematics class is a change-tracking layer on top of iDynUtils
+ *        which computes link poses only for the subtrees of the robot KDL tree whose joints changed
+ *        since the last update. Poses are computed in the same order, with the same operations,
+ *        regardless of which links are dirty, so that results are bit-identical to a full update.
+ *        iDynUtils::getPositionKDL uses it, so that it does not need iDyn3_model.computePositions().
+ */
+class IncrementalForwardKinematics
+{
+public:
+    /**
+     * @brief IncrementalForwardKinematics creates the link tables from the model KDL tree
+     * @param model the robot model. Its current world base pose is used to express poses in world frame,
+     *        see setWorldBasePose
+     */
+    IncrementalForwardKinematics(iDynUtils& model);
+
+    /**
+     * @brief setWorldBasePose caches the floating base pose wrt the world frame, which is used
+     *        by getPositionKDL(link_index). It must be called whenever the model world pose
+     *        or floating base link change (iDynUtils does it for its own instance)
+     * @param world_T_fb the floating base link pose in world frame
+     */
+    void setWorldBasePose(const KDL::Frame& world_T_fb);
+
+    /**
+     * @brief update compares q with the last applied configuration and recomputes
+     *        the poses of the links downstream of the changed joints
+     * @param q the robot configuration, in model order
+     * @return the number of links whose pose has been recomputed
+     */
+    unsigned int update(const yarp::sig::Vector& q);
+
+    /**
+     * @brief invalidate marks all links as dirty, so that the next update is a full update
+     */
+    void invalidate();
+
+    /**
+     * @brief getPositionKDL returns the pose of a link in world frame
+     * @param link_index the iDyn3 link index
+     * @return the world_T_link frame
+     */
+    KDL::Frame getPositionKDL(const int link_index) const;
+
+    /**
+     * @brief getPositionKDL returns the relative pose between two links
+     * @param first_link the iDyn3 index of the link in which the pose is expressed
+     * @param second_link the iDyn3 index of the link whose pose we want
+     * @return the first_T_second frame
+     */
+    KDL::Frame getPositionKDL(const int first_link, const int second_link) const;
+
+    /**
+     * @brief getRoot_T_Link returns the pose of a link wrt the root of the KDL tree
+     * @param link_index the iDyn3 link index
+     * @return the root_T_link frame
+     */
+    const KDL::Frame& getRoot_T_Link(const int link_index) const;
+
+    /**
+     * @brief getNrOfRecomputedLinks returns how many link poses were recomputed by the last update
+     * @return the number of recomputed links
+     */
+    unsigned int getNrOfRecomputedLinks() const;
+
+    /**
+     * @brief getNrOfLinks returns the number of links in the tree
+     * @return the number of links
+     */
+    unsigned int getNrOfLinks() const;
+
+    /**
+     * @brief getSegments returns the tree segments, in depth-first order (a parent always precedes its children)
+     * @return the tree segments
+     */
+    const std::vector<KDL::Segment>& getSegments() const;
+
+    /**
+     * @brief getParents returns the position in getSegments() of the parent of each segment, -1 for the root
+     * @return the parent of each segment
+     */
+    const std::vector<int>& getParents() const;
+
+    /**
+     * @brief getDOFIndices returns the model DOF index of the joint of each segment, -1 for fixed joints
+     * @return the DOF index of each segment
+     */
+    const std::vector<int>& getDOFIndices() const;
+
+    /**
+     * @brief getSegmentIndex returns the position in getSegments() of a link
+     * @param link_index the iDyn3 link index
+     * @return the segment position, -1 if the link index is invalid
+     */
+    int getSegmentIndex(const int link_index) const;
+
+    /**
+     * @brief getTotalMass returns the sum of the masses of all segments
+     * @return the robot mass
+     */
+    double getTotalMass() const;
+
+private:
+    iDynUtils& model;
+
+    /**
+     * @brief segments the tree segments, in depth-first order (a parent always precedes its children)
+     */
+    std::vector<KDL::Segment> segments;
+
+    /**
+     * @brief parents the position in segments of the parent of each segment, -1 for the root
+     */
+    std::vector<int> parents;
+
+    /**
+     * @brief dof_indices the model DOF index of the joint of each segment, -1 for fixed joints
+     */
+    std::vector<int> dof_indices;
+
+    /**
+     * @brief link_to_segment maps iDyn3 link indices to positions in segments
+     */
+    std::vector<int> link_to_segment;
+
+    double total_mass;
+
+    std::vector<KDL::Frame> root_T_link;
+    std::vector<char> dirty;
+
+    /**
+     * @brief world_T_fb the cached floating base pose in world frame
+     */
+    KDL::Frame world_T_fb;
+
+    /**
+     * @brief fb_segment the position in segments of the floating base link
+     */
+    int fb_segment;
+
+    yarp::sig::Vector last_q;
+    bool is_initialized;
+    unsigned int recomputed_links;
+
+    void addSubtree(const KDL::SegmentMap::const_iterator& segment, const int parent);
+};
+
+#endif
@@ -65,6 +65,14 @@ public:
      *         3x1 angular velocity vector [rad/s]
      */
     yarp::sig::Vector sense();
+
+    /**
+     * @brief sense reads the IMU in place. It does not allocate if output already has the IMU output size
+     * @param output the same 12 element vector returned by sense()
+     * @return true if the IMU is connected
+     */
+    bool sense(yarp::sig::Vector& output);
+
     /**
      * @brief sense
      * @param orientation 3x1 orientation vector in Euler angles ZYX (RPY)
@@ -164,6 +164,74 @@ public:
      * \f$[N]\f$ is control mode is torque
      */
     virtual void move(const yarp::sig::Vector& u_d);
+
+    /**
+     * @brief sensePositionRaw reads joint positions in driver units, i.e. \f$[deg]\f$ regardless of useSI,
+     * directly into a caller buffer. It does not allocate
+     * @param q_sensed a buffer of at least getNumberOfJoints() doubles
+     * @return true on success
+     */
+    bool sensePositionRaw(double* q_sensed);
+
+    /**
+     * @brief senseVelocityRaw reads joint velocities in driver units, i.e. \f$[\frac{deg}{s}]\f$ regardless of useSI,
+     * directly into a caller buffer. It does not allocate
+     * @param velocity_sensed a buffer of at least getNumberOfJoints() doubles
+     * @return true on success
+     */
+    bool senseVelocityRaw(double* velocity_sensed);
+
+    /**
+     * @brief senseTorqueRaw reads joint torques directly into a caller buffer. It does not allocate
+     * @param tau_sensed a buffer of at least getNumberOfJoints() doubles
+     * @return true on success
+     */
+    bool senseTorqueRaw(double* tau_sensed);
+
+    /**
+     * @brief sensePositionRefFeedbackRaw reads joint position ref feedback in driver units,
+     * i.e. \f$[deg]\f$ regardless of useSI, directly into a caller buffer. It does not allocate
+     * @param q_position_ref_feedback a buffer of at least getNumberOfJoints() doubles
+     * @return true on success
+     */
+    bool sensePositionRefFeedbackRaw(double* q_position_ref_feedback);
+
+    /**
+     * @brief senseRaw reads joint positions, velocities and torques together, in driver units,
+     * directly into caller buffers. Positions are read with IEncodersTimed, so that each joint
+     * position comes with its timestamp. It does not allocate
+     * @param q_sensed a buffer of at least getNumberOfJoints() doubles
+     * @param velocity_sensed a buffer of at least getNumberOfJoints() doubles
+     * @param tau_sensed a buffer of at least getNumberOfJoints() doubles
+     * @param timestamps a buffer of at least getNumberOfJoints() doubles, the encoders timestamps in \f$[s]\f$
+     * @return true on success
+     */
+    bool senseRaw(double* q_sensed,
+                  double* velocity_sensed,
+                  double* tau_sensed,
+                  double* timestamps);
+
+    /**
+     * @brief moveRaw moves all joints of the chain with a command already in driver units,
+     * i.e. move without the SI conversion. It does not allocate
+     * @param u_d a buffer of getNumberOfJoints() doubles
+     */
+    void moveRaw(const double* u_d);
+
+    /**
+     * @brief getEncoderToSIScale returns the factor which converts positions and velocities
+     * from driver units to the units of sense, i.e. \f$\frac{\pi}{180}\f$ if useSI is true, 1 otherwise
+     * @return the conversion factor
+     */
+    double getEncoderToSIScale() const;
+
+    /**
+     * @brief getMotorCommandFromSIScale returns the factor which converts a command in the units of move
+     * to driver units for the current control type, i.e. \f$\frac{180}{\pi}\f$ if useSI is true
+     * and control mode is position, position direct or impedance, 1 otherwise
+     * @return the conversion factor
+     */
+    double getMotorCommandFromSIScale() const;
     
     bool moveDone();
 
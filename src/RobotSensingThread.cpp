@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <idynutils/RobotSensingThread.h>
+#include <yarp/os/Time.h>
+#include <algorithm>
+
+const unsigned int RobotSensingThread::IMU_OUTPUT_SIZE;
+
+RobotStateSnapshot::RobotStateSnapshot() :
+    joints_timestamp(0.0),
+    joints_skew(0.0),
+    ft_timestamp(0.0),
+    imu_timestamp(0.0),
+    sequence(0)
+{
+
+}
+
+RobotSensingThread::RobotSensingThread(RobotUtils& robot, const int period) :
+    yarp::os::RateThread(period),
+    robot(robot),
+    sequence(0)
+{
+    RobotUtils::ftPtrMap ftSensors = robot.getftSensors();
+    for(RobotUtils::ftPtrMap::iterator it = ftSensors.begin(); it != ftSensors.end(); ++it)
+    {
+        ft_frames.push_back(it->first);
+        ft_sensors.push_back(it->second);
+    }
+
+    number_of_joints = robot.getNumberOfJoints();
+    ft_offset = 3*number_of_joints;
+    imu_offset = ft_offset + 6*ft_sensors.size();
+    timestamps_offset = imu_offset + (robot.hasIMU() ? IMU_OUTPUT_SIZE : 0);
+    block_size = timestamps_offset + 4;
+
+    q.resize(number_of_joints, 0.0);
+    qdot.resize(number_of_joints, 0.0);
+    tau.resize(number_of_joints, 0.0);
+    wrench.resize(6, 0.0);
+    imu_output.resize(IMU_OUTPUT_SIZE, 0.0);
+
+    sensed.assign(block_size, 0.0);
+    published.assign(block_size, 0.0);
+}
+
+RobotSensingThread::~RobotSensingThread()
+{
+    if(isRunning())
+        stop();
+}
+
+void RobotSensingThread::run()
+{
+    robot.sense(q, qdot, tau);
+    for(unsigned int i = 0; i < number_of_joints; ++i)
+    {
+        sensed[i] = q[i];
+        sensed[number_of_joints + i] = qdot[i];
+        sensed[2*number_of_joints + i] = tau[i];
+    }
+    sensed[timestamps_offset] = robot.getSenseTimestamp();
+    sensed[timestamps_offset + 1] = robot.getSenseSkew();
+
+    for(unsigned int s = 0; s < ft_sensors.size(); ++s)
+    {
+        // a failed read keeps the previous wrench
+        if(ft_sensors[s]->sense(wrench))
+            for(unsigned int i = 0; i < 6 && i < wrench.size(); ++i)
+                sensed[ft_offset + 6*s + i] = wrench[i];
+    }
+    sensed[timestamps_offset + 2] = yarp::os::Time::now();
+
+    if(robot.hasIMU())
+    {
+        robot.getIMU()->sense(imu_output);
+        for(unsigned int i = 0; i < IMU_OUTPUT_SIZE && i < imu_output.size(); ++i)
+            sensed[imu_offset + i] = imu_output[i];
+        sensed[timestamps_offset + 3] = yarp::os::Time::now();
+    }
+
+    publish();
+}
+
+void RobotSensingThread::publish()
+{
+    // there is only one writer, so the sequence does not need atomic increments
+    sequence = sequence + 1;
+    __sync_synchronize();
+    std::copy(sensed.begin(), sensed.end(), published.begin());
+    __sync_synchronize();
+    sequence = sequence + 1;
+}
+
+bool RobotSensingThread::getSnapshot(RobotStateSnapshot& snapshot) const
+{
+    if(snapshot.q.size() != number_of_joints)
+    {
+        snapshot.q.resize(number_of_joints, 0.0);
+        snapshot.qdot.resize(number_of_joints, 0.0);
+        snapshot.tau.resize(number_of_joints, 0.0);
+    }
+    if(snapshot.ft_readings.size() != ft_frames.size())
+    {
+        snapshot.ft_readings.clear();
+        for(unsigned int s = 0; s < ft_frames.size(); ++s)
+            snapshot.ft_readings[ft_frames[s]] = yarp::sig::Vector(6, 0.0);
+    }
+    const unsigned int imu_size = timestamps_offset - imu_offset;
+    if(snapshot.imu.size() != imu_size)
+        snapshot.imu.resize(imu_size, 0.0);
+
+    while(true)
+    {
+        const unsigned long begin = sequence;
+        __sync_synchronize();
+        if(begin == 0)
+            return false;
+
+        // an odd sequence means the thread is publishing
+        if((begin & 1) != 0)
+            continue;
+
+        for(unsigned int i = 0; i < number_of_joints; ++i)
+        {
+            snapshot.q[i] = published[i];
+            snapshot.qdot[i] = published[number_of_joints + i];
+            snapshot.tau[i] = published[2*number_of_joints + i];
+        }
+
+        // ft_readings and ft_frames are both sorted by reference frame
+        unsigned int s = 0;
+        for(RobotUtils::ftReadings::iterator it = snapshot.ft_readings.begin();
+            it != snapshot.ft_readings.end(); ++it, ++s)
+        {
+            yarp::sig::Vector& reading = it->second;
+            if(reading.size() != 6)
+                reading.resize(6, 0.0);
+            for(unsigned int i = 0; i < 6; ++i)
+                reading[i] = published[ft_offset + 6*s + i];
+        }
+
+        for(unsigned int i = 0; i < imu_size; ++i)
+            snapshot.imu[i] = published[imu_offset + i];
+
+        snapshot.joints_timestamp = published[timestamps_offset];
+        snapshot.joints_skew = published[timestamps_offset + 1];
+        snapshot.ft_timestamp = published[timestamps_offset + 2];
+        snapshot.imu_timestamp = published[timestamps_offset + 3];
+
+        __sync_synchronize();
+        if(sequence == begin)
+        {
+            snapshot.sequence = begin / 2;
+            return true;
+        }
+    }
+}
+
+unsigned long RobotSensingThread::getNumberOfSnapshots() const
+{
+    return sequence / 2;
+}
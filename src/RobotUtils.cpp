@@ -18,6 +18,12 @@
 */
 
 #include <idynutils/RobotUtils.h>
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 using namespace iCub::iDynTree;
 using namespace yarp::math;
@@ -36,29 +42,11 @@ RobotUtils::RobotUtils(const std::string moduleName,
     head(walkman::robot::head, moduleName, robotName, true, walkman::controlTypes::none),
     q_sensed_right_hand( 1 ),
     q_sensed_left_hand( 1 ),
-    q_sensed_right_arm( right_arm.getNumberOfJoints() ),
-    q_sensed_left_arm( left_arm.getNumberOfJoints() ),
-    q_sensed_torso( torso.getNumberOfJoints() ),
-    q_sensed_right_leg( right_leg.getNumberOfJoints() ),
-    q_sensed_left_leg( left_leg.getNumberOfJoints() ),
-    q_sensed_head(head.getNumberOfJoints()),
     q_commanded_right_hand( 1 ),
     q_commanded_left_hand( 1 ),
-    q_commanded_right_arm( right_arm.getNumberOfJoints() ),
-    q_commanded_left_arm( left_arm.getNumberOfJoints() ),
-    q_commanded_torso( torso.getNumberOfJoints() ),
-    q_commanded_right_leg( right_leg.getNumberOfJoints() ),
-    q_commanded_left_leg( left_leg.getNumberOfJoints() ),
-    q_commanded_head(head.getNumberOfJoints()),
-    q_ref_feedback_sensed_right_hand( 1 ),
-    q_ref_feedback_sensed_left_hand( 1 ),
-    q_ref_feedback_sensed_right_arm( right_arm.getNumberOfJoints() ),
-    q_ref_feedback_sensed_left_arm( left_arm.getNumberOfJoints() ),
-    q_ref_feedback_sensed_torso( torso.getNumberOfJoints() ),
-    q_ref_feedback_sensed_right_leg( right_leg.getNumberOfJoints() ),
-    q_ref_feedback_sensed_left_leg( left_leg.getNumberOfJoints() ),
-    q_ref_feedback_sensed_head(head.getNumberOfJoints()),
     idynutils( robotName, urdf_path, srdf_path ),
+    sense_skew(0.0),
+    sense_timestamp(0.0),
     _moduleName(moduleName)
 {
     this->number_of_joints = idynutils.iDyn3_model.getNrOfDOFs();
@@ -67,8 +55,18 @@ RobotUtils::RobotUtils(const std::string moduleName,
     tau_sensed.resize(this->number_of_joints,0.0);
     q_ref_feedback_sensed.resize(this->number_of_joints,0.0);
 
+    buildJointPermutation();
+    setNumberOfIOThreads(1);
+
     loadIMUSensors();
     loadForceTorqueSensors();
+    buildftTable();
+}
+
+RobotUtils::~RobotUtils()
+{
+    for(unsigned int w = 0; w < chain_io_workers.size(); ++w)
+        chain_io_workers[w]->stop();
 }
 
 bool RobotUtils::hasHands()
@@ -97,21 +95,7 @@ const std::vector<std::string> &RobotUtils::getJointNames() const
 }
 
 void RobotUtils::move(const yarp::sig::Vector &_q) {
-
-    fromIdynToRobot(_q,
-                    q_commanded_right_arm,
-                    q_commanded_left_arm,
-                    q_commanded_torso,
-                    q_commanded_right_leg,
-                    q_commanded_left_leg,
-                    q_commanded_head);
-
-    torso.move(q_commanded_torso);
-    left_arm.move(q_commanded_left_arm);
-    right_arm.move(q_commanded_right_arm);
-    left_leg.move(q_commanded_left_leg);
-    right_leg.move(q_commanded_right_leg);
-    if(head.isAvailable) head.move(q_commanded_head);
+    scatter(_q);
 }
 
 bool RobotUtils::moveDone()
@@ -331,108 +315,362 @@ void RobotUtils::sense(yarp::sig::Vector &q,
                        yarp::sig::Vector &qdot,
                        yarp::sig::Vector &tau)
 {
-    q = sensePosition();
-    qdot = senseVelocity();
-    tau = senseTorque();
+    if(q.size() != this->number_of_joints) q.resize(this->number_of_joints, 0.0);
+    if(qdot.size() != this->number_of_joints) qdot.resize(this->number_of_joints, 0.0);
+    if(tau.size() != this->number_of_joints) tau.resize(this->number_of_joints, 0.0);
+
+    sense_skew = 0.0;
+    if(driver_sensed.empty())
+        return;
+
+    runChainIO(CHAIN_IO_SENSE_TIMED);
+
+    const double* driver_q = &driver_sensed[0];
+    const double* driver_qdot = &driver_sensed_qdot[0];
+    const double* driver_tau = &driver_sensed_tau[0];
+    const double* timestamps = &driver_timestamps[0];
+
+    double first_read = timestamps[chain_mappings[0].offset];
+    double last_read = first_read;
+    for(unsigned int c = 0; c < chain_mappings.size(); ++c)
+    {
+        const ChainMapping& mapping = chain_mappings[c];
+        const double scale = mapping.chain->getEncoderToSIScale();
+        const unsigned int end = mapping.offset + mapping.number_of_mapped_joints;
+        for(unsigned int i = mapping.offset; i < end; ++i)
+        {
+            const unsigned int model_index = model_indices[i];
+            q[model_index] = scale*driver_q[i];
+            qdot[model_index] = scale*driver_qdot[i];
+            tau[model_index] = driver_tau[i];
+        }
+
+        first_read = std::min(first_read, timestamps[mapping.offset]);
+        last_read = std::max(last_read, timestamps[mapping.offset]);
+    }
+    sense_skew = last_read - first_read;
+    sense_timestamp = last_read;
 }
 
-yarp::sig::Vector &RobotUtils::sensePosition()
+double RobotUtils::getSenseSkew() const
 {
-    right_arm.sensePosition(q_sensed_right_arm);
-    left_arm.sensePosition(q_sensed_left_arm);
-    torso.sensePosition(q_sensed_torso);
-    right_leg.sensePosition(q_sensed_right_leg);
-    left_leg.sensePosition(q_sensed_left_leg);
-    if(head.isAvailable) head.sensePosition(q_sensed_head);
-
-    fromRobotToIdyn(q_sensed_right_arm,
-                    q_sensed_left_arm,
-                    q_sensed_torso,
-                    q_sensed_right_leg,
-                    q_sensed_left_leg,
-                    q_sensed_head,
-                    q_sensed);
+    return sense_skew;
+}
 
+double RobotUtils::getSenseTimestamp() const
+{
+    return sense_timestamp;
+}
+
+yarp::sig::Vector &RobotUtils::sensePosition()
+{
+    gather(&walkman::yarp_single_chain_interface::sensePositionRaw, true, q_sensed);
     return q_sensed;
 }
 
 yarp::sig::Vector &RobotUtils::senseVelocity()
 {
-    right_arm.senseVelocity(qdot_sensed_right_arm);
-    left_arm.senseVelocity(qdot_sensed_left_arm);
-    torso.senseVelocity(qdot_sensed_torso);
-    right_leg.senseVelocity(qdot_sensed_right_leg);
-    left_leg.senseVelocity(qdot_sensed_left_leg);
-    if(head.isAvailable) head.senseVelocity(qdot_sensed_head);
-
-    fromRobotToIdyn(qdot_sensed_right_arm,
-                    qdot_sensed_left_arm,
-                    qdot_sensed_torso,
-                    qdot_sensed_right_leg,
-                    qdot_sensed_left_leg,
-                    qdot_sensed_head,
-                    qdot_sensed);
-
+    gather(&walkman::yarp_single_chain_interface::senseVelocityRaw, true, qdot_sensed);
     return qdot_sensed;
 }
 
 yarp::sig::Vector &RobotUtils::senseTorque()
 {
-    right_arm.senseTorque(tau_sensed_right_arm);
-    left_arm.senseTorque(tau_sensed_left_arm);
-    torso.senseTorque(tau_sensed_torso);
-    right_leg.senseTorque(tau_sensed_right_leg);
-    left_leg.senseTorque(tau_sensed_left_leg);
-    if(head.isAvailable) head.senseTorque(tau_sensed_head);
-
-    fromRobotToIdyn(tau_sensed_right_arm,
-                    tau_sensed_left_arm,
-                    tau_sensed_torso,
-                    tau_sensed_right_leg,
-                    tau_sensed_left_leg,
-                    tau_sensed_head,
-                    tau_sensed);
-
+    gather(&walkman::yarp_single_chain_interface::senseTorqueRaw, false, tau_sensed);
     return tau_sensed;
 }
 
 yarp::sig::Vector& RobotUtils::sensePositionRefFeedback()
 {
-    right_arm.sensePositionRefFeedback(q_ref_feedback_sensed_right_arm);
-    left_arm.sensePositionRefFeedback(q_ref_feedback_sensed_left_arm);
-    torso.sensePositionRefFeedback(q_ref_feedback_sensed_torso);
-    right_leg.sensePositionRefFeedback(q_ref_feedback_sensed_right_leg);
-    left_leg.sensePositionRefFeedback(q_ref_feedback_sensed_left_leg);
-    if(head.isAvailable) head.sensePositionRefFeedback(q_ref_feedback_sensed_head);
-
-    fromRobotToIdyn(q_ref_feedback_sensed_right_arm,
-                    q_ref_feedback_sensed_left_arm,
-                    q_ref_feedback_sensed_torso,
-                    q_ref_feedback_sensed_right_leg,
-                    q_ref_feedback_sensed_left_leg,
-                    q_ref_feedback_sensed_head,
-                    q_ref_feedback_sensed);
-
+    gather(&walkman::yarp_single_chain_interface::sensePositionRefFeedbackRaw, true, q_ref_feedback_sensed);
     return q_ref_feedback_sensed;
 }
 
+void RobotUtils::buildJointPermutation()
+{
+    walkman::yarp_single_chain_interface* chains[] = { &right_arm, &left_arm, &torso,
+                                                       &right_leg, &left_leg, &head };
+    kinematic_chain* model_chains[] = { &idynutils.right_arm, &idynutils.left_arm, &idynutils.torso,
+                                        &idynutils.right_leg, &idynutils.left_leg, &idynutils.head };
+
+    chain_mappings.clear();
+    model_indices.clear();
+    for(unsigned int c = 0; c < 6; ++c)
+    {
+        if(!chains[c]->isAvailable || chains[c]->getNumberOfJoints() <= 0 ||
+           model_chains[c]->joint_numbers.empty())
+            continue;
+
+        ChainMapping mapping;
+        mapping.chain = chains[c];
+        mapping.offset = model_indices.size();
+        mapping.number_of_driver_joints = chains[c]->getNumberOfJoints();
+        mapping.number_of_mapped_joints = std::min<unsigned int>(mapping.number_of_driver_joints,
+                                                                 model_chains[c]->joint_numbers.size());
+        if(mapping.number_of_mapped_joints < model_chains[c]->joint_numbers.size())
+            std::cout << "Chain " << chains[c]->getChainName() << " has "
+                      << mapping.number_of_driver_joints << " joints but "
+                      << model_chains[c]->joint_numbers.size() << " joints in the model" << std::endl;
+
+        model_indices.resize(mapping.offset + mapping.number_of_driver_joints, 0);
+        for(unsigned int i = 0; i < mapping.number_of_mapped_joints; ++i)
+            model_indices[mapping.offset + i] = model_chains[c]->joint_numbers[i];
+
+        chain_mappings.push_back(mapping);
+    }
+
+    driver_sensed.assign(model_indices.size(), 0.0);
+    driver_sensed_qdot.assign(model_indices.size(), 0.0);
+    driver_sensed_tau.assign(model_indices.size(), 0.0);
+    driver_timestamps.assign(model_indices.size(), 0.0);
+    driver_commanded.assign(model_indices.size(), 0.0);
+}
+
+void RobotUtils::gather(const RawSenseFunction senseRaw,
+                        const bool convertToSI,
+                        yarp::sig::Vector& q)
+{
+    if(driver_sensed.empty())
+        return;
+
+    runChainIO(CHAIN_IO_SENSE_RAW, senseRaw);
+
+    const double* driver = &driver_sensed[0];
+    for(unsigned int c = 0; c < chain_mappings.size(); ++c)
+    {
+        const ChainMapping& mapping = chain_mappings[c];
+        const double scale = convertToSI ? mapping.chain->getEncoderToSIScale() : 1.0;
+        const unsigned int end = mapping.offset + mapping.number_of_mapped_joints;
+        for(unsigned int i = mapping.offset; i < end; ++i)
+            q[model_indices[i]] = scale*driver[i];
+    }
+}
+
+void RobotUtils::scatter(const yarp::sig::Vector& q)
+{
+    if(driver_commanded.empty())
+        return;
+
+    // each chain permutes its own command
+    runChainIO(CHAIN_IO_MOVE, NULL, &q);
+}
+
+/**
+ * @brief The ChainIOWorker class performs the current I/O operation on the chains of a bin, every time it is started.
+ *        On linux, it is pinned to a cpu
+ */
+class RobotUtils::ChainIOWorker : public yarp::os::Thread
+{
+    RobotUtils& father;
+    const unsigned int bin;
+    yarp::os::Semaphore start_semaphore;
+    yarp::os::Semaphore done_semaphore;
+
+public:
+    ChainIOWorker(RobotUtils& father, const unsigned int bin) :
+        father(father), bin(bin), start_semaphore(0), done_semaphore(0)
+    {
+
+    }
+
+    void startBin()
+    {
+        start_semaphore.post();
+    }
+
+    void waitBin()
+    {
+        done_semaphore.wait();
+    }
+
+    virtual bool threadInit()
+    {
+#ifdef __linux__
+        long number_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if(number_of_cpus > 0)
+        {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(bin % number_of_cpus, &cpu_set);
+            if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) != 0)
+                std::cout << "Could not pin chain I/O thread " << bin << " to cpu "
+                          << bin % number_of_cpus << std::endl;
+        }
+#endif
+        return true;
+    }
+
+    virtual void onStop()
+    {
+        start_semaphore.post();
+    }
+
+    virtual void run()
+    {
+        while(true)
+        {
+            start_semaphore.wait();
+            if(isStopping())
+                break;
+
+            father.doChainIO(bin, father.chain_io,
+                             father.chain_io_sense_raw, father.chain_io_command);
+            done_semaphore.post();
+        }
+    }
+};
+
+void RobotUtils::doChainIO(const unsigned int bin,
+                           const RobotUtils::ChainIO io,
+                           const RawSenseFunction senseRaw,
+                           const yarp::sig::Vector* command)
+{
+    const std::vector<unsigned int>& chains = chain_io_bins[bin];
+    for(unsigned int k = 0; k < chains.size(); ++k)
+    {
+        const ChainMapping& mapping = chain_mappings[chains[k]];
+        const unsigned int offset = mapping.offset;
+        switch(io)
+        {
+            case CHAIN_IO_SENSE_RAW:
+                (mapping.chain->*senseRaw)(&driver_sensed[offset]);
+                break;
+            case CHAIN_IO_SENSE_TIMED:
+                mapping.chain->senseRaw(&driver_sensed[offset],
+                                        &driver_sensed_qdot[offset],
+                                        &driver_sensed_tau[offset],
+                                        &driver_timestamps[offset]);
+                break;
+            case CHAIN_IO_MOVE:
+            {
+                const yarp::sig::Vector& q = *command;
+                const double scale = mapping.chain->getMotorCommandFromSIScale();
+                const unsigned int end = offset + mapping.number_of_mapped_joints;
+                for(unsigned int i = offset; i < end; ++i)
+                    driver_commanded[i] = scale*q[model_indices[i]];
+
+                mapping.chain->moveRaw(&driver_commanded[offset]);
+                break;
+            }
+        }
+    }
+}
+
+void RobotUtils::runChainIO(const RobotUtils::ChainIO io,
+                            const RawSenseFunction senseRaw,
+                            const yarp::sig::Vector* command)
+{
+    // without workers nothing is shared, so that sense and move can be called from different threads
+    if(chain_io_workers.empty())
+    {
+        doChainIO(0, io, senseRaw, command);
+        return;
+    }
+
+    chain_io = io;
+    chain_io_sense_raw = senseRaw;
+    chain_io_command = command;
+
+    // the calling thread does the first bin, then waits for the workers
+    for(unsigned int w = 0; w < chain_io_workers.size(); ++w)
+        chain_io_workers[w]->startBin();
+    doChainIO(0, io, senseRaw, command);
+    for(unsigned int w = 0; w < chain_io_workers.size(); ++w)
+        chain_io_workers[w]->waitBin();
+}
+
+void RobotUtils::setNumberOfIOThreads(const unsigned int number_of_threads)
+{
+    for(unsigned int w = 0; w < chain_io_workers.size(); ++w)
+        chain_io_workers[w]->stop();
+    chain_io_workers.clear();
+
+    const unsigned int number_of_bins = std::max(1u, std::min<unsigned int>(number_of_threads,
+                                                                            chain_mappings.size()));
+    chain_io_bins.assign(number_of_bins, std::vector<unsigned int>());
+    for(unsigned int c = 0; c < chain_mappings.size(); ++c)
+        chain_io_bins[c % number_of_bins].push_back(c);
+
+    for(unsigned int bin = 1; bin < number_of_bins; ++bin)
+    {
+        boost::shared_ptr<ChainIOWorker> worker(new ChainIOWorker(*this, bin));
+        worker->start();
+        chain_io_workers.push_back(worker);
+    }
+}
+
+unsigned int RobotUtils::getNumberOfIOThreads() const
+{
+    return chain_io_workers.size() + 1;
+}
+
 
 RobotUtils::ftReadings& RobotUtils::senseftSensors()
 {
-    ft_readings.clear();
-    for( ftPtrMap::iterator i = ftSensors.begin(); i != ftSensors.end(); ++i)
+    // ft_readings has the same keys of ftSensors, so they are iterated together
+    ftReadings::iterator reading = ft_readings.begin();
+    for( ftPtrMap::iterator i = ftSensors.begin(); i != ftSensors.end(); ++i, ++reading)
     {
-        ft_readings[i->first] = i->second->sense();
+        i->second->sense(reading->second);
     }
     return ft_readings;
 }
 
+const std::vector<yarp::sig::Vector>& RobotUtils::senseftTable()
+{
+    for(unsigned int i = 0; i < ft_table_sensors.size(); ++i)
+        ft_table_sensors[i]->sense(ft_table_readings[i]);
+    return ft_table_readings;
+}
+
+int RobotUtils::getftIndex(const std::string& ft_frame) const
+{
+    for(unsigned int i = 0; i < ft_reference_frames.size(); ++i)
+        if(ft_reference_frames[i] == ft_frame)
+            return i;
+    return -1;
+}
+
+void RobotUtils::updateiDyn3Model(iDynUtils& model,
+                                  const yarp::sig::Vector& q,
+                                  const bool set_world_pose)
+{
+    model.updateiDyn3Model(q, ft_table_model_indices, senseftTable(), set_world_pose);
+}
+
+void RobotUtils::updateiDyn3Model(const yarp::sig::Vector& q,
+                                  const bool set_world_pose)
+{
+    updateiDyn3Model(idynutils, q, set_world_pose);
+}
+
+void RobotUtils::buildftTable()
+{
+    ft_table_sensors.clear();
+    ft_table_readings.clear();
+    ft_table_model_indices.clear();
+    ft_readings.clear();
+
+    for(unsigned int i = 0; i < ft_reference_frames.size(); ++i)
+    {
+        const std::string& ft_frame = ft_reference_frames[i];
+        ft_table_sensors.push_back(ftSensors[ft_frame]);
+        ft_table_readings.push_back(yarp::sig::Vector(6, 0.0));
+        ft_table_model_indices.push_back(idynutils.getFTSensorIndex(ft_frame));
+        if(ft_table_model_indices.back() < 0)
+            std::cout << "ft on " << ft_frame << " is not in the model" << std::endl;
+
+        ft_readings[ft_frame] = yarp::sig::Vector(6, 0.0);
+    }
+}
+
 bool RobotUtils::senseftSensor(const std::string &ft_frame,
                                yarp::sig::Vector &ftReading)
 {
-    if(ftSensors[ft_frame]) {
-        ftPtr ft(ftSensors[ft_frame]);
-        return ft->sense(ftReading);
+    // find does not insert unknown frames, which would break senseftSensors
+    ftPtrMap::iterator it = ftSensors.find(ft_frame);
+    if(it != ftSensors.end() && it->second) {
+        return it->second->sense(ftReading);
     }
     return false;
 }
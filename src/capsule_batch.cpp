@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <idynutils/capsule_batch.h>
+#include <assert.h>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* pair buffers are always padded to the widest SIMD width we support */
+#define CAPSULE_BATCH_PADDING 4
+
+namespace {
+
+/* The packs wrap the arithmetic of a SIMD register, so that the same
+   segment-segment kernel is used for the scalar, SSE2 and AVX versions */
+struct ScalarPack
+{
+    typedef double type;
+    static const unsigned int width = 1;
+    static type load(const double* p) { return *p; }
+    static void store(double* p, const type v) { *p = v; }
+    static type set1(const double v) { return v; }
+    static type add(const type a, const type b) { return a + b; }
+    static type sub(const type a, const type b) { return a - b; }
+    static type mul(const type a, const type b) { return a * b; }
+    static type div(const type a, const type b) { return a / b; }
+    static type min(const type a, const type b) { return a < b ? a : b; }
+    static type max(const type a, const type b) { return a > b ? a : b; }
+    static type sqrt(const type a) { return std::sqrt(a); }
+    /* returns a > b ? x : y */
+    static type selectGreater(const type a, const type b, const type x, const type y) { return a > b ? x : y; }
+};
+
+#if defined(__SSE2__)
+struct SSE2Pack
+{
+    typedef __m128d type;
+    static const unsigned int width = 2;
+    static type load(const double* p) { return _mm_load_pd(p); }
+    static void store(double* p, const type v) { _mm_store_pd(p, v); }
+    static type set1(const double v) { return _mm_set1_pd(v); }
+    static type add(const type a, const type b) { return _mm_add_pd(a, b); }
+    static type sub(const type a, const type b) { return _mm_sub_pd(a, b); }
+    static type mul(const type a, const type b) { return _mm_mul_pd(a, b); }
+    static type div(const type a, const type b) { return _mm_div_pd(a, b); }
+    static type min(const type a, const type b) { return _mm_min_pd(a, b); }
+    static type max(const type a, const type b) { return _mm_max_pd(a, b); }
+    static type sqrt(const type a) { return _mm_sqrt_pd(a); }
+    static type selectGreater(const type a, const type b, const type x, const type y)
+    {
+        type mask = _mm_cmpgt_pd(a, b);
+        return _mm_or_pd(_mm_and_pd(mask, x), _mm_andnot_pd(mask, y));
+    }
+};
+#endif
+
+#if defined(__AVX__)
+struct AVXPack
+{
+    typedef __m256d type;
+    static const unsigned int width = 4;
+    /* Eigen::aligned_allocator only guarantees 16 bytes alignment */
+    static type load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, const type v) { _mm256_storeu_pd(p, v); }
+    static type set1(const double v) { return _mm256_set1_pd(v); }
+    static type add(const type a, const type b) { return _mm256_add_pd(a, b); }
+    static type sub(const type a, const type b) { return _mm256_sub_pd(a, b); }
+    static type mul(const type a, const type b) { return _mm256_mul_pd(a, b); }
+    static type div(const type a, const type b) { return _mm256_div_pd(a, b); }
+    static type min(const type a, const type b) { return _mm256_min_pd(a, b); }
+    static type max(const type a, const type b) { return _mm256_max_pd(a, b); }
+    static type sqrt(const type a) { return _mm256_sqrt_pd(a); }
+    static type selectGreater(const type a, const type b, const type x, const type y)
+    {
+        return _mm256_blendv_pd(y, x, _mm256_cmp_pd(a, b, _CMP_GT_OQ));
+    }
+};
+typedef AVXPack NativePack;
+#elif defined(__SSE2__)
+typedef SSE2Pack NativePack;
+#else
+typedef ScalarPack NativePack;
+#endif
+
+struct PairBuffers
+{
+    const double *a1_x, *a1_y, *a1_z, *a2_x, *a2_y, *a2_z, *r_a;
+    const double *b1_x, *b1_y, *b1_z, *b2_x, *b2_y, *b2_z, *r_b;
+    double *distance, *pa_x, *pa_y, *pa_z, *pb_x, *pb_y, *pb_z;
+};
+
+/**
+ * @brief segmentDistances computes the closest points between the capsules of pairs [begin, end).
+ *        The closest points on the segments are found by clamping the unconstrained solution
+ *        on the first segment, then the second, then the first again, which is branch-free
+ *        and equivalent to the classic case analysis.
+ */
+template<class P>
+void segmentDistances(const PairBuffers& buffers, const unsigned int begin, const unsigned int end)
+{
+    typedef typename P::type T;
+    const T zero = P::set1(0.0);
+    const T one = P::set1(1.0);
+    const T eps = P::set1(1e-12);
+
+    for(unsigned int i = begin; i < end; i += P::width)
+    {
+        T a1x = P::load(buffers.a1_x + i), a1y = P::load(buffers.a1_y + i), a1z = P::load(buffers.a1_z + i);
+        T b1x = P::load(buffers.b1_x + i), b1y = P::load(buffers.b1_y + i), b1z = P::load(buffers.b1_z + i);
+
+        T d1x = P::sub(P::load(buffers.a2_x + i), a1x);
+        T d1y = P::sub(P::load(buffers.a2_y + i), a1y);
+        T d1z = P::sub(P::load(buffers.a2_z + i), a1z);
+        T d2x = P::sub(P::load(buffers.b2_x + i), b1x);
+        T d2y = P::sub(P::load(buffers.b2_y + i), b1y);
+        T d2z = P::sub(P::load(buffers.b2_z + i), b1z);
+        T rx = P::sub(a1x, b1x), ry = P::sub(a1y, b1y), rz = P::sub(a1z, b1z);
+
+        T a = P::add(P::add(P::mul(d1x,d1x), P::mul(d1y,d1y)), P::mul(d1z,d1z));
+        T e = P::add(P::add(P::mul(d2x,d2x), P::mul(d2y,d2y)), P::mul(d2z,d2z));
+        T b = P::add(P::add(P::mul(d1x,d2x), P::mul(d1y,d2y)), P::mul(d1z,d2z));
+        T c = P::add(P::add(P::mul(d1x,rx), P::mul(d1y,ry)), P::mul(d1z,rz));
+        T f = P::add(P::add(P::mul(d2x,rx), P::mul(d2y,ry)), P::mul(d2z,rz));
+        T denom = P::sub(P::mul(a,e), P::mul(b,b));
+
+        // parameter on the first segment for the infinite lines, 0 if they are parallel
+        T s = P::div(P::sub(P::mul(b,f), P::mul(c,e)), P::max(denom, eps));
+        s = P::selectGreater(denom, eps, P::min(P::max(s, zero), one), zero);
+        // parameter on the second segment, 0 if it is degenerate
+        T t = P::div(P::add(P::mul(b,s), f), P::max(e, eps));
+        t = P::selectGreater(e, eps, P::min(P::max(t, zero), one), zero);
+        // back on the first segment, 0 if it is degenerate
+        s = P::div(P::sub(P::mul(b,t), c), P::max(a, eps));
+        s = P::selectGreater(a, eps, P::min(P::max(s, zero), one), zero);
+
+        T cax = P::add(a1x, P::mul(s,d1x)), cay = P::add(a1y, P::mul(s,d1y)), caz = P::add(a1z, P::mul(s,d1z));
+        T cbx = P::add(b1x, P::mul(t,d2x)), cby = P::add(b1y, P::mul(t,d2y)), cbz = P::add(b1z, P::mul(t,d2z));
+
+        T dx = P::sub(cbx, cax), dy = P::sub(cby, cay), dz = P::sub(cbz, caz);
+        T length = P::sqrt(P::add(P::add(P::mul(dx,dx), P::mul(dy,dy)), P::mul(dz,dz)));
+        // for intersecting axes any direction is valid
+        T inv_length = P::div(one, P::max(length, eps));
+        T nx = P::selectGreater(length, eps, P::mul(dx, inv_length), zero);
+        T ny = P::selectGreater(length, eps, P::mul(dy, inv_length), zero);
+        T nz = P::selectGreater(length, eps, P::mul(dz, inv_length), one);
+
+        T ra = P::load(buffers.r_a + i), rb = P::load(buffers.r_b + i);
+        P::store(buffers.distance + i, P::sub(P::sub(length, ra), rb));
+        P::store(buffers.pa_x + i, P::add(cax, P::mul(ra, nx)));
+        P::store(buffers.pa_y + i, P::add(cay, P::mul(ra, ny)));
+        P::store(buffers.pa_z + i, P::add(caz, P::mul(ra, nz)));
+        P::store(buffers.pb_x + i, P::sub(cbx, P::mul(rb, nx)));
+        P::store(buffers.pb_y + i, P::sub(cby, P::mul(rb, ny)));
+        P::store(buffers.pb_z + i, P::sub(cbz, P::mul(rb, nz)));
+    }
+}
+}
+
+CapsuleBatch::CapsuleBatch()
+{
+
+}
+
+unsigned int CapsuleBatch::addCapsule(const double radius)
+{
+    ep1_x.push_back(0.0); ep1_y.push_back(0.0); ep1_z.push_back(0.0);
+    ep2_x.push_back(0.0); ep2_y.push_back(0.0); ep2_z.push_back(0.0);
+    this->radius.push_back(radius);
+    return this->radius.size() - 1;
+}
+
+void CapsuleBatch::setEndPoints(const unsigned int capsule,
+                                const KDL::Vector& endPoint1,
+                                const KDL::Vector& endPoint2)
+{
+    assert(capsule < radius.size());
+    ep1_x[capsule] = endPoint1.x(); ep1_y[capsule] = endPoint1.y(); ep1_z[capsule] = endPoint1.z();
+    ep2_x[capsule] = endPoint2.x(); ep2_y[capsule] = endPoint2.y(); ep2_z[capsule] = endPoint2.z();
+}
+
+unsigned int CapsuleBatch::addPair(const unsigned int capsuleA, const unsigned int capsuleB)
+{
+    assert(capsuleA < radius.size() && capsuleB < radius.size());
+    pair_a.push_back(capsuleA);
+    pair_b.push_back(capsuleB);
+    resizePairBuffers();
+    return pair_a.size() - 1;
+}
+
+void CapsuleBatch::clearPairs()
+{
+    pair_a.clear();
+    pair_b.clear();
+    resizePairBuffers();
+}
+
+void CapsuleBatch::resizePairBuffers()
+{
+    unsigned int padded_size = ((pair_a.size() + CAPSULE_BATCH_PADDING - 1) / CAPSULE_BATCH_PADDING) *
+                               CAPSULE_BATCH_PADDING;
+
+    AlignedArray* buffers[] = { &a1_x, &a1_y, &a1_z, &a2_x, &a2_y, &a2_z, &r_a,
+                                &b1_x, &b1_y, &b1_z, &b2_x, &b2_y, &b2_z, &r_b,
+                                &distance, &pa_x, &pa_y, &pa_z, &pb_x, &pb_y, &pb_z };
+    for(unsigned int i = 0; i < sizeof(buffers)/sizeof(buffers[0]); ++i)
+        buffers[i]->assign(padded_size, 0.0);
+}
+
+void CapsuleBatch::gatherPairs()
+{
+    for(unsigned int i = 0; i < pair_a.size(); ++i)
+    {
+        const unsigned int a = pair_a[i];
+        const unsigned int b = pair_b[i];
+        a1_x[i] = ep1_x[a]; a1_y[i] = ep1_y[a]; a1_z[i] = ep1_z[a];
+        a2_x[i] = ep2_x[a]; a2_y[i] = ep2_y[a]; a2_z[i] = ep2_z[a];
+        r_a[i] = radius[a];
+        b1_x[i] = ep1_x[b]; b1_y[i] = ep1_y[b]; b1_z[i] = ep1_z[b];
+        b2_x[i] = ep2_x[b]; b2_y[i] = ep2_y[b]; b2_z[i] = ep2_z[b];
+        r_b[i] = radius[b];
+    }
+}
+
+void CapsuleBatch::computeDistances()
+{
+    gatherPairs();
+
+    PairBuffers buffers = { &a1_x[0], &a1_y[0], &a1_z[0], &a2_x[0], &a2_y[0], &a2_z[0], &r_a[0],
+                            &b1_x[0], &b1_y[0], &b1_z[0], &b2_x[0], &b2_y[0], &b2_z[0], &r_b[0],
+                            &distance[0], &pa_x[0], &pa_y[0], &pa_z[0], &pb_x[0], &pb_y[0], &pb_z[0] };
+    if(pair_a.size() > 0)
+        segmentDistances<NativePack>(buffers, 0, a1_x.size());
+}
+
+void CapsuleBatch::computeDistancesScalar()
+{
+    gatherPairs();
+
+    for(unsigned int i = 0; i < pair_a.size(); ++i)
+        computePair(i);
+}
+
+void CapsuleBatch::computePair(const unsigned int i)
+{
+    PairBuffers buffers = { &a1_x[0], &a1_y[0], &a1_z[0], &a2_x[0], &a2_y[0], &a2_z[0], &r_a[0],
+                            &b1_x[0], &b1_y[0], &b1_z[0], &b2_x[0], &b2_y[0], &b2_z[0], &r_b[0],
+                            &distance[0], &pa_x[0], &pa_y[0], &pa_z[0], &pb_x[0], &pb_y[0], &pb_z[0] };
+    segmentDistances<ScalarPack>(buffers, i, i+1);
+}
+
+double CapsuleBatch::segmentsDistance(const KDL::Vector& A1, const KDL::Vector& A2,
+                                      const KDL::Vector& B1, const KDL::Vector& B2,
+                                      KDL::Vector& closestPointA, KDL::Vector& closestPointB)
+{
+    // one lane of the kernel, with null radii the closest points lie on the segments
+    const double zero = 0.0;
+    double distance;
+    PairBuffers buffers = { &A1.data[0], &A1.data[1], &A1.data[2], &A2.data[0], &A2.data[1], &A2.data[2], &zero,
+                            &B1.data[0], &B1.data[1], &B1.data[2], &B2.data[0], &B2.data[1], &B2.data[2], &zero,
+                            &distance,
+                            &closestPointA.data[0], &closestPointA.data[1], &closestPointA.data[2],
+                            &closestPointB.data[0], &closestPointB.data[1], &closestPointB.data[2] };
+    segmentDistances<ScalarPack>(buffers, 0, 1);
+    return distance;
+}
+
+unsigned int CapsuleBatch::getNrOfCapsules() const
+{
+    return radius.size();
+}
+
+unsigned int CapsuleBatch::getNrOfPairs() const
+{
+    return pair_a.size();
+}
+
+double CapsuleBatch::getDistance(const unsigned int pair) const
+{
+    assert(pair < pair_a.size());
+    return distance[pair];
+}
+
+void CapsuleBatch::getClosestPoints(const unsigned int pair,
+                                    KDL::Vector& closestPointA,
+                                    KDL::Vector& closestPointB) const
+{
+    assert(pair < pair_a.size());
+    closestPointA = KDL::Vector(pa_x[pair], pa_y[pair], pa_z[pair]);
+    closestPointB = KDL::Vector(pb_x[pair], pb_y[pair], pb_z[pair]);
+}
+
+unsigned int CapsuleBatch::getSIMDWidth()
+{
+    return NativePack::width;
+}
@@ -0,0 +1,627 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <boost/filesystem.hpp>
+#include <idynutils/capsule_batch.h>
+#include <idynutils/capsule_fitting.h>
+#include <geometric_shapes/shapes.h>
+#include <geometric_shapes/shape_operations.h>
+#include <urdf_parser/urdf_parser.h>
+#include <tinyxml.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <set>
+
+namespace {
+
+const double CAPSULE_FITTING_PI = 3.14159265358979323846;
+
+KDL::Frame poseToKdl(const urdf::Pose& p)
+{
+    return KDL::Frame(KDL::Rotation::Quaternion(p.rotation.x, p.rotation.y, p.rotation.z, p.rotation.w),
+                      KDL::Vector(p.position.x, p.position.y, p.position.z));
+}
+
+urdf::Pose kdlToPose(const KDL::Frame& f)
+{
+    urdf::Pose p;
+    p.position.x = f.p.x();
+    p.position.y = f.p.y();
+    p.position.z = f.p.z();
+    double x, y, z, w;
+    f.M.GetQuaternion(x, y, z, w);
+    p.rotation.setFromQuaternion(x, y, z, w);
+    return p;
+}
+
+bool lessVector(const KDL::Vector& a, const KDL::Vector& b)
+{
+    if(a.x() != b.x()) return a.x() < b.x();
+    if(a.y() != b.y()) return a.y() < b.y();
+    return a.z() < b.z();
+}
+
+bool equalVector(const KDL::Vector& a, const KDL::Vector& b)
+{
+    return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+}
+
+/**
+ * @brief The LinearCongruentialGenerator class makes the point shuffling deterministic
+ */
+class LinearCongruentialGenerator
+{
+    unsigned long state;
+public:
+    LinearCongruentialGenerator() : state(12345) {}
+    /* returns a number in [0, n) */
+    unsigned long next(const unsigned long n)
+    {
+        state = (1103515245ul*state + 12345ul) & 0x7ffffffful;
+        return state % n;
+    }
+};
+
+struct Circle
+{
+    double x, y, r;
+    Circle(const double x = 0.0, const double y = 0.0, const double r = 0.0) : x(x), y(y), r(r) {}
+    bool contains(const double px, const double py) const
+    {
+        return std::sqrt((px-x)*(px-x) + (py-y)*(py-y)) <= r + 1E-12;
+    }
+};
+
+Circle circleFrom2(const double ax, const double ay, const double bx, const double by)
+{
+    return Circle((ax+bx)/2.0, (ay+by)/2.0, std::sqrt((ax-bx)*(ax-bx) + (ay-by)*(ay-by))/2.0);
+}
+
+Circle circleFrom3(const double ax, const double ay,
+                   const double bx, const double by,
+                   const double cx, const double cy)
+{
+    const double d = 2.0*(ax*(by-cy) + bx*(cy-ay) + cx*(ay-by));
+    if(std::fabs(d) < 1E-15)
+    {
+        // collinear points, the circle is defined by the farthest pair
+        Circle c = circleFrom2(ax, ay, bx, by);
+        Circle c2 = circleFrom2(ax, ay, cx, cy);
+        Circle c3 = circleFrom2(bx, by, cx, cy);
+        if(c2.r > c.r) c = c2;
+        if(c3.r > c.r) c = c3;
+        return c;
+    }
+
+    const double a2 = ax*ax + ay*ay, b2 = bx*bx + by*by, c2 = cx*cx + cy*cy;
+    const double x = (a2*(by-cy) + b2*(cy-ay) + c2*(ay-by))/d;
+    const double y = (a2*(cx-bx) + b2*(ax-cx) + c2*(bx-ax))/d;
+    return Circle(x, y, std::sqrt((ax-x)*(ax-x) + (ay-y)*(ay-y)));
+}
+
+/**
+ * @brief minimumEnclosingCircle computes the minimum enclosing circle of 2D points
+ *        with the randomized incremental algorithm by Welzl, expected linear time
+ */
+Circle minimumEnclosingCircle(const std::vector<double>& x,
+                              const std::vector<double>& y,
+                              std::vector<unsigned int>& order)
+{
+    // Fisher-Yates shuffle, so that the order does not depend on the standard library implementation
+    LinearCongruentialGenerator generator;
+    for(unsigned int i = order.size(); i > 1; --i)
+        std::swap(order[i-1], order[generator.next(i)]);
+
+    Circle c(x[order[0]], y[order[0]], 0.0);
+    for(unsigned int i = 1; i < order.size(); ++i)
+    {
+        const unsigned int pi = order[i];
+        if(c.contains(x[pi], y[pi]))
+            continue;
+
+        c = Circle(x[pi], y[pi], 0.0);
+        for(unsigned int j = 0; j < i; ++j)
+        {
+            const unsigned int pj = order[j];
+            if(c.contains(x[pj], y[pj]))
+                continue;
+
+            c = circleFrom2(x[pi], y[pi], x[pj], y[pj]);
+            for(unsigned int k = 0; k < j; ++k)
+            {
+                const unsigned int pk = order[k];
+                if(!c.contains(x[pk], y[pk]))
+                    c = circleFrom3(x[pi], y[pi], x[pj], y[pj], x[pk], y[pk]);
+            }
+        }
+    }
+    return c;
+}
+
+/**
+ * @brief The AxisFitting class fits capsules with a given axis direction
+ */
+class AxisFitting
+{
+    const std::vector<KDL::Vector>& points;
+    std::vector<double> x, y, t, rho;
+    std::vector<unsigned int> order;
+
+public:
+    AxisFitting(const std::vector<KDL::Vector>& points) :
+        points(points), x(points.size()), y(points.size()), t(points.size()), rho(points.size()),
+        order(points.size())
+    {
+
+    }
+
+    /**
+     * @brief getVolume computes the axis interval [t1, t2] and the volume of the smallest capsule
+     *        of given radius around the current axis which contains all the points
+     */
+    double getVolume(const double radius, double& t1, double& t2) const
+    {
+        t1 = std::numeric_limits<double>::infinity();
+        t2 = -std::numeric_limits<double>::infinity();
+        for(unsigned int i = 0; i < points.size(); ++i)
+        {
+            const double h = std::sqrt(std::max(radius*radius - rho[i]*rho[i], 0.0));
+            t1 = std::min(t1, t[i] + h);
+            t2 = std::max(t2, t[i] - h);
+        }
+
+        if(t2 < t1)
+        {
+            // a sphere is enough
+            t1 = t2 = (t1 + t2)/2.0;
+        }
+
+        return CAPSULE_FITTING_PI*radius*radius*(t2 - t1) + 4.0/3.0*CAPSULE_FITTING_PI*radius*radius*radius;
+    }
+
+    double fit(const KDL::Vector& axis, CapsuleFitting::Capsule& capsule)
+    {
+        KDL::Vector u = axis * (std::fabs(axis.x()) < 0.9 ? KDL::Vector(1.0, 0.0, 0.0) : KDL::Vector(0.0, 1.0, 0.0));
+        u.Normalize();
+        KDL::Vector v = axis * u;
+
+        double t_min = std::numeric_limits<double>::infinity();
+        double t_max = -std::numeric_limits<double>::infinity();
+        for(unsigned int i = 0; i < points.size(); ++i)
+        {
+            x[i] = KDL::dot(points[i], u);
+            y[i] = KDL::dot(points[i], v);
+            t[i] = KDL::dot(points[i], axis);
+            t_min = std::min(t_min, t[i]);
+            t_max = std::max(t_max, t[i]);
+            order[i] = i;
+        }
+
+        // the capsule axis goes through the center of the minimum enclosing circle of the projected points
+        Circle circle = minimumEnclosingCircle(x, y, order);
+        double r_min = 0.0;
+        for(unsigned int i = 0; i < points.size(); ++i)
+        {
+            rho[i] = std::sqrt((x[i]-circle.x)*(x[i]-circle.x) + (y[i]-circle.y)*(y[i]-circle.y));
+            r_min = std::max(r_min, rho[i]);
+        }
+
+        // a sphere of radius r_max around the middle of the axis contains all the points
+        const double r_max = std::sqrt(r_min*r_min + (t_max-t_min)*(t_max-t_min)/4.0);
+
+        // the volume is sampled, then refined around the best sample by golden section search
+        const unsigned int samples = 16;
+        double t1, t2;
+        double best_volume = std::numeric_limits<double>::infinity();
+        unsigned int best_sample = 0;
+        for(unsigned int s = 0; s <= samples; ++s)
+        {
+            const double volume = getVolume(r_min + (r_max - r_min)*s/samples, t1, t2);
+            if(volume < best_volume)
+            {
+                best_volume = volume;
+                best_sample = s;
+            }
+        }
+
+        double a = r_min + (r_max - r_min)*(best_sample > 0 ? best_sample - 1 : 0)/samples;
+        double b = r_min + (r_max - r_min)*std::min(best_sample + 1, samples)/samples;
+        const double golden = (std::sqrt(5.0) - 1.0)/2.0;
+        double c = b - golden*(b - a);
+        double d = a + golden*(b - a);
+        double volume_c = getVolume(c, t1, t2);
+        double volume_d = getVolume(d, t1, t2);
+        for(unsigned int i = 0; i < 30; ++i)
+        {
+            if(volume_c < volume_d)
+            {
+                b = d; d = c; volume_d = volume_c;
+                c = b - golden*(b - a);
+                volume_c = getVolume(c, t1, t2);
+            }
+            else
+            {
+                a = c; c = d; volume_c = volume_d;
+                d = a + golden*(b - a);
+                volume_d = getVolume(d, t1, t2);
+            }
+        }
+
+        double radius = r_min + (r_max - r_min)*best_sample/samples;
+        if(std::min(volume_c, volume_d) < best_volume)
+            radius = volume_c < volume_d ? c : d;
+        best_volume = getVolume(radius, t1, t2);
+
+        const KDL::Vector center = circle.x*u + circle.y*v;
+        capsule = CapsuleFitting::Capsule(center + t1*axis, center + t2*axis, radius);
+        return best_volume;
+    }
+};
+
+/**
+ * @brief segmentsDistance computes the distance between two segments, see CapsuleBatch::segmentsDistance
+ */
+double segmentsDistance(const KDL::Vector& p1, const KDL::Vector& q1,
+                        const KDL::Vector& p2, const KDL::Vector& q2)
+{
+    KDL::Vector closest_point1, closest_point2;
+    return CapsuleBatch::segmentsDistance(p1, q1, p2, q2, closest_point1, closest_point2);
+}
+
+void computeZeroConfigurationPoses(const urdf::ModelInterface& robot_urdf,
+                                   const boost::shared_ptr<const urdf::Link>& link,
+                                   const KDL::Frame& w_T_link,
+                                   std::map<std::string, KDL::Frame>& w_T_links)
+{
+    w_T_links[link->name] = w_T_link;
+    for(unsigned int i = 0; i < link->child_joints.size(); ++i)
+    {
+        const boost::shared_ptr<urdf::Joint>& joint = link->child_joints[i];
+        boost::shared_ptr<const urdf::Link> child = robot_urdf.getLink(joint->child_link_name);
+        if(child)
+            computeZeroConfigurationPoses(robot_urdf, child,
+                                          w_T_link * poseToKdl(joint->parent_to_joint_origin_transform),
+                                          w_T_links);
+    }
+}
+
+}
+
+CapsuleFitting::Capsule::Capsule() :
+    radius(0.0)
+{
+
+}
+
+CapsuleFitting::Capsule::Capsule(const KDL::Vector& endPoint1,
+                                 const KDL::Vector& endPoint2,
+                                 const double radius) :
+    endPoint1(endPoint1), endPoint2(endPoint2), radius(radius)
+{
+
+}
+
+double CapsuleFitting::Capsule::getLength() const
+{
+    return (endPoint2 - endPoint1).Norm();
+}
+
+double CapsuleFitting::Capsule::getVolume() const
+{
+    return CAPSULE_FITTING_PI*radius*radius*getLength() + 4.0/3.0*CAPSULE_FITTING_PI*radius*radius*radius;
+}
+
+KDL::Frame CapsuleFitting::Capsule::getOrigin() const
+{
+    KDL::Vector z = endPoint2 - endPoint1;
+    if(z.Normalize() < 1E-12)
+        return KDL::Frame(endPoint1);
+
+    KDL::Vector x = (std::fabs(z.x()) < 0.9 ? KDL::Vector(1.0, 0.0, 0.0) : KDL::Vector(0.0, 1.0, 0.0)) * z;
+    x.Normalize();
+    return KDL::Frame(KDL::Rotation(x, z * x, z), (endPoint1 + endPoint2)/2.0);
+}
+
+bool CapsuleFitting::Capsule::contains(const KDL::Vector& point,
+                                       const double tolerance) const
+{
+    return segmentsDistance(endPoint1, endPoint2, point, point) <= radius + tolerance;
+}
+
+bool CapsuleFitting::fitCapsule(const std::vector<KDL::Vector>& points,
+                                CapsuleFitting::Capsule& capsule)
+{
+    if(points.empty())
+        return false;
+
+    // meshes usually repeat every vertex in each of its triangles
+    std::vector<KDL::Vector> unique_points(points);
+    std::sort(unique_points.begin(), unique_points.end(), lessVector);
+    unique_points.erase(std::unique(unique_points.begin(), unique_points.end(), equalVector),
+                        unique_points.end());
+
+    AxisFitting fitting(unique_points);
+
+    // candidate axes: the coordinate axes and a Fibonacci sampling of the hemisphere
+    std::vector<KDL::Vector> axes;
+    axes.push_back(KDL::Vector(1.0, 0.0, 0.0));
+    axes.push_back(KDL::Vector(0.0, 1.0, 0.0));
+    axes.push_back(KDL::Vector(0.0, 0.0, 1.0));
+    const unsigned int samples = 200;
+    const double golden_angle = CAPSULE_FITTING_PI*(3.0 - std::sqrt(5.0));
+    for(unsigned int k = 0; k < samples; ++k)
+    {
+        const double z = (k + 0.5)/samples;
+        const double r = std::sqrt(1.0 - z*z);
+        axes.push_back(KDL::Vector(r*std::cos(k*golden_angle), r*std::sin(k*golden_angle), z));
+    }
+
+    KDL::Vector best_axis;
+    double best_volume = std::numeric_limits<double>::infinity();
+    Capsule candidate;
+    for(unsigned int i = 0; i < axes.size(); ++i)
+    {
+        const double volume = fitting.fit(axes[i], candidate);
+        if(volume < best_volume)
+        {
+            best_volume = volume;
+            best_axis = axes[i];
+            capsule = candidate;
+        }
+    }
+
+    // local refinement of the best axis
+    for(double step = 0.05; step > 1E-4;)
+    {
+        KDL::Vector u = best_axis * (std::fabs(best_axis.x()) < 0.9 ? KDL::Vector(1.0, 0.0, 0.0) : KDL::Vector(0.0, 1.0, 0.0));
+        u.Normalize();
+        KDL::Vector v = best_axis * u;
+        const KDL::Vector directions[4] = { u, -u, v, -v };
+
+        bool improved = false;
+        for(unsigned int i = 0; i < 4; ++i)
+        {
+            KDL::Vector axis = best_axis + step*directions[i];
+            axis.Normalize();
+            const double volume = fitting.fit(axis, candidate);
+            if(volume < best_volume)
+            {
+                best_volume = volume;
+                best_axis = axis;
+                capsule = candidate;
+                improved = true;
+                break;
+            }
+        }
+
+        if(!improved)
+            step /= 2.0;
+    }
+
+    return true;
+}
+
+bool CapsuleFitting::getCollisionPoints(const boost::shared_ptr<const urdf::Link>& link,
+                                        std::vector<KDL::Vector>& points)
+{
+    points.clear();
+    if(!link->collision || !link->collision->geometry)
+        return false;
+
+    const KDL::Frame link_T_shape = poseToKdl(link->collision->origin);
+
+    if(link->collision->geometry->type == urdf::Geometry::BOX)
+    {
+        boost::shared_ptr<urdf::Box> collisionGeometry =
+                boost::dynamic_pointer_cast<urdf::Box>(link->collision->geometry);
+
+        for(unsigned int i = 0; i < 8; ++i)
+            points.push_back(link_T_shape * KDL::Vector((i & 1 ? 0.5 : -0.5)*collisionGeometry->dim.x,
+                                                        (i & 2 ? 0.5 : -0.5)*collisionGeometry->dim.y,
+                                                        (i & 4 ? 0.5 : -0.5)*collisionGeometry->dim.z));
+        return true;
+    }
+    else if(link->collision->geometry->type == urdf::Geometry::MESH)
+    {
+        boost::shared_ptr< ::urdf::Mesh> collisionGeometry =
+                boost::dynamic_pointer_cast< ::urdf::Mesh>(link->collision->geometry);
+
+        shapes::Mesh *mesh = shapes::createMeshFromResource(collisionGeometry->filename);
+        if(mesh == NULL)
+        {
+            std::cout << "Error loading mesh for link " << link->name << std::endl;
+            return false;
+        }
+
+        for(unsigned int i = 0; i < mesh->vertex_count; ++i)
+            points.push_back(link_T_shape * KDL::Vector(mesh->vertices[3*i]*collisionGeometry->scale.x,
+                                                        mesh->vertices[3*i + 1]*collisionGeometry->scale.y,
+                                                        mesh->vertices[3*i + 2]*collisionGeometry->scale.z));
+        delete mesh;
+        return !points.empty();
+    }
+
+    return false;
+}
+
+bool CapsuleFitting::generateCapsuleModel(const std::string& robot_urdf_path,
+                                          const std::string& robot_srdf_path,
+                                          const std::string& capsule_urdf_path,
+                                          const std::string& capsule_srdf_path)
+{
+    boost::shared_ptr<urdf::ModelInterface> robot_urdf = urdf::parseURDFFile(robot_urdf_path);
+    if(!robot_urdf)
+    {
+        std::cout << "Error loading URDF " << robot_urdf_path << std::endl;
+        return false;
+    }
+
+    // capsules of all links, in link frame
+    std::map<std::string, Capsule> capsules;
+    typedef std::map<std::string, boost::shared_ptr<urdf::Link> >::iterator it_type;
+    for(it_type it = robot_urdf->links_.begin(); it != robot_urdf->links_.end(); ++it)
+    {
+        boost::shared_ptr<urdf::Link> link = it->second;
+        if(!link->collision || !link->collision->geometry)
+            continue;
+
+        const KDL::Frame link_T_shape = poseToKdl(link->collision->origin);
+        if(link->collision->geometry->type == urdf::Geometry::CYLINDER)
+        {
+            boost::shared_ptr<urdf::Cylinder> collisionGeometry =
+                    boost::dynamic_pointer_cast<urdf::Cylinder>(link->collision->geometry);
+            const KDL::Vector half_axis = collisionGeometry->length/2.0 * link_T_shape.M.UnitZ();
+            capsules[link->name] = Capsule(link_T_shape.p - half_axis, link_T_shape.p + half_axis,
+                                           collisionGeometry->radius);
+            continue;
+        }
+        else if(link->collision->geometry->type == urdf::Geometry::SPHERE)
+        {
+            boost::shared_ptr<urdf::Sphere> collisionGeometry =
+                    boost::dynamic_pointer_cast<urdf::Sphere>(link->collision->geometry);
+            capsules[link->name] = Capsule(link_T_shape.p, link_T_shape.p, collisionGeometry->radius);
+            continue;
+        }
+
+        std::vector<KDL::Vector> points;
+        Capsule capsule;
+        if(!getCollisionPoints(link, points) || !fitCapsule(points, capsule))
+        {
+            std::cout << "Could not fit a capsule for link " << link->name << std::endl;
+            continue;
+        }
+        capsules[link->name] = capsule;
+
+        std::cout << "fitted capsule for " << link->name << ": radius " << capsule.radius
+                  << ", length " << capsule.getLength() << std::endl;
+
+        boost::shared_ptr<urdf::Collision> collision(link->collision);
+        if(capsule.getLength() < 1E-9)
+        {
+            boost::shared_ptr<urdf::Sphere> sphere(new urdf::Sphere());
+            sphere->radius = capsule.radius;
+            collision->geometry = sphere;
+        }
+        else
+        {
+            boost::shared_ptr<urdf::Cylinder> cylinder(new urdf::Cylinder());
+            cylinder->radius = capsule.radius;
+            cylinder->length = capsule.getLength();
+            collision->geometry = cylinder;
+        }
+        collision->origin = kdlToPose(capsule.getOrigin());
+
+        // ComputeLinksDistance only uses the first collision geometry
+        link->collision_array.clear();
+        link->collision_array.push_back(collision);
+    }
+
+    TiXmlDocument* capsule_urdf = urdf::exportURDF(robot_urdf);
+    if(capsule_urdf == NULL || !capsule_urdf->SaveFile(capsule_urdf_path.c_str()))
+    {
+        std::cout << "Error writing capsule URDF " << capsule_urdf_path << std::endl;
+        delete capsule_urdf;
+        return false;
+    }
+    delete capsule_urdf;
+
+    TiXmlDocument capsule_srdf(robot_srdf_path.c_str());
+    TiXmlElement* robot_srdf = NULL;
+    if(capsule_srdf.LoadFile())
+        robot_srdf = capsule_srdf.FirstChildElement("robot");
+    if(robot_srdf == NULL)
+    {
+        std::cout << "Error loading SRDF " << robot_srdf_path << std::endl;
+        return false;
+    }
+
+    std::set< std::pair<std::string, std::string> > disabled_collisions;
+    for(TiXmlElement* disabled = robot_srdf->FirstChildElement("disable_collisions");
+        disabled != NULL; disabled = disabled->NextSiblingElement("disable_collisions"))
+    {
+        const char* link1 = disabled->Attribute("link1");
+        const char* link2 = disabled->Attribute("link2");
+        if(link1 == NULL || link2 == NULL)
+            continue;
+        disabled_collisions.insert(std::make_pair(std::string(link1), std::string(link2)));
+        disabled_collisions.insert(std::make_pair(std::string(link2), std::string(link1)));
+    }
+
+    // capsules are fatter than the original geometries, pairs which intersect in the
+    // zero configuration must be disabled like moveit_setup_assistant does
+    std::map<std::string, KDL::Frame> w_T_links;
+    computeZeroConfigurationPoses(*robot_urdf, robot_urdf->getRoot(), KDL::Frame::Identity(), w_T_links);
+
+    unsigned int default_collisions = 0;
+    typedef std::map<std::string, Capsule>::iterator capsules_it_type;
+    for(capsules_it_type itA = capsules.begin(); itA != capsules.end(); ++itA)
+    {
+        capsules_it_type itB = itA;
+        for(++itB; itB != capsules.end(); ++itB)
+        {
+            if(disabled_collisions.count(std::make_pair(itA->first, itB->first)) > 0 ||
+               w_T_links.count(itA->first) == 0 || w_T_links.count(itB->first) == 0)
+                continue;
+
+            const KDL::Frame& w_T_linkA = w_T_links[itA->first];
+            const KDL::Frame& w_T_linkB = w_T_links[itB->first];
+            const Capsule& capsuleA = itA->second;
+            const Capsule& capsuleB = itB->second;
+            if(segmentsDistance(w_T_linkA * capsuleA.endPoint1, w_T_linkA * capsuleA.endPoint2,
+                                w_T_linkB * capsuleB.endPoint1, w_T_linkB * capsuleB.endPoint2) <
+               capsuleA.radius + capsuleB.radius)
+            {
+                TiXmlElement disabled("disable_collisions");
+                disabled.SetAttribute("link1", itA->first.c_str());
+                disabled.SetAttribute("link2", itB->first.c_str());
+                disabled.SetAttribute("reason", "Default");
+                robot_srdf->InsertEndChild(disabled);
+                ++default_collisions;
+            }
+        }
+    }
+    std::cout << "Disabled " << default_collisions
+              << " capsule pairs colliding in the zero configuration" << std::endl;
+
+    if(!capsule_srdf.SaveFile(capsule_srdf_path.c_str()))
+    {
+        std::cout << "Error writing capsule SRDF " << capsule_srdf_path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool CapsuleFitting::generateCapsuleModel(const std::string& robot_urdf_path,
+                                          const std::string& robot_srdf_path)
+{
+    return generateCapsuleModel(robot_urdf_path, robot_srdf_path,
+                                getCapsuleModelPath(robot_urdf_path),
+                                getCapsuleModelPath(robot_srdf_path));
+}
+
+std::string CapsuleFitting::getCapsuleModelPath(const std::string& robot_model_path)
+{
+    boost::filesystem::path original_model(robot_model_path);
+    std::string capsule_model_filename = std::string(original_model.stem().c_str()) +
+                                         std::string("_capsules") +
+                                         std::string(original_model.extension().c_str());
+    return (original_model.parent_path() / capsule_model_filename).string();
+}
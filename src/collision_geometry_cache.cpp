@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <boost/filesystem.hpp>
+#include <idynutils/collision_geometry_cache.h>
+#include <resource_retriever/retriever.h>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char CACHE_MAGIC[8] = { 'I', 'D', 'U', 'G', 'E', 'O', 'M', '\0' };
+
+/**
+ * @brief The CacheHeader struct is at the beginning of the cache file
+ */
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t number_of_records;
+    uint64_t key;
+};
+
+/**
+ * @brief The CacheRecord struct precedes the data of each mesh, which is the link name padded to 8 bytes,
+ *        3*number_of_vertices doubles and 3*number_of_triangles uint32_t padded to 8 bytes
+ */
+struct CacheRecord
+{
+    uint32_t name_length;
+    uint32_t number_of_vertices;
+    uint32_t number_of_triangles;
+    uint32_t reserved;
+    // position and quaternion (x, y, z, w)
+    double link_T_shape[7];
+};
+
+size_t padded(const size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+/**
+ * @brief fnv1a updates a 64 bit FNV-1a hash
+ */
+uint64_t fnv1a(uint64_t hash, const unsigned char* data, const size_t size)
+{
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t fnv1a(const uint64_t hash, const std::string& data)
+{
+    return fnv1a(hash, reinterpret_cast<const unsigned char*>(data.c_str()), data.size());
+}
+
+}
+
+CollisionGeometryCache::CollisionGeometryCache() :
+    mapped_data(NULL),
+    mapped_size(0),
+    number_of_records(0)
+{
+
+}
+
+CollisionGeometryCache::~CollisionGeometryCache()
+{
+    unload();
+}
+
+void CollisionGeometryCache::unload()
+{
+    meshes.clear();
+    if(mapped_data != NULL)
+        munmap(mapped_data, mapped_size);
+    mapped_data = NULL;
+    mapped_size = 0;
+}
+
+uint64_t CollisionGeometryCache::computeKey(const std::string& robot_urdf_path,
+                                            const urdf::Model& robot_urdf)
+{
+    uint64_t key = 14695981039346656037ull;
+
+    std::ifstream urdf_file(robot_urdf_path.c_str(), std::ios::binary);
+    std::string urdf_content((std::istreambuf_iterator<char>(urdf_file)),
+                             std::istreambuf_iterator<char>());
+    key = fnv1a(key, urdf_content);
+
+    // links are sorted by name
+    resource_retriever::Retriever retriever;
+    typedef std::map<std::string, boost::shared_ptr<urdf::Link> >::const_iterator it_type;
+    for(it_type it = robot_urdf.links_.begin(); it != robot_urdf.links_.end(); ++it)
+    {
+        const boost::shared_ptr<urdf::Link>& link = it->second;
+        if(!link->collision || !link->collision->geometry ||
+           link->collision->geometry->type != urdf::Geometry::MESH)
+            continue;
+
+        boost::shared_ptr< ::urdf::Mesh> collisionGeometry =
+                boost::dynamic_pointer_cast< ::urdf::Mesh>(link->collision->geometry);
+        key = fnv1a(key, collisionGeometry->filename);
+        try
+        {
+            resource_retriever::MemoryResource resource = retriever.get(collisionGeometry->filename);
+            key = fnv1a(key, resource.data.get(), resource.size);
+        }
+        catch(const resource_retriever::Exception&)
+        {
+            // the mesh cannot be loaded anyway, the link will not be in the cache
+        }
+    }
+
+    return key;
+}
+
+std::string CollisionGeometryCache::getCachePath(const std::string& robot_urdf_path)
+{
+    boost::filesystem::path urdf_path(robot_urdf_path);
+    std::string cache_filename = std::string(urdf_path.stem().c_str()) + std::string("_collision_geometry.cache");
+    return (urdf_path.parent_path() / cache_filename).string();
+}
+
+bool CollisionGeometryCache::load(const std::string& path, const uint64_t key)
+{
+    unload();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(CacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    mapped_size = file_stat.st_size;
+    mapped_data = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped_data == MAP_FAILED)
+    {
+        mapped_data = NULL;
+        mapped_size = 0;
+        return false;
+    }
+
+    const char* data = static_cast<const char*>(mapped_data);
+    const CacheHeader* header = reinterpret_cast<const CacheHeader*>(data);
+    if(std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+       header->version != CACHE_VERSION || header->key != key)
+    {
+        unload();
+        return false;
+    }
+
+    size_t offset = sizeof(CacheHeader);
+    for(uint32_t i = 0; i < header->number_of_records; ++i)
+    {
+        if(offset + sizeof(CacheRecord) > mapped_size)
+        {
+            unload();
+            return false;
+        }
+        const CacheRecord* record = reinterpret_cast<const CacheRecord*>(data + offset);
+        offset += sizeof(CacheRecord);
+
+        const size_t name_size = padded(record->name_length);
+        const size_t vertices_size = 3*sizeof(double)*record->number_of_vertices;
+        const size_t triangles_size = padded(3*sizeof(uint32_t)*record->number_of_triangles);
+        if(offset + name_size + vertices_size + triangles_size > mapped_size)
+        {
+            unload();
+            return false;
+        }
+
+        Mesh mesh;
+        const double* p = record->link_T_shape;
+        mesh.link_T_shape = KDL::Frame(KDL::Rotation::Quaternion(p[3], p[4], p[5], p[6]),
+                                       KDL::Vector(p[0], p[1], p[2]));
+        std::string name(data + offset, record->name_length);
+        offset += name_size;
+        mesh.vertices = reinterpret_cast<const double*>(data + offset);
+        mesh.numberOfVertices = record->number_of_vertices;
+        offset += vertices_size;
+        mesh.triangles = reinterpret_cast<const uint32_t*>(data + offset);
+        mesh.numberOfTriangles = record->number_of_triangles;
+        offset += triangles_size;
+
+        for(uint32_t t = 0; t < 3*mesh.numberOfTriangles; ++t)
+        {
+            if(mesh.triangles[t] >= mesh.numberOfVertices)
+            {
+                unload();
+                return false;
+            }
+        }
+
+        meshes[name] = mesh;
+    }
+
+    return true;
+}
+
+bool CollisionGeometryCache::getMesh(const std::string& linkName,
+                                     CollisionGeometryCache::Mesh& mesh) const
+{
+    std::map<std::string, Mesh>::const_iterator it = meshes.find(linkName);
+    if(it == meshes.end())
+        return false;
+
+    mesh = it->second;
+    return true;
+}
+
+void CollisionGeometryCache::addMesh(const std::string& linkName,
+                                     const KDL::Frame& link_T_shape,
+                                     const std::vector<fcl::Vec3f>& vertices,
+                                     const std::vector<fcl::Triangle>& triangles)
+{
+    CacheRecord record;
+    record.name_length = linkName.size();
+    record.number_of_vertices = vertices.size();
+    record.number_of_triangles = triangles.size();
+    record.reserved = 0;
+    record.link_T_shape[0] = link_T_shape.p.x();
+    record.link_T_shape[1] = link_T_shape.p.y();
+    record.link_T_shape[2] = link_T_shape.p.z();
+    link_T_shape.M.GetQuaternion(record.link_T_shape[3], record.link_T_shape[4],
+                                 record.link_T_shape[5], record.link_T_shape[6]);
+
+    const size_t name_size = padded(record.name_length);
+    const size_t vertices_size = 3*sizeof(double)*record.number_of_vertices;
+    const size_t triangles_size = padded(3*sizeof(uint32_t)*record.number_of_triangles);
+
+    size_t offset = records.size();
+    records.resize(offset + sizeof(CacheRecord) + name_size + vertices_size + triangles_size, 0);
+    std::memcpy(&records[offset], &record, sizeof(CacheRecord));
+    offset += sizeof(CacheRecord);
+    std::memcpy(&records[offset], linkName.c_str(), record.name_length);
+    offset += name_size;
+
+    double* vertices_data = reinterpret_cast<double*>(&records[offset]);
+    for(unsigned int i = 0; i < vertices.size(); ++i)
+        for(unsigned int j = 0; j < 3; ++j)
+            vertices_data[3*i + j] = vertices[i][j];
+    offset += vertices_size;
+
+    uint32_t* triangles_data = reinterpret_cast<uint32_t*>(&records[offset]);
+    for(unsigned int i = 0; i < triangles.size(); ++i)
+        for(unsigned int j = 0; j < 3; ++j)
+            triangles_data[3*i + j] = triangles[i][j];
+
+    ++number_of_records;
+}
+
+unsigned int CollisionGeometryCache::getNrOfAddedMeshes() const
+{
+    return number_of_records;
+}
+
+bool CollisionGeometryCache::save(const std::string& path, const uint64_t key) const
+{
+    CacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.number_of_records = number_of_records;
+    header.key = key;
+
+    // the cache is written in a temporary file and then renamed, so that a process loading it never sees it partial
+    std::string temporary_path = path + ".tmp";
+    {
+        std::ofstream file(temporary_path.c_str(), std::ios::binary | std::ios::trunc);
+        if(!file)
+            return false;
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+        if(!records.empty())
+            file.write(&records[0], records.size());
+        if(!file.good())
+            return false;
+    }
+
+    return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+}
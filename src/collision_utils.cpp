@@ -1,5 +1,9 @@
 #include <boost/filesystem.hpp>
+#include <idynutils/capsule_fitting.h>
+#include <idynutils/collision_geometry_cache.h>
 #include <idynutils/collision_utils.h>
+#include <idynutils/convex_hull.h>
+#include <idynutils/incremental_kinematics.h>
 #include <kdl_parser/kdl_parser.hpp>
 #include <fcl/config.h>
 #include <fcl/BV/OBBRSS.h>
@@ -8,6 +12,12 @@
 #include <fcl/shape/geometric_shapes.h>
 #include <geometric_shapes/shapes.h>
 #include <geometric_shapes/shape_operations.h>
+#include <yarp/os/Semaphore.h>
+#include <yarp/os/SystemClock.h>
+#include <yarp/os/Thread.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
 
 // construct vector
 KDL::Vector toKdl(urdf::Vector3 v)
@@ -27,16 +37,106 @@ KDL::Frame toKdl(urdf::Pose p)
   return KDL::Frame(toKdl(p.rotation), toKdl(p.position));
 }
 
+namespace {
+
+/**
+ * @brief getCapsuleEndPoints computes the endpoints of the axis of a capsule collision object in world frame.
+ *        As in fcl, the capsule is centered in its shape frame, with z-axis aligned with the capsule axis
+ */
+void getCapsuleEndPoints(const fcl::CollisionObject* capsule_object,
+                         KDL::Vector& endPoint1, KDL::Vector& endPoint2)
+{
+    const fcl::Transform3f& w_T_shape = capsule_object->getTransform();
+    const fcl::Capsule* capsule = static_cast<const fcl::Capsule*>(capsule_object->getCollisionGeometry());
+    fcl::Vec3f ep1 = w_T_shape.transform(fcl::Vec3f(0.0, 0.0, -0.5*capsule->lz));
+    fcl::Vec3f ep2 = w_T_shape.transform(fcl::Vec3f(0.0, 0.0, 0.5*capsule->lz));
+    endPoint1 = KDL::Vector(ep1[0], ep1[1], ep1[2]);
+    endPoint2 = KDL::Vector(ep2[0], ep2[1], ep2[2]);
+}
+
+/**
+ * @brief createMeshBVH creates the BVH of a mesh
+ */
+boost::shared_ptr<fcl::CollisionGeometry> createMeshBVH(const std::vector<fcl::Vec3f>& vertices,
+                                                        const std::vector<fcl::Triangle>& triangles)
+{
+    fcl::BVHModel<fcl::OBBRSS>* bvhModel = new fcl::BVHModel<fcl::OBBRSS>;
+    bvhModel->beginModel();
+    bvhModel->addSubModel(vertices, triangles);
+    bvhModel->endModel();
+    return boost::shared_ptr<fcl::CollisionGeometry>(bvhModel);
+}
+
+/**
+ * @brief The ConvexHullData class owns the arrays of a fcl::Convex, which only keeps pointers to them
+ */
+class ConvexHullData
+{
+protected:
+    std::vector<fcl::Vec3f> plane_normals;
+    std::vector<fcl::FCL_REAL> plane_distances;
+    std::vector<fcl::Vec3f> points;
+    std::vector<int> polygons;
+
+    ConvexHullData(const std::vector<KDL::Vector>& vertices,
+                   const std::vector<unsigned int>& triangles)
+    {
+        for(unsigned int i = 0; i < vertices.size(); ++i)
+            points.push_back(fcl::Vec3f(vertices[i].x(), vertices[i].y(), vertices[i].z()));
+
+        for(unsigned int i = 0; i + 2 < triangles.size(); i += 3)
+        {
+            fcl::Vec3f normal = (points[triangles[i+1]] - points[triangles[i]]).cross(
+                                 points[triangles[i+2]] - points[triangles[i]]);
+            normal.normalize();
+            plane_normals.push_back(normal);
+            plane_distances.push_back(normal.dot(points[triangles[i]]));
+            polygons.push_back(3);
+            polygons.push_back(triangles[i]);
+            polygons.push_back(triangles[i+1]);
+            polygons.push_back(triangles[i+2]);
+        }
+    }
+};
+
+/**
+ * @brief The ConvexHullShape class is a fcl::Convex which owns its vertices and faces
+ */
+class ConvexHullShape : private ConvexHullData, public fcl::Convex
+{
+public:
+    ConvexHullShape(const std::vector<KDL::Vector>& vertices,
+                    const std::vector<unsigned int>& triangles) :
+        ConvexHullData(vertices, triangles),
+        fcl::Convex(&plane_normals[0], &plane_distances[0], plane_normals.size(),
+                    &points[0], points.size(), &polygons[0])
+    {
+
+    }
+};
+
+}
+
 bool ComputeLinksDistance::globalToLinkCoordinates(const std::string& linkName,
                                                    const fcl::Transform3f &fcl_w_T_f,
                                                    KDL::Frame &link_T_f)
 {
+    if(link_ids.count(linkName) == 0)
+        return false;
+
+    return globalToLinkCoordinates(link_ids[linkName], fcl_w_T_f, link_T_f);
+}
+
+bool ComputeLinksDistance::globalToLinkCoordinates(const unsigned int link,
+                                                   const fcl::Transform3f &fcl_w_T_f,
+                                                   KDL::Frame &link_T_f)
+{
 
-    fcl::Transform3f fcl_w_T_shape = collision_objects_[linkName]->getTransform();
+    const fcl::Transform3f& fcl_w_T_shape = link_collision_objects[link]->getTransform();
 
     fcl::Transform3f fcl_shape_T_f = fcl_w_T_shape.inverseTimes(fcl_w_T_f);
 
-    link_T_f = link_T_shape[linkName] * fcl2KDL(fcl_shape_T_f);
+    link_T_f = link_T_shapes[link] * fcl2KDL(fcl_shape_T_f);
 
     return true;
 }
@@ -45,20 +145,30 @@ bool ComputeLinksDistance::shapeToLinkCoordinates(const std::string& linkName,
                                                   const fcl::Transform3f &fcl_shape_T_f,
                                                   KDL::Frame &link_T_f)
 {
+    if(link_ids.count(linkName) == 0)
+        return false;
 
-    link_T_f = link_T_shape[linkName] * fcl2KDL(fcl_shape_T_f);
-
-    return true;
+    return shapeToLinkCoordinates(link_ids[linkName], fcl_shape_T_f, link_T_f);
 }
 
-bool ComputeLinksDistance::parseCollisionObjects(const std::string &robot_urdf_path,
-                                                 const std::string &robot_srdf_path)
+bool ComputeLinksDistance::shapeToLinkCoordinates(const unsigned int link,
+                                                  const fcl::Transform3f &fcl_shape_T_f,
+                                                  KDL::Frame &link_T_f)
 {
-    urdf::Model robot_urdf;
 
-    robot_urdf.initFile(robot_urdf_path);
-    robot_srdf.initFile(robot_urdf, robot_srdf_path);
+    link_T_f = link_T_shapes[link] * fcl2KDL(fcl_shape_T_f);
 
+    return true;
+}
+
+bool ComputeLinksDistance::parseCollisionObjects(const urdf::Model& robot_urdf,
+                                                 const std::string& robot_urdf_path)
+{
+    // meshes are loaded from the binary geometry cache when the URDF and the meshes did not change
+    CollisionGeometryCache geometry_cache;
+    const std::string geometry_cache_path = CollisionGeometryCache::getCachePath(robot_urdf_path);
+    const uint64_t geometry_cache_key = CollisionGeometryCache::computeKey(robot_urdf_path, robot_urdf);
+    const bool geometry_cache_loaded = geometry_cache.load(geometry_cache_path, geometry_cache_key);
 
     std::vector<boost::shared_ptr<urdf::Link> > links;
     robot_urdf.getLinks(links);
@@ -77,6 +187,7 @@ bool ComputeLinksDistance::parseCollisionObjects(const std::string &robot_urdf_p
 
                 boost::shared_ptr<fcl::CollisionGeometry> shape;
                 KDL::Frame shape_origin;
+                int capsule_index = -1;
 
                 if (link->collision->geometry->type == urdf::Geometry::CYLINDER) {
                     std::cout << "adding capsule for " << link->name << std::endl;
@@ -88,14 +199,18 @@ bool ComputeLinksDistance::parseCollisionObjects(const std::string &robot_urdf_p
                     shape.reset(new fcl::Capsule(collisionGeometry->radius,
                                                  collisionGeometry->length));
 
+                    // fcl capsules are centered in their frame, as urdf cylinders,
+                    // custom capsules have the frame on an endpoint
                     shape_origin = toKdl(link->collision->origin);
-                    shape_origin.p -= collisionGeometry->length/2.0 * shape_origin.M.UnitZ();
+                    KDL::Frame capsule_origin = shape_origin;
+                    capsule_origin.p -= collisionGeometry->length/2.0 * capsule_origin.M.UnitZ();
 
                     custom_capsules_[link->name] =
                         boost::shared_ptr<ComputeLinksDistance::Capsule>(
-                            new ComputeLinksDistance::Capsule(shape_origin,
+                            new ComputeLinksDistance::Capsule(capsule_origin,
                                                               collisionGeometry->radius,
                                                               collisionGeometry->length));
+                    capsule_index = capsule_batch.addCapsule(collisionGeometry->radius);
                 } else if (link->collision->geometry->type == urdf::Geometry::SPHERE) {
                     std::cout << "adding sphere for " << link->name << std::endl;
 
@@ -123,41 +238,67 @@ bool ComputeLinksDistance::parseCollisionObjects(const std::string &robot_urdf_p
                 else if(link->collision->geometry->type == urdf::Geometry::MESH){
                     std::cout << "adding mesh for " << link->name << std::endl;
 
-                    boost::shared_ptr< ::urdf::Mesh> collisionGeometry = boost::dynamic_pointer_cast< ::urdf::Mesh> (link->collision->geometry);
-
-                    shapes::Mesh *mesh = shapes::createMeshFromResource(collisionGeometry->filename);
-                    if(mesh == NULL)
-                    {
-                        std::cout << "Error loading mesh for link " << link->name << std::endl;
-                        continue;
-                    }
-
                     std::vector<fcl::Vec3f> vertices;
                     std::vector<fcl::Triangle> triangles;
 
-                    for(unsigned int i=0; i < mesh->vertex_count; ++i){
-                        fcl::Vec3f v(mesh->vertices[3*i]*collisionGeometry->scale.x,
-                                     mesh->vertices[3*i + 1]*collisionGeometry->scale.y,
-                                     mesh->vertices[3*i + 2]*collisionGeometry->scale.z);
-
-                        vertices.push_back(v);
+                    CollisionGeometryCache::Mesh cached_mesh;
+                    if(geometry_cache_loaded && geometry_cache.getMesh(link->name, cached_mesh))
+                    {
+                        vertices.reserve(cached_mesh.numberOfVertices);
+                        for(unsigned int i = 0; i < cached_mesh.numberOfVertices; ++i)
+                            vertices.push_back(fcl::Vec3f(cached_mesh.vertices[3*i],
+                                                          cached_mesh.vertices[3*i + 1],
+                                                          cached_mesh.vertices[3*i + 2]));
+
+                        triangles.reserve(cached_mesh.numberOfTriangles);
+                        for(unsigned int i = 0; i < cached_mesh.numberOfTriangles; ++i)
+                            triangles.push_back(fcl::Triangle(cached_mesh.triangles[3*i],
+                                                              cached_mesh.triangles[3*i + 1],
+                                                              cached_mesh.triangles[3*i + 2]));
+
+                        shape_origin = cached_mesh.link_T_shape;
                     }
-
-                    for(unsigned int i=0; i< mesh->triangle_count; ++i){
-                        fcl::Triangle t(mesh->triangles[3*i],
-                                        mesh->triangles[3*i + 1],
-                                        mesh->triangles[3*i + 2]);
-                        triangles.push_back(t);
+                    else
+                    {
+                        boost::shared_ptr< ::urdf::Mesh> collisionGeometry = boost::dynamic_pointer_cast< ::urdf::Mesh> (link->collision->geometry);
+
+                        shapes::Mesh *mesh = shapes::createMeshFromResource(collisionGeometry->filename);
+                        if(mesh == NULL)
+                        {
+                            std::cout << "Error loading mesh for link " << link->name << std::endl;
+                            continue;
+                        }
+
+                        for(unsigned int i=0; i < mesh->vertex_count; ++i){
+                            fcl::Vec3f v(mesh->vertices[3*i]*collisionGeometry->scale.x,
+                                         mesh->vertices[3*i + 1]*collisionGeometry->scale.y,
+                                         mesh->vertices[3*i + 2]*collisionGeometry->scale.z);
+
+                            vertices.push_back(v);
+                        }
+
+                        for(unsigned int i=0; i< mesh->triangle_count; ++i){
+                            fcl::Triangle t(mesh->triangles[3*i],
+                                            mesh->triangles[3*i + 1],
+                                            mesh->triangles[3*i + 2]);
+                            triangles.push_back(t);
+                        }
+                        delete mesh;
+
+                        shape_origin = toKdl(link->collision->origin);
+                        geometry_cache.addMesh(link->name, shape_origin, vertices, triangles);
                     }
 
-                    // add the mesh data into the BVHModel structure
-                    shape.reset(new fcl::BVHModel<fcl::OBBRSS>);
-                    fcl::BVHModel<fcl::OBBRSS>* bvhModel = (fcl::BVHModel<fcl::OBBRSS>*)shape.get();
-                    bvhModel->beginModel();
-                    bvhModel->addSubModel(vertices, triangles);
-                    bvhModel->endModel();
+                    if(convex_hulls)
+                    {
+                        std::cout << "replacing mesh with its convex hull for " << link->name << std::endl;
+                        shape = generateConvexHull(link->name, robot_urdf_path, geometry_cache_key,
+                                                   vertices, triangles);
+                    }
 
-                    shape_origin = toKdl(link->collision->origin);
+                    // add the mesh data into the BVHModel structure, unless it has been replaced by its hull
+                    if(!shape)
+                        shape = createMeshBVH(vertices, triangles);
                 }
 
                 boost::shared_ptr<fcl::CollisionObject> collision_object(
@@ -169,6 +310,13 @@ bool ComputeLinksDistance::parseCollisionObjects(const std::string &robot_urdf_p
                 /* Store the transformation of the CollisionShape from URDF
                  * that is, we store link_T_shape for the actual link */
                 link_T_shape[link->name] = shape_origin;
+
+                link_ids[link->name] = link_names.size();
+                link_names.push_back(link->name);
+                link_collision_objects.push_back(collision_object.get());
+                link_T_shapes.push_back(shape_origin);
+                link_model_indices.push_back(model.iDyn3_model.getLinkIndex(link->name));
+                link_capsule_indices.push_back(capsule_index);
             } else {
                 std::cout << "Collision type unknown for link " << link->name << std::endl;
             }
@@ -176,32 +324,53 @@ bool ComputeLinksDistance::parseCollisionObjects(const std::string &robot_urdf_p
             std::cout << "Collision not defined for link " << link->name << std::endl;
         }
     }
+
+    if(!geometry_cache_loaded && geometry_cache.getNrOfAddedMeshes() > 0)
+    {
+        if(geometry_cache.save(geometry_cache_path, geometry_cache_key))
+            std::cout << "Collision geometry cached in " << geometry_cache_path << std::endl;
+        else
+            std::cout << "Could not write the collision geometry cache " << geometry_cache_path << std::endl;
+    }
+
+    shape_reach.resize(link_names.size());
+    for(unsigned int i = 0; i < link_names.size(); ++i)
+        shape_reach[i] = getShapeReach(i);
+    broad_phase_min.resize(link_names.size());
+    broad_phase_max.resize(link_names.size());
+    broad_phase_overlaps.assign(link_names.size()*link_names.size(), false);
+
     return true;
 }
 
 bool ComputeLinksDistance::updateCollisionObjects()
 {
-    typedef std::set<std::string>::iterator it_links;
-    typedef std::map<std::string,boost::shared_ptr<fcl::CollisionObject> >::iterator it_co;
-
-//    for(it_type it = collision_objects_.begin();
-//        it != collision_objects_.end(); ++it)
-    for(it_links it = linksToUpdate.begin();
-        it != linksToUpdate.end(); ++it)
+    for(unsigned int i = 0; i < linksToUpdate.size(); ++i)
     {
-//        std::string link_name = it->first;
-        std::string link_name = *it;
+        const unsigned int link = linksToUpdate[i];
         KDL::Frame w_T_link, w_T_shape;
-        w_T_link = model.iDyn3_model.getPositionKDL(model.iDyn3_model.getLinkIndex(link_name));
-        w_T_shape = w_T_link * link_T_shape[link_name];
+        w_T_link = model.iDyn3_model.getPositionKDL(link_model_indices[link]);
+        w_T_shape = w_T_link * link_T_shapes[link];
 
         fcl::Transform3f fcl_w_T_shape = KDL2fcl(w_T_shape);
-        fcl::CollisionObject* collObj_shape = collision_objects_[link_name].get();
-        collObj_shape->setTransform(fcl_w_T_shape);
+        link_collision_objects[link]->setTransform(fcl_w_T_shape);
     }
     return true;
 }
 
+bool ComputeLinksDistance::updateCollisionObjects(const IncrementalForwardKinematics& fk)
+{
+    for(unsigned int i = 0; i < linksToUpdate.size(); ++i)
+    {
+        const unsigned int link = linksToUpdate[i];
+        KDL::Frame w_T_link, w_T_shape;
+        w_T_link = fk.getPositionKDL(link_model_indices[link]);
+        w_T_shape = w_T_link * link_T_shapes[link];
+
+        link_collision_objects[link]->setTransform(KDL2fcl(w_T_shape));
+    }
+    return true;
+}
 
 fcl::Transform3f ComputeLinksDistance::KDL2fcl(const KDL::Frame &in){
     fcl::Transform3f out;
@@ -228,153 +397,1376 @@ KDL::Frame ComputeLinksDistance::fcl2KDL(const fcl::Transform3f &in)
 
 void ComputeLinksDistance::generateLinksToUpdate()
 {
+    std::vector<bool> is_link_to_update(link_names.size(), false);
+    for(unsigned int i = 0; i < pairsToCheck.size(); ++i)
+    {
+        is_link_to_update[pairsToCheck[i].linkA] = true;
+        is_link_to_update[pairsToCheck[i].linkB] = true;
+    }
+
     linksToUpdate.clear();
-    std::vector<std::string> collisionEntries;
-    // TODO isn't the result of
-    // model.moveit_robot_model->getLinkModelNamesWithCollisionGeometry()
-    // exactly what we are looking for?
-    allowed_collision_matrix->getAllEntryNames(collisionEntries);
-    typedef std::vector<std::string>::iterator iter_link;
-    typedef std::list<std::pair<std::string,std::string> >::iterator iter_pair;
+    for(unsigned int link = 0; link < link_names.size(); ++link)
+        if(is_link_to_update[link])
+            linksToUpdate.push_back(link);
+
+    broad_phase_order = linksToUpdate;
+}
+
+void ComputeLinksDistance::updateBroadPhase(const double detectionThreshold)
+{
+    const unsigned int n = link_names.size();
+    const double inflation = 0.5*detectionThreshold;
+    const KDL::Vector delta(inflation, inflation, inflation);
+    broad_phase_inflation = inflation;
+
+    for(unsigned int k = 0; k < linksToUpdate.size(); ++k)
+    {
+        const unsigned int i = linksToUpdate[k];
+        // the bounds come from the same fcl objects, with the same shape frames, used by the narrow phase
+        // (the capsule batch and the analytic kernels derive the capsule axes from them as well)
+        fcl::CollisionObject* collObj_shape = link_collision_objects[i];
+        collObj_shape->computeAABB();
+        const fcl::AABB& aabb = collObj_shape->getAABB();
+        broad_phase_min[i] = KDL::Vector(aabb.min_[0], aabb.min_[1], aabb.min_[2]);
+        broad_phase_max[i] = KDL::Vector(aabb.max_[0], aabb.max_[1], aabb.max_[2]);
+        broad_phase_min[i] -= delta;
+        broad_phase_max[i] += delta;
+    }
 
-    for(iter_link it_A = collisionEntries.begin();
-        it_A != collisionEntries.end();
-        ++it_A)
+    // insertion sort: the order of the previous call is almost sorted
+    for(unsigned int i = 1; i < broad_phase_order.size(); ++i)
     {
-        for(iter_link it_B = collisionEntries.begin();
-            it_B != collisionEntries.end();
-            ++it_B)
+        unsigned int index = broad_phase_order[i];
+        double x = broad_phase_min[index].x();
+        int j = i - 1;
+        while(j >= 0 && broad_phase_min[broad_phase_order[j]].x() > x)
         {
-            if(it_B <= it_A)
-                continue;
-            else
+            broad_phase_order[j+1] = broad_phase_order[j];
+            --j;
+        }
+        broad_phase_order[j+1] = index;
+    }
+
+    std::fill(broad_phase_overlaps.begin(), broad_phase_overlaps.end(), false);
+    for(unsigned int i = 0; i < broad_phase_order.size(); ++i)
+    {
+        const unsigned int a = broad_phase_order[i];
+        for(unsigned int j = i + 1; j < broad_phase_order.size(); ++j)
+        {
+            const unsigned int b = broad_phase_order[j];
+            if(broad_phase_min[b].x() > broad_phase_max[a].x())
+                break;
+
+            if(broad_phase_min[b].y() <= broad_phase_max[a].y() &&
+               broad_phase_min[a].y() <= broad_phase_max[b].y() &&
+               broad_phase_min[b].z() <= broad_phase_max[a].z() &&
+               broad_phase_min[a].z() <= broad_phase_max[b].z())
             {
-                collision_detection::AllowedCollision::Type collisionType;
-                if(allowed_collision_matrix->getAllowedCollision(*it_A,*it_B,collisionType) &&
-                   collisionType == collision_detection::AllowedCollision::NEVER)
-                {
-                    linksToUpdate.insert(*it_A);
-                    linksToUpdate.insert(*it_B);
-                }
+                broad_phase_overlaps[a*n + b] = true;
+                broad_phase_overlaps[b*n + a] = true;
             }
         }
     }
 }
 
+void ComputeLinksDistance::updateCapsuleBatch()
+{
+    for(unsigned int i = 0; i < linksToUpdate.size(); ++i)
+    {
+        const unsigned int link = linksToUpdate[i];
+        if(link_capsule_indices[link] < 0)
+            continue;
+
+        KDL::Vector ep1, ep2;
+        getCapsuleEndPoints(link_collision_objects[link], ep1, ep2);
+        capsule_batch.setEndPoints(link_capsule_indices[link], ep1, ep2);
+    }
+}
+
 void ComputeLinksDistance::generatePairsToCheck()
 {
     pairsToCheck.clear();
+    capsule_batch.clearPairs();
+    closest_pairs_bounds.clear();
+
+    // only links with collision objects are scanned, ACM entries without them would be discarded anyway.
+    // Link IDs follow the name order of the ACM entries, so pairs are generated in the same order
     std::vector<std::string> collisionEntries;
     allowed_collision_matrix->getAllEntryNames(collisionEntries);
-    typedef std::vector<std::string>::iterator iter_link;
-    typedef std::list<std::pair<std::string,std::string> >::iterator iter_pair;
+    std::vector<unsigned int> links;
+    for(unsigned int i = 0; i < collisionEntries.size(); ++i)
+        if(link_ids.count(collisionEntries[i]) > 0)
+            links.push_back(link_ids[collisionEntries[i]]);
 
-    for(iter_link it_A = collisionEntries.begin();
-        it_A != collisionEntries.end();
-        ++it_A)
+    for(unsigned int a = 0; a < links.size(); ++a)
     {
-        for(iter_link it_B = collisionEntries.begin();
-            it_B != collisionEntries.end();
-            ++it_B)
+        const unsigned int linkA = links[a];
+        for(unsigned int b = a + 1; b < links.size(); ++b)
         {
-            if(it_B <= it_A)
-                continue;
-            else
+            const unsigned int linkB = links[b];
+            collision_detection::AllowedCollision::Type collisionType;
+            if(allowed_collision_matrix->getAllowedCollision(link_names[linkA], link_names[linkB], collisionType) &&
+               collisionType == collision_detection::AllowedCollision::NEVER)
             {
-                collision_detection::AllowedCollision::Type collisionType;
-                if(allowed_collision_matrix->getAllowedCollision(*it_A,*it_B,collisionType) &&
-                   collisionType == collision_detection::AllowedCollision::NEVER)
-                pairsToCheck.push_back(ComputeLinksDistance::LinksPair(this,*it_A,*it_B));
+                pairsToCheck.push_back(ComputeLinksDistance::LinksPair(this,linkA,linkB));
+                if(link_capsule_indices[linkA] >= 0 && link_capsule_indices[linkB] >= 0)
+                    pairsToCheck.back().capsulePairIndex =
+                        capsule_batch.addPair(link_capsule_indices[linkA], link_capsule_indices[linkB]);
             }
         }
     }
+    closest_pairs_bounds.reserve(pairsToCheck.size());
+    closest_pairs_heap.reserve(pairsToCheck.size());
+
+    pair_in_threshold.assign(pairsToCheck.size(), false);
+    pair_distances.assign(pairsToCheck.size(), 0.0);
+    pair_linkA_pA.assign(pairsToCheck.size(), KDL::Frame());
+    pair_linkB_pB.assign(pairsToCheck.size(), KDL::Frame());
+
+    std::vector< std::pair<double,unsigned int> > costs;
+    for(unsigned int i = 0; i < pairsToCheck.size(); ++i)
+    {
+        pairsToCheck[i].cost = estimatePairCost(pairsToCheck[i]);
+        costs.push_back(std::pair<double,unsigned int>(-pairsToCheck[i].cost, i));
+    }
+    std::sort(costs.begin(), costs.end());
+    pairs_by_cost.clear();
+    for(unsigned int i = 0; i < costs.size(); ++i)
+        pairs_by_cost.push_back(costs[i].second);
+
+    for(unsigned int bin = 0; bin < narrow_phase_bins.size(); ++bin)
+        narrow_phase_bins[bin].reserve(pairsToCheck.size());
+
     std::cout << "Checking " << pairsToCheck.size() << " pairs for collision" << std::endl;
 }
 
-ComputeLinksDistance::ComputeLinksDistance(iDynUtils &model) : model(model)
+double ComputeLinksDistance::getShapeReach(const unsigned int link)
+{
+    const fcl::CollisionGeometry* shape = link_collision_objects[link]->getCollisionGeometry();
+    if(shape->getNodeType() == fcl::GEOM_CAPSULE)
+    {
+        // capsules are centered in their frame
+        const fcl::Capsule* capsule = static_cast<const fcl::Capsule*>(shape);
+        return 0.5*capsule->lz + capsule->radius;
+    }
+
+    return shape->aabb_center.length() + shape->aabb_radius;
+}
+
+double ComputeLinksDistance::getShapeDisplacement(const fcl::Transform3f& w_T_shape0,
+                                                  const fcl::Transform3f& w_T_shape1,
+                                                  const double reach)
+{
+    // a point at distance r from the frame origin moves at most by |dp| + 2 sin(theta/2) r,
+    // theta being the angle of the relative rotation
+    const fcl::Quaternion3f& q0 = w_T_shape0.getQuatRotation();
+    const fcl::Quaternion3f& q1 = w_T_shape1.getQuatRotation();
+    double cos_half_theta = std::fabs(q0.getW()*q1.getW() + q0.getX()*q1.getX() +
+                                      q0.getY()*q1.getY() + q0.getZ()*q1.getZ());
+    double sin_half_theta = std::sqrt(std::max(0.0, 1.0 - cos_half_theta*cos_half_theta));
+
+    return (w_T_shape1.getTranslation() - w_T_shape0.getTranslation()).length() +
+           2.0*sin_half_theta*reach;
+}
+
+void ComputeLinksDistance::generateLinkMotionBounds()
+{
+    link_motion_bounds.assign(link_names.size(), std::vector< std::pair<int,double> >());
+
+    const KDL::Tree& tree = model.iDyn3_model.getKDLTree();
+    const std::string root_name = tree.getRootSegment()->first;
+    const yarp::sig::Vector q_max = model.iDyn3_model.getJointBoundMax();
+    const yarp::sig::Vector q_min = model.iDyn3_model.getJointBoundMin();
+
+    for(unsigned int link = 0; link < link_names.size(); ++link)
+    {
+        KDL::SegmentMap::const_iterator segment = tree.getSegments().find(link_names[link]);
+        if(segment == tree.getSegments().end())
+            continue;
+
+        // bound of the distance between the link frame origin and any point of the shape
+        double reach = link_T_shapes[link].p.Norm() + shape_reach[link];
+
+        std::vector< std::pair<int,double> >& bounds = link_motion_bounds[link];
+        while(segment->first != root_name)
+        {
+            const KDL::Segment& kdl_segment = segment->second.segment;
+            const KDL::Joint& joint = kdl_segment.getJoint();
+
+            // the distance between the joint origin and the segment tip does not depend on the joint position
+            double joint_to_tip = (kdl_segment.pose(0.0).p - joint.JointOrigin()).Norm();
+            reach += joint_to_tip;
+
+            if(joint.getType() != KDL::Joint::None)
+            {
+                int dof = model.iDyn3_model.getDOFIndex(joint.getName());
+                bool is_prismatic = joint.getType() == KDL::Joint::TransAxis ||
+                                    joint.getType() == KDL::Joint::TransX ||
+                                    joint.getType() == KDL::Joint::TransY ||
+                                    joint.getType() == KDL::Joint::TransZ;
+                if(dof >= 0)
+                {
+                    bounds.push_back(std::pair<int,double>(dof, is_prismatic ? 1.0 : reach));
+                    if(is_prismatic)
+                        reach += std::max(std::fabs(q_max[dof]), std::fabs(q_min[dof]));
+                }
+            }
+
+            // from the parent frame origin to the joint origin
+            reach += joint.JointOrigin().Norm();
+            segment = segment->second.parent;
+        }
+    }
+}
+
+boost::shared_ptr<fcl::CollisionGeometry> ComputeLinksDistance::generateConvexHull(const std::string& linkName,
+                                                                                 const std::string& robot_urdf_path,
+                                                                                 const uint64_t key,
+                                                                                 const std::vector<fcl::Vec3f>& vertices,
+                                                                                 const std::vector<fcl::Triangle>& triangles)
+{
+    boost::filesystem::path urdf_path(robot_urdf_path);
+    boost::filesystem::path cache_directory(urdf_path.parent_path() /
+                                            (std::string(urdf_path.stem().c_str()) + std::string("_convex_hulls")));
+    boost::filesystem::path cache_path(cache_directory / (linkName + std::string(".off")));
+
+    // hulls are keyed as the geometry cache, so they are recomputed whenever the URDF or a mesh changes
+    std::vector<KDL::Vector> hull_vertices;
+    std::vector<unsigned int> hull_triangles;
+    if(!loadConvexHull(cache_path.string(), key, hull_vertices, hull_triangles))
+    {
+        std::vector<KDL::Vector> points;
+        for(unsigned int i = 0; i < vertices.size(); ++i)
+            points.push_back(KDL::Vector(vertices[i][0], vertices[i][1], vertices[i][2]));
+
+        idynutils::convex_hull huller;
+        if(!huller.getConvexHull3D(points, hull_vertices, hull_triangles))
+        {
+            std::cout << "Error computing the convex hull of link " << linkName << std::endl;
+            return boost::shared_ptr<fcl::CollisionGeometry>();
+        }
+
+        boost::system::error_code error;
+        boost::filesystem::create_directories(cache_directory, error);
+        if(!saveConvexHull(cache_path.string(), key, hull_vertices, hull_triangles))
+            std::cout << "Could not cache the convex hull of link " << linkName
+                      << " in " << cache_path.string() << std::endl;
+    }
+
+    boost::shared_ptr<fcl::CollisionGeometry> hull(new ConvexHullShape(hull_vertices, hull_triangles));
+
+    if(report_convex_hulls)
+        reportConvexHull(linkName, vertices, triangles, hull);
+
+    return hull;
+}
+
+void ComputeLinksDistance::reportConvexHull(const std::string& linkName,
+                                            const std::vector<fcl::Vec3f>& vertices,
+                                            const std::vector<fcl::Triangle>& triangles,
+                                            const boost::shared_ptr<fcl::CollisionGeometry>& hull)
+{
+    boost::shared_ptr<fcl::CollisionGeometry> mesh = createMeshBVH(vertices, triangles);
+    fcl::CollisionObject mesh_object(mesh);
+    fcl::CollisionObject hull_object(hull);
+    const double probe_radius = 0.005;
+    fcl::CollisionObject probe_object(boost::shared_ptr<fcl::CollisionGeometry>(new fcl::Sphere(probe_radius)));
+
+    fcl::DistanceRequest request;
+#if FCL_MINOR_VERSION > 2
+    request.gjk_solver_type = fcl::GST_INDEP;
+#endif
+    request.enable_nearest_points = true;
+
+    const fcl::Convex* convex = static_cast<const fcl::Convex*>(hull.get());
+
+    ConvexHullReport report;
+    report.linkName = linkName;
+    report.meshVertices = vertices.size();
+    report.meshTriangles = triangles.size();
+    report.hullVertices = convex->num_points;
+    report.hullTriangles = convex->num_planes;
+    report.meanDistanceError = 0.0;
+    report.maxDistanceError = 0.0;
+    report.meshDistanceTime = 0.0;
+    report.hullDistanceTime = 0.0;
+
+    /* probe spheres 1cm outside faces spread over the mesh, so that the error is large where the face
+       is in a concave region, far from the hull. Faces are counterclockwise seen from outside, as in STL */
+    const double probe_distance = 0.01;
+    const unsigned int probes = std::min(static_cast<unsigned int>(triangles.size()), 32u);
+    unsigned int probed = 0;
+    for(unsigned int k = 0; k < probes; ++k)
+    {
+        const fcl::Triangle& triangle = triangles[(k*triangles.size())/probes];
+        const fcl::Vec3f& a = vertices[triangle[0]];
+        const fcl::Vec3f& b = vertices[triangle[1]];
+        const fcl::Vec3f& c = vertices[triangle[2]];
+        fcl::Vec3f normal = (b - a).cross(c - a);
+        if(normal.length() < 1e-12)
+            continue;
+        normal.normalize();
+        const fcl::Vec3f centroid = (a + b + c)/3.0;
+        probe_object.setTransform(fcl::Transform3f(centroid + normal*(probe_distance + probe_radius)));
+
+        fcl::DistanceResult mesh_result, hull_result;
+        double tic = yarp::os::SystemClock::nowSystem();
+        fcl::distance(&mesh_object, &probe_object, request, mesh_result);
+        report.meshDistanceTime += yarp::os::SystemClock::nowSystem() - tic;
+
+        tic = yarp::os::SystemClock::nowSystem();
+        fcl::distance(&hull_object, &probe_object, request, hull_result);
+        report.hullDistanceTime += yarp::os::SystemClock::nowSystem() - tic;
+
+        // probes inside the hull are in collision with it, fcl does not give penetration distances
+        const double error = std::max(mesh_result.min_distance, 0.0) - std::max(hull_result.min_distance, 0.0);
+        report.meanDistanceError += error;
+        report.maxDistanceError = std::max(report.maxDistanceError, error);
+        ++probed;
+    }
+    if(probed > 0)
+    {
+        report.meanDistanceError /= probed;
+        report.meshDistanceTime /= probed;
+        report.hullDistanceTime /= probed;
+    }
+
+    std::cout << "convex hull of " << linkName << ": "
+              << report.meshTriangles << " -> " << report.hullTriangles << " triangles, "
+              << "distance error mean " << report.meanDistanceError
+              << " max " << report.maxDistanceError << ", "
+              << "distance time " << report.meshDistanceTime << " -> " << report.hullDistanceTime << std::endl;
+
+    convex_hulls_report.push_back(report);
+}
+
+bool ComputeLinksDistance::loadConvexHull(const std::string& path,
+                                          const uint64_t key,
+                                          std::vector<KDL::Vector>& vertices,
+                                          std::vector<unsigned int>& triangles)
+{
+    vertices.clear();
+    triangles.clear();
+
+    std::ifstream file(path.c_str());
+    std::string header, comment, key_label;
+    uint64_t file_key;
+    unsigned int number_of_vertices, number_of_faces, number_of_edges;
+    if(!(file >> header >> comment >> key_label >> file_key) ||
+       header != "OFF" || comment != "#" || key_label != "key" || file_key != key)
+        return false;
+    if(!(file >> number_of_vertices >> number_of_faces >> number_of_edges))
+        return false;
+
+    for(unsigned int i = 0; i < number_of_vertices; ++i)
+    {
+        double x, y, z;
+        if(!(file >> x >> y >> z))
+            return false;
+        vertices.push_back(KDL::Vector(x, y, z));
+    }
+
+    for(unsigned int i = 0; i < number_of_faces; ++i)
+    {
+        unsigned int n, a, b, c;
+        if(!(file >> n >> a >> b >> c) || n != 3 ||
+           a >= number_of_vertices || b >= number_of_vertices || c >= number_of_vertices)
+            return false;
+        triangles.push_back(a);
+        triangles.push_back(b);
+        triangles.push_back(c);
+    }
+
+    return !triangles.empty();
+}
+
+bool ComputeLinksDistance::saveConvexHull(const std::string& path,
+                                          const uint64_t key,
+                                          const std::vector<KDL::Vector>& vertices,
+                                          const std::vector<unsigned int>& triangles)
+{
+    std::ofstream file(path.c_str());
+    if(!file)
+        return false;
+
+    file.precision(17);
+    file << "OFF" << std::endl;
+    file << "# key " << key << std::endl;
+    file << vertices.size() << " " << triangles.size()/3 << " 0" << std::endl;
+    for(unsigned int i = 0; i < vertices.size(); ++i)
+        file << vertices[i].x() << " " << vertices[i].y() << " " << vertices[i].z() << std::endl;
+    for(unsigned int i = 0; i + 2 < triangles.size(); i += 3)
+        file << "3 " << triangles[i] << " " << triangles[i+1] << " " << triangles[i+2] << std::endl;
+
+    return file.good();
+}
+
+const std::vector<ComputeLinksDistance::ConvexHullReport>& ComputeLinksDistance::getConvexHullsReport() const
+{
+    return convex_hulls_report;
+}
+
+ComputeLinksDistance::~ComputeLinksDistance()
+{
+    for(unsigned int w = 0; w < narrow_phase_workers.size(); ++w)
+        narrow_phase_workers[w]->stop();
+}
+
+void ComputeLinksDistance::generateLinkJoints()
+{
+    link_joints.assign(link_names.size(), std::vector<LinkJoint>());
+
+    const KDL::Tree& tree = model.iDyn3_model.getKDLTree();
+    const std::string root_name = tree.getRootSegment()->first;
+
+    for(unsigned int link = 0; link < link_names.size(); ++link)
+    {
+        KDL::SegmentMap::const_iterator segment = tree.getSegments().find(link_names[link]);
+        if(segment == tree.getSegments().end())
+            continue;
+
+        while(segment->first != root_name)
+        {
+            const KDL::Joint& joint = segment->second.segment.getJoint();
+            KDL::SegmentMap::const_iterator parent = segment->second.parent;
+            if(joint.getType() != KDL::Joint::None)
+            {
+                LinkJoint link_joint;
+                link_joint.dof = model.iDyn3_model.getDOFIndex(joint.getName());
+                link_joint.parent_index = model.iDyn3_model.getLinkIndex(parent->first);
+                link_joint.origin = joint.JointOrigin();
+                link_joint.axis = joint.JointAxis();
+                link_joint.prismatic = joint.getType() == KDL::Joint::TransAxis ||
+                                       joint.getType() == KDL::Joint::TransX ||
+                                       joint.getType() == KDL::Joint::TransY ||
+                                       joint.getType() == KDL::Joint::TransZ;
+                if(link_joint.dof >= 0)
+                    link_joints[link].push_back(link_joint);
+            }
+            segment = parent;
+        }
+    }
+
+    joint_axes.resize(model.iDyn3_model.getNrOfDOFs());
+    joint_origins.resize(model.iDyn3_model.getNrOfDOFs());
+    joint_stamps.assign(model.iDyn3_model.getNrOfDOFs(), 0);
+}
+
+void ComputeLinksDistance::updateJoint(const LinkJoint& joint)
+{
+    if(joint_stamps[joint.dof] == query_stamp)
+        return;
+
+    const KDL::Frame& w_T_parent = model.iDyn3_model.getPositionKDL(joint.parent_index);
+    joint_axes[joint.dof] = w_T_parent.M * joint.axis;
+    joint_origins[joint.dof] = w_T_parent * joint.origin;
+    joint_stamps[joint.dof] = query_stamp;
+}
+
+void ComputeLinksDistance::computeDistanceJacobian(const ComputeLinksDistance::LinksPair& pair,
+                                                   const KDL::Frame& linkA_pA,
+                                                   const KDL::Frame& linkB_pB,
+                                                   const double distance,
+                                                   yarp::sig::Matrix& distance_jacobian)
+{
+    distance_jacobian.resize(1, model.iDyn3_model.getNrOfDOFs());
+    distance_jacobian.zero();
+
+    // points in contact have no well defined normal
+    if(std::fabs(distance) < 1e-9)
+        return;
+
+    const KDL::Vector w_pA = model.iDyn3_model.getPositionKDL(link_model_indices[pair.linkA]) * linkA_pA.p;
+    const KDL::Vector w_pB = model.iDyn3_model.getPositionKDL(link_model_indices[pair.linkB]) * linkB_pB.p;
+
+    // with the signed distance, (pA - pB)/d is the gradient of d w.r.t. pA both when separated and penetrating
+    const KDL::Vector n = (w_pA - w_pB) / distance;
+
+    // d(d)/dq_j = n^T (J_pA,j - J_pB,j): joints common to the two paths contribute to both terms
+    const std::vector<LinkJoint>& jointsA = link_joints[pair.linkA];
+    for(unsigned int i = 0; i < jointsA.size(); ++i)
+    {
+        updateJoint(jointsA[i]);
+        const KDL::Vector& z = joint_axes[jointsA[i].dof];
+        distance_jacobian(0, jointsA[i].dof) += jointsA[i].prismatic ?
+            KDL::dot(n, z) : KDL::dot(n, z * (w_pA - joint_origins[jointsA[i].dof]));
+    }
+
+    const std::vector<LinkJoint>& jointsB = link_joints[pair.linkB];
+    for(unsigned int i = 0; i < jointsB.size(); ++i)
+    {
+        updateJoint(jointsB[i]);
+        const KDL::Vector& z = joint_axes[jointsB[i].dof];
+        distance_jacobian(0, jointsB[i].dof) -= jointsB[i].prismatic ?
+            KDL::dot(n, z) : KDL::dot(n, z * (w_pB - joint_origins[jointsB[i].dof]));
+    }
+}
+
+void ComputeLinksDistance::setDistanceJacobians(const bool enabled)
+{
+    distance_jacobians = enabled;
+}
+
+bool ComputeLinksDistance::getDistanceJacobians() const
 {
+    return distance_jacobians;
+}
+
+ComputeLinksDistance::ComputeLinksDistance(iDynUtils &model, const bool convex_hulls,
+                                           const bool report_convex_hulls) :
+    model(model),
+    broad_phase(true),
+    culled_pairs(0),
+    distance_cache(true),
+    cache_queries(0),
+    cache_hits(0),
+    cache_time_saved(0.0),
+    link_distances_tic(0.0),
+    broad_phase_inflation(0.0),
+    ccd_max_iterations(1000),
+    ccd_iterations(0),
+    ccd_converged(true),
+    distance_jacobians(false),
+    query_stamp(0),
+    analytic_kernels(true),
+    narrow_phase_threshold(0.0),
+    convex_hulls(convex_hulls),
+    report_convex_hulls(report_convex_hulls)
+{
+    // capsule models are generated by fit_capsules, see CapsuleFitting
     boost::filesystem::path original_urdf(model.getRobotURDFPath());
-    std::string capsule_model_urdf_filename = std::string(original_urdf.stem().c_str()) + std::string("_capsules.urdf");
-    boost::filesystem::path capsule_urdf(original_urdf.parent_path() /
-                                          capsule_model_urdf_filename);
+    boost::filesystem::path capsule_urdf(CapsuleFitting::getCapsuleModelPath(original_urdf.string()));
 
     boost::filesystem::path original_srdf(model.getRobotSRDFPath());
-    std::string capsule_model_srdf_filename = std::string(original_srdf.stem().c_str()) + std::string("_capsules.srdf");
-    boost::filesystem::path capsule_srdf(original_srdf.parent_path() /
-                                          capsule_model_srdf_filename);
-
-    std::string urdf_to_load, srdf_to_load;
+    boost::filesystem::path capsule_srdf(CapsuleFitting::getCapsuleModelPath(original_srdf.string()));
 
+    // the models already parsed by iDynUtils are reused, unless capsule models exist
+    boost::shared_ptr<urdf::Model> robot_urdf = model.urdf_model;
+    std::string urdf_to_load = original_urdf.string();
     if(boost::filesystem::exists(capsule_urdf))
-        urdf_to_load = capsule_urdf.c_str();
-    else
-        urdf_to_load = original_urdf.c_str();
+    {
+        urdf_to_load = capsule_urdf.string();
+        robot_urdf.reset(new urdf::Model());
+        robot_urdf->initFile(urdf_to_load);
+    }
 
+    robot_srdf = model.robot_srdf;
     if(boost::filesystem::exists(capsule_srdf))
-        srdf_to_load = capsule_srdf.c_str();
-    else
-        srdf_to_load = original_srdf.c_str();
+    {
+        robot_srdf.reset(new srdf::Model());
+        robot_srdf->initFile(*robot_urdf, capsule_srdf.string());
+    }
 
-    this->parseCollisionObjects(urdf_to_load, srdf_to_load);
+    this->parseCollisionObjects(*robot_urdf, urdf_to_load);
 
     this->setCollisionBlackList(std::list<LinkPairDistance::LinksPair>());
+
+    this->generateLinkMotionBounds();
+
+    this->generateLinkJoints();
+
+    this->setNumberOfThreads(1);
 }
 
-std::list<LinkPairDistance> ComputeLinksDistance::getLinkDistances(double detectionThreshold)
+namespace {
+KDL::Vector toKdl(const fcl::Vec3f& v)
 {
-    std::list<LinkPairDistance> results;
+    return KDL::Vector(v[0], v[1], v[2]);
+}
+}
+
+double ComputeLinksDistance::sphereSphereDistance(const KDL::Vector& centerA, const double radiusA,
+                                                  const KDL::Vector& centerB, const double radiusB,
+                                                  KDL::Vector& closestPointA, KDL::Vector& closestPointB)
+{
+    KDL::Vector AB = centerB - centerA;
+    double centers_distance = AB.Norm();
+    // for concentric spheres any direction is valid
+    KDL::Vector direction = centers_distance > 1e-12 ? AB / centers_distance : KDL::Vector(0.0, 0.0, 1.0);
+
+    closestPointA = centerA + radiusA * direction;
+    closestPointB = centerB - radiusB * direction;
+
+    return centers_distance - radiusA - radiusB;
+}
+
+double ComputeLinksDistance::capsuleSphereDistance(const KDL::Vector& endPointA1, const KDL::Vector& endPointA2,
+                                                   const double radiusA,
+                                                   const KDL::Vector& centerB, const double radiusB,
+                                                   KDL::Vector& closestPointA, KDL::Vector& closestPointB)
+{
+    KDL::Vector axis_point, center_point;
+    CapsuleBatch::segmentsDistance(endPointA1, endPointA2, centerB, centerB, axis_point, center_point);
+    return sphereSphereDistance(axis_point, radiusA, centerB, radiusB, closestPointA, closestPointB);
+}
+
+double ComputeLinksDistance::capsuleCapsuleDistance(const KDL::Vector& endPointA1, const KDL::Vector& endPointA2,
+                                                    const double radiusA,
+                                                    const KDL::Vector& endPointB1, const KDL::Vector& endPointB2,
+                                                    const double radiusB,
+                                                    KDL::Vector& closestPointA, KDL::Vector& closestPointB)
+{
+    KDL::Vector axis_point_A, axis_point_B;
+    CapsuleBatch::segmentsDistance(endPointA1, endPointA2, endPointB1, endPointB2, axis_point_A, axis_point_B);
+    return sphereSphereDistance(axis_point_A, radiusA, axis_point_B, radiusB, closestPointA, closestPointB);
+}
+
+bool ComputeLinksDistance::analyticDistance(const ComputeLinksDistance::LinksPair& pair,
+                                            double& distance,
+                                            KDL::Vector& w_pA,
+                                            KDL::Vector& w_pB)
+{
+    const fcl::CollisionObject* collObj_shapeA = pair.collisionObjectA.get();
+    const fcl::CollisionObject* collObj_shapeB = pair.collisionObjectB.get();
+    const fcl::NODE_TYPE typeA = collObj_shapeA->getNodeType();
+    const fcl::NODE_TYPE typeB = collObj_shapeB->getNodeType();
+
+    if((typeA != fcl::GEOM_CAPSULE && typeA != fcl::GEOM_SPHERE) ||
+       (typeB != fcl::GEOM_CAPSULE && typeB != fcl::GEOM_SPHERE))
+        return false;
+
+    // capsules are centered in their shape frame, as in fcl, so that the analytic kernels
+    // compute the same distances as GJK for every pair
+    if(typeA == fcl::GEOM_CAPSULE && typeB == fcl::GEOM_CAPSULE)
+    {
+        const fcl::Capsule* capsuleA = static_cast<const fcl::Capsule*>(collObj_shapeA->getCollisionGeometry());
+        const fcl::Capsule* capsuleB = static_cast<const fcl::Capsule*>(collObj_shapeB->getCollisionGeometry());
+        KDL::Vector A1, A2, B1, B2;
+        getCapsuleEndPoints(collObj_shapeA, A1, A2);
+        getCapsuleEndPoints(collObj_shapeB, B1, B2);
+        distance = capsuleCapsuleDistance(A1, A2, capsuleA->radius,
+                                          B1, B2, capsuleB->radius,
+                                          w_pA, w_pB);
+    }
+    else if(typeA == fcl::GEOM_CAPSULE)
+    {
+        const fcl::Capsule* capsuleA = static_cast<const fcl::Capsule*>(collObj_shapeA->getCollisionGeometry());
+        const fcl::Sphere* sphereB = static_cast<const fcl::Sphere*>(collObj_shapeB->getCollisionGeometry());
+        KDL::Vector A1, A2;
+        getCapsuleEndPoints(collObj_shapeA, A1, A2);
+        distance = capsuleSphereDistance(A1, A2, capsuleA->radius,
+                                         toKdl(collObj_shapeB->getTranslation()), sphereB->radius,
+                                         w_pA, w_pB);
+    }
+    else if(typeB == fcl::GEOM_CAPSULE)
+    {
+        const fcl::Sphere* sphereA = static_cast<const fcl::Sphere*>(collObj_shapeA->getCollisionGeometry());
+        const fcl::Capsule* capsuleB = static_cast<const fcl::Capsule*>(collObj_shapeB->getCollisionGeometry());
+        KDL::Vector B1, B2;
+        getCapsuleEndPoints(collObj_shapeB, B1, B2);
+        distance = capsuleSphereDistance(B1, B2, capsuleB->radius,
+                                         toKdl(collObj_shapeA->getTranslation()), sphereA->radius,
+                                         w_pB, w_pA);
+    }
+    else
+    {
+        const fcl::Sphere* sphereA = static_cast<const fcl::Sphere*>(collObj_shapeA->getCollisionGeometry());
+        const fcl::Sphere* sphereB = static_cast<const fcl::Sphere*>(collObj_shapeB->getCollisionGeometry());
+        distance = sphereSphereDistance(toKdl(collObj_shapeA->getTranslation()), sphereA->radius,
+                                        toKdl(collObj_shapeB->getTranslation()), sphereB->radius,
+                                        w_pA, w_pB);
+    }
+
+    return true;
+}
+
+void ComputeLinksDistance::setAnalyticKernels(const bool enabled)
+{
+    analytic_kernels = enabled;
+}
+
+bool ComputeLinksDistance::getAnalyticKernels() const
+{
+    return analytic_kernels;
+}
+
+void ComputeLinksDistance::setBroadPhase(const bool enabled)
+{
+    broad_phase = enabled;
+}
+
+bool ComputeLinksDistance::getBroadPhase() const
+{
+    return broad_phase;
+}
+
+unsigned int ComputeLinksDistance::getNrOfCulledPairs() const
+{
+    return culled_pairs;
+}
+
+double ComputeLinksDistance::getCullingRatio() const
+{
+    if(pairsToCheck.empty())
+        return 0.0;
+    return double(culled_pairs) / double(pairsToCheck.size());
+}
+
+void ComputeLinksDistance::setDistanceCache(const bool enabled)
+{
+    distance_cache = enabled;
+}
+
+bool ComputeLinksDistance::getDistanceCache() const
+{
+    return distance_cache;
+}
+
+void ComputeLinksDistance::resetDistanceCache()
+{
+    typedef std::vector< ComputeLinksDistance::LinksPair >::iterator iter_pair;
+    for(iter_pair it = pairsToCheck.begin(); it != pairsToCheck.end(); ++it)
+        it->cacheValid = false;
+}
+
+double ComputeLinksDistance::getCacheHitRate() const
+{
+    if(cache_queries == 0)
+        return 0.0;
+    return double(cache_hits) / double(cache_queries);
+}
+
+double ComputeLinksDistance::getCacheTimeSaved() const
+{
+    return cache_time_saved;
+}
 
+void ComputeLinksDistance::beginLinkDistances(const double detectionThreshold,
+                                              const bool compute_bounding_boxes)
+{
     updateCollisionObjects();
 
-    typedef std::list< ComputeLinksDistance::LinksPair >::iterator iter_pair;
+    // the broad phase is useless when all distances are requested
+    culled_pairs = 0;
+    if(broad_phase && detectionThreshold < std::numeric_limits<double>::infinity())
+        updateBroadPhase(detectionThreshold);
+    else if(compute_bounding_boxes)
+        updateBroadPhase(0.0);
+
+    cache_queries = 0;
+    cache_hits = 0;
+    cache_time_saved = 0.0;
+    ++query_stamp;
+    link_distances_tic = yarp::os::SystemClock::nowSystem();
+
+    // all capsule-capsule pairs are computed at once
+    if(analytic_kernels)
+    {
+        updateCapsuleBatch();
+        capsule_batch.computeDistances();
+    }
+}
+
+void ComputeLinksDistance::endLinkDistances()
+{
+    unsigned int computed_pairs = pairsToCheck.size() - culled_pairs - cache_hits;
+    if(computed_pairs > 0)
+        cache_time_saved = cache_hits * (yarp::os::SystemClock::nowSystem() - link_distances_tic) / computed_pairs;
+}
+
+bool ComputeLinksDistance::computeLinksPairDistance(ComputeLinksDistance::LinksPair& pair,
+                                                    const double detectionThreshold,
+                                                    double& distance,
+                                                    KDL::Frame& linkA_pA,
+                                                    KDL::Frame& linkB_pB)
+{
+    if(isPairSkipped(pair, detectionThreshold))
+        return false;
+
+    return computeNarrowPhase(pair, detectionThreshold, distance, linkA_pA, linkB_pB);
+}
+
+bool ComputeLinksDistance::isPairSkipped(const ComputeLinksDistance::LinksPair& pair,
+                                         const double detectionThreshold)
+{
+    const bool finite_threshold = detectionThreshold < std::numeric_limits<double>::infinity();
+
+    if(broad_phase && finite_threshold &&
+       !broad_phase_overlaps[pair.linkA*link_names.size() + pair.linkB])
+    {
+        ++culled_pairs;
+        return true;
+    }
+
+    // skipped pairs are not in the result only because their distance is above the threshold
+    if(distance_cache && finite_threshold && pair.cacheValid)
+    {
+        ++cache_queries;
+        if(getCachedLowerBound(pair) >= detectionThreshold)
+        {
+            ++cache_hits;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief The NarrowPhaseWorker class computes the narrow phase of the pairs in a bin, every time it is started
+ */
+class ComputeLinksDistance::NarrowPhaseWorker : public yarp::os::Thread
+{
+    ComputeLinksDistance& father;
+    const unsigned int bin;
+    yarp::os::Semaphore start_semaphore;
+    yarp::os::Semaphore done_semaphore;
+
+public:
+    NarrowPhaseWorker(ComputeLinksDistance& father, const unsigned int bin) :
+        father(father), bin(bin), start_semaphore(0), done_semaphore(0)
+    {
+
+    }
+
+    void startBin()
+    {
+        start_semaphore.post();
+    }
+
+    void waitBin()
+    {
+        done_semaphore.wait();
+    }
+
+    virtual void onStop()
+    {
+        start_semaphore.post();
+    }
+
+    virtual void run()
+    {
+        while(true)
+        {
+            start_semaphore.wait();
+            if(isStopping())
+                break;
+
+            father.computeNarrowPhaseBin(bin);
+            done_semaphore.post();
+        }
+    }
+};
+
+void ComputeLinksDistance::computeNarrowPhaseBin(const unsigned int bin)
+{
+    const std::vector<unsigned int>& pairs = narrow_phase_bins[bin];
+    for(unsigned int i = 0; i < pairs.size(); ++i)
+    {
+        const unsigned int pair = pairs[i];
+        pair_in_threshold[pair] = computeNarrowPhase(pairsToCheck[pair], narrow_phase_threshold,
+                                                     pair_distances[pair],
+                                                     pair_linkA_pA[pair], pair_linkB_pB[pair]);
+    }
+}
+
+void ComputeLinksDistance::computePairsDistances(const double detectionThreshold)
+{
+    if(narrow_phase_workers.empty())
+    {
+        for(unsigned int i = 0; i < pairsToCheck.size(); ++i)
+            pair_in_threshold[i] = computeLinksPairDistance(pairsToCheck[i], detectionThreshold,
+                                                            pair_distances[i],
+                                                            pair_linkA_pA[i], pair_linkB_pB[i]);
+        return;
+    }
+
+    // the pairs which survive the broad phase and the cache are assigned, from the most expensive,
+    // to the bin with the smallest total cost (longest processing time first)
+    for(unsigned int bin = 0; bin < narrow_phase_bins.size(); ++bin)
+    {
+        narrow_phase_bins[bin].clear();
+        narrow_phase_bin_costs[bin] = 0.0;
+    }
+    for(unsigned int k = 0; k < pairs_by_cost.size(); ++k)
+    {
+        const unsigned int pair = pairs_by_cost[k];
+        pair_in_threshold[pair] = false;
+        if(isPairSkipped(pairsToCheck[pair], detectionThreshold))
+            continue;
+
+        unsigned int bin = std::min_element(narrow_phase_bin_costs.begin(), narrow_phase_bin_costs.end()) -
+                           narrow_phase_bin_costs.begin();
+        narrow_phase_bins[bin].push_back(pair);
+        narrow_phase_bin_costs[bin] += pairsToCheck[pair].cost;
+    }
+
+    // the calling thread computes the first bin
+    narrow_phase_threshold = detectionThreshold;
+    for(unsigned int w = 0; w < narrow_phase_workers.size(); ++w)
+        narrow_phase_workers[w]->startBin();
+    computeNarrowPhaseBin(0);
+    for(unsigned int w = 0; w < narrow_phase_workers.size(); ++w)
+        narrow_phase_workers[w]->waitBin();
+}
+
+double ComputeLinksDistance::estimatePairCost(const ComputeLinksDistance::LinksPair& pair)
+{
+    // capsule-capsule pairs are computed in the capsule batch
+    if(pair.capsulePairIndex >= 0)
+        return 0.1;
+
+    const fcl::NODE_TYPE typeA = pair.collisionObjectA->getNodeType();
+    const fcl::NODE_TYPE typeB = pair.collisionObjectB->getNodeType();
+    if((typeA == fcl::GEOM_CAPSULE || typeA == fcl::GEOM_SPHERE) &&
+       (typeB == fcl::GEOM_CAPSULE || typeB == fcl::GEOM_SPHERE))
+        return 1.0;
+
+    // GJK on primitives costs about 10 analytic kernels, BVH traversal grows with the mesh size
+    double cost = 10.0;
+    const fcl::CollisionObject* objects[2] = { pair.collisionObjectA.get(), pair.collisionObjectB.get() };
+    for(unsigned int i = 0; i < 2; ++i)
+    {
+        if(objects[i]->getObjectType() == fcl::OT_BVH)
+        {
+            const fcl::BVHModel<fcl::OBBRSS>* mesh =
+                static_cast<const fcl::BVHModel<fcl::OBBRSS>*>(objects[i]->getCollisionGeometry());
+            cost *= 1.0 + std::log(1.0 + mesh->num_tris) / std::log(2.0);
+        }
+    }
+    return cost;
+}
+
+void ComputeLinksDistance::setNumberOfThreads(const unsigned int number_of_threads)
+{
+    for(unsigned int w = 0; w < narrow_phase_workers.size(); ++w)
+        narrow_phase_workers[w]->stop();
+    narrow_phase_workers.clear();
+
+    const unsigned int number_of_bins = std::max(number_of_threads, 1u);
+    narrow_phase_bins.assign(number_of_bins, std::vector<unsigned int>());
+    for(unsigned int bin = 0; bin < number_of_bins; ++bin)
+        narrow_phase_bins[bin].reserve(pairsToCheck.size());
+    narrow_phase_bin_costs.assign(number_of_bins, 0.0);
 
-    for(iter_pair it = pairsToCheck.begin();
-        it != pairsToCheck.end();
-        ++it)
+    for(unsigned int bin = 1; bin < number_of_bins; ++bin)
     {
-        std::string linkA = it->linkA;
-        std::string linkB = it->linkB;
+        boost::shared_ptr<NarrowPhaseWorker> worker(new NarrowPhaseWorker(*this, bin));
+        worker->start();
+        narrow_phase_workers.push_back(worker);
+    }
+}
 
-        fcl::CollisionObject* collObj_shapeA = it->collisionObjectA.get();
-        fcl::CollisionObject* collObj_shapeB = it->collisionObjectB.get();
+unsigned int ComputeLinksDistance::getNumberOfThreads() const
+{
+    return narrow_phase_workers.size() + 1;
+}
 
-        fcl::DistanceRequest request;
+double ComputeLinksDistance::getCachedLowerBound(const ComputeLinksDistance::LinksPair& pair)
+{
+    return pair.cachedDistance -
+        getShapeDisplacement(pair.cached_w_T_shapeA, pair.collisionObjectA->getTransform(), shape_reach[pair.linkA]) -
+        getShapeDisplacement(pair.cached_w_T_shapeB, pair.collisionObjectB->getTransform(), shape_reach[pair.linkB]);
+}
+
+double ComputeLinksDistance::getBoundingBoxesDistance(const unsigned int linkA, const unsigned int linkB)
+{
+    // the bounding boxes are inflated by broad_phase_inflation on each side
+    double squared_distance = 0.0;
+    for(unsigned int i = 0; i < 3; ++i)
+    {
+        double gap = std::max(broad_phase_min[linkB][i] - broad_phase_max[linkA][i],
+                              broad_phase_min[linkA][i] - broad_phase_max[linkB][i]) +
+                     2.0*broad_phase_inflation;
+        if(gap > 0.0)
+            squared_distance += gap*gap;
+    }
+    return std::sqrt(squared_distance);
+}
+
+bool ComputeLinksDistance::computeNarrowPhase(ComputeLinksDistance::LinksPair& pair,
+                                              const double detectionThreshold,
+                                              double& distance,
+                                              KDL::Frame& linkA_pA,
+                                              KDL::Frame& linkB_pB)
+{
+    const unsigned int linkA = pair.linkA;
+    const unsigned int linkB = pair.linkB;
+    const fcl::Transform3f& w_T_shapeA = pair.collisionObjectA->getTransform();
+    const fcl::Transform3f& w_T_shapeB = pair.collisionObjectB->getTransform();
+
+    if(analytic_kernels)
+    {
+        KDL::Vector w_pA, w_pB;
+        bool is_analytic = true;
+        if(pair.capsulePairIndex >= 0)
+        {
+            distance = capsule_batch.getDistance(pair.capsulePairIndex);
+            capsule_batch.getClosestPoints(pair.capsulePairIndex, w_pA, w_pB);
+        }
+        else
+            is_analytic = analyticDistance(pair, distance, w_pA, w_pB);
+
+        if(is_analytic)
+        {
+            pair.cacheValid = true;
+            pair.cachedDistance = distance;
+            pair.cached_w_T_shapeA = w_T_shapeA;
+            pair.cached_w_T_shapeB = w_T_shapeB;
+
+            if(distance >= detectionThreshold)
+                return false;
+
+            globalToLinkCoordinates(linkA, fcl::Transform3f(fcl::Vec3f(w_pA.x(), w_pA.y(), w_pA.z())), linkA_pA);
+            globalToLinkCoordinates(linkB, fcl::Transform3f(fcl::Vec3f(w_pB.x(), w_pB.y(), w_pB.z())), linkB_pB);
+            return true;
+        }
+    }
+
+    fcl::CollisionObject* collObj_shapeA = pair.collisionObjectA.get();
+    fcl::CollisionObject* collObj_shapeB = pair.collisionObjectB.get();
+
+    fcl::DistanceRequest request;
 #if FCL_MINOR_VERSION > 2
-        request.gjk_solver_type = fcl::GST_INDEP;
+    request.gjk_solver_type = fcl::GST_INDEP;
 #endif
-        request.enable_nearest_points = true;
+    request.enable_nearest_points = true;
+
+    // result will be returned via the collision result structure
+    fcl::DistanceResult result;
+
+    // perform distance test
+    fcl::distance(collObj_shapeA, collObj_shapeB, request, result);
+
+    pair.cacheValid = true;
+    pair.cachedDistance = result.min_distance;
+    pair.cached_w_T_shapeA = w_T_shapeA;
+    pair.cached_w_T_shapeB = w_T_shapeB;
+
+    distance = result.min_distance;
+    if(distance >= detectionThreshold)
+        return false;
+
+    // p1Homo, p2Homo newly computed points by FCL
+    // absolutely computed w.r.t. base-frame
+    if(collObj_shapeA->getNodeType() == fcl::GEOM_CAPSULE &&
+       collObj_shapeB->getNodeType() == fcl::GEOM_CAPSULE)
+    {
+        globalToLinkCoordinates(linkA, result.nearest_points[0], linkA_pA);
+        globalToLinkCoordinates(linkB, result.nearest_points[1], linkB_pB);
+    } else {
+        shapeToLinkCoordinates(linkA, result.nearest_points[0], linkA_pA);
+        shapeToLinkCoordinates(linkB, result.nearest_points[1], linkB_pB);
+    }
+
+    return true;
+}
+
+std::list<LinkPairDistance> ComputeLinksDistance::getLinkDistances(double detectionThreshold)
+{
+    std::list<LinkPairDistance> results;
 
-        // result will be returned via the collision result structure
-        fcl::DistanceResult result;
+    beginLinkDistances(detectionThreshold);
 
-        // perform distance test
-        fcl::distance(collObj_shapeA, collObj_shapeB, request, result);
+    computePairsDistances(detectionThreshold);
 
-        // p1Homo, p2Homo newly computed points by FCL
-        // absolutely computed w.r.t. base-frame
-        KDL::Frame linkA_pA, linkB_pB;
+    // results are merged in pair order, so that they do not depend on the number of threads
+    yarp::sig::Matrix distance_jacobian;
+    for(unsigned int i = 0; i < pairsToCheck.size(); ++i)
+    {
+        if(!pair_in_threshold[i])
+            continue;
 
-        if(collObj_shapeA->getNodeType() == fcl::GEOM_CAPSULE &&
-           collObj_shapeB->getNodeType() == fcl::GEOM_CAPSULE)
+        if(distance_jacobians)
         {
-            globalToLinkCoordinates(linkA, result.nearest_points[0], linkA_pA);
-            globalToLinkCoordinates(linkB, result.nearest_points[1], linkB_pB);
-        } else {
-            shapeToLinkCoordinates(linkA, result.nearest_points[0], linkA_pA);
-            shapeToLinkCoordinates(linkB, result.nearest_points[1], linkB_pB);
+            computeDistanceJacobian(pairsToCheck[i], pair_linkA_pA[i], pair_linkB_pB[i],
+                                    pair_distances[i], distance_jacobian);
+            results.push_back(LinkPairDistance(link_names[pairsToCheck[i].linkA],
+                                               link_names[pairsToCheck[i].linkB],
+                                               pair_linkA_pA[i], pair_linkB_pB[i],
+                                               pair_distances[i], distance_jacobian));
         }
-
-        if(result.min_distance < detectionThreshold)
-            results.push_back(LinkPairDistance(linkA, linkB,
-                                               linkA_pA, linkB_pB,
-                                               result.min_distance));
+        else
+            results.push_back(LinkPairDistance(link_names[pairsToCheck[i].linkA],
+                                               link_names[pairsToCheck[i].linkB],
+                                               pair_linkA_pA[i], pair_linkB_pB[i],
+                                               pair_distances[i]));
     }
 
+    endLinkDistances();
+
     results.sort();
 
     return results;
 }
 
+namespace {
+    bool closerRecord(const LinkPairDistanceRecord& first, const LinkPairDistanceRecord& second)
+    {
+        return first.distance < second.distance;
+    }
+}
+
+unsigned int ComputeLinksDistance::getLinkDistances(LinkPairDistanceRecord* records,
+                                                    const unsigned int capacity,
+                                                    double detectionThreshold,
+                                                    const bool sorted)
+{
+    beginLinkDistances(detectionThreshold);
+
+    // when more than capacity pairs are closer than the threshold, records is a max-heap
+    // w.r.t. the distance, so that the farthest record is replaced in O(log(capacity))
+    unsigned int size = 0;
+    bool is_heap = false;
+    computePairsDistances(detectionThreshold);
+    for(unsigned int i = 0; i < pairsToCheck.size(); ++i)
+    {
+        if(!pair_in_threshold[i])
+            continue;
+
+        const double distance = pair_distances[i];
+        const KDL::Frame& linkA_pA = pair_linkA_pA[i];
+        const KDL::Frame& linkB_pB = pair_linkB_pB[i];
+
+        if(capacity == 0)
+            continue;
+
+        if(size == capacity)
+        {
+            if(!is_heap)
+            {
+                std::make_heap(records, records + size, closerRecord);
+                is_heap = true;
+            }
+            if(distance >= records[0].distance)
+                continue;
+            std::pop_heap(records, records + size, closerRecord);
+            --size;
+        }
+
+        LinkPairDistanceRecord& record = records[size++];
+        record.pairId = i;
+        record.linkA = pairsToCheck[i].linkA;
+        record.linkB = pairsToCheck[i].linkB;
+        record.distance = distance;
+        for(unsigned int j = 0; j < 3; ++j)
+        {
+            record.linkA_closestPoint[j] = linkA_pA.p[j];
+            record.linkB_closestPoint[j] = linkB_pB.p[j];
+        }
+
+        if(is_heap)
+            std::push_heap(records, records + size, closerRecord);
+    }
+
+    endLinkDistances();
+
+    if(sorted)
+    {
+        if(is_heap)
+            std::sort_heap(records, records + size, closerRecord);
+        else
+            std::sort(records, records + size, closerRecord);
+    }
+
+    return size;
+}
+
+unsigned int ComputeLinksDistance::getNrOfPairs() const
+{
+    return pairsToCheck.size();
+}
+
+std::list<LinkPairDistance> ComputeLinksDistance::getClosestLinkPairs(const unsigned int k,
+                                                                      double detectionThreshold)
+{
+    std::list<LinkPairDistance> results;
+    if(k == 0)
+        return results;
+
+    beginLinkDistances(detectionThreshold, true);
+
+    // a lower bound of each pair distance: the distance between the bounding boxes,
+    // improved by the distance cache when available
+    closest_pairs_bounds.clear();
+    for(unsigned int i = 0; i < pairsToCheck.size(); ++i)
+    {
+        const ComputeLinksDistance::LinksPair& pair = pairsToCheck[i];
+        double lower_bound = getBoundingBoxesDistance(pair.linkA, pair.linkB);
+        if(distance_cache && pair.cacheValid)
+            lower_bound = std::max(lower_bound, getCachedLowerBound(pair));
+
+        if(lower_bound >= detectionThreshold)
+            ++culled_pairs;
+        else
+            closest_pairs_bounds.push_back(std::pair<double,unsigned int>(lower_bound, i));
+    }
+    std::sort(closest_pairs_bounds.begin(), closest_pairs_bounds.end());
+
+    // pairs are checked by increasing lower bound, and the k-th best distance found so far is used as threshold:
+    // as soon as a lower bound is above it, no remaining pair can be closer.
+    // The heap keeps (distance, pair index), the narrow phase results are stored by pair index
+    closest_pairs_heap.clear();
+    for(unsigned int i = 0; i < closest_pairs_bounds.size(); ++i)
+    {
+        if(closest_pairs_bounds[i].first >= detectionThreshold)
+        {
+            culled_pairs += closest_pairs_bounds.size() - i;
+            break;
+        }
+
+        const unsigned int pair = closest_pairs_bounds[i].second;
+        if(!computeNarrowPhase(pairsToCheck[pair], detectionThreshold, pair_distances[pair],
+                               pair_linkA_pA[pair], pair_linkB_pB[pair]))
+            continue;
+
+        if(closest_pairs_heap.size() == k)
+        {
+            std::pop_heap(closest_pairs_heap.begin(), closest_pairs_heap.end());
+            closest_pairs_heap.pop_back();
+        }
+        closest_pairs_heap.push_back(std::pair<double,unsigned int>(pair_distances[pair], pair));
+        std::push_heap(closest_pairs_heap.begin(), closest_pairs_heap.end());
+
+        if(closest_pairs_heap.size() == k)
+            detectionThreshold = std::min(detectionThreshold, closest_pairs_heap.front().first);
+    }
+
+    endLinkDistances();
+
+    std::sort_heap(closest_pairs_heap.begin(), closest_pairs_heap.end());
+
+    // results and jacobians are computed only for the returned pairs
+    yarp::sig::Matrix distance_jacobian;
+    for(unsigned int i = 0; i < closest_pairs_heap.size(); ++i)
+    {
+        const unsigned int pair = closest_pairs_heap[i].second;
+        if(distance_jacobians)
+        {
+            computeDistanceJacobian(pairsToCheck[pair], pair_linkA_pA[pair], pair_linkB_pB[pair],
+                                    pair_distances[pair], distance_jacobian);
+            results.push_back(LinkPairDistance(link_names[pairsToCheck[pair].linkA],
+                                               link_names[pairsToCheck[pair].linkB],
+                                               pair_linkA_pA[pair], pair_linkB_pB[pair],
+                                               pair_distances[pair], distance_jacobian));
+        }
+        else
+            results.push_back(LinkPairDistance(link_names[pairsToCheck[pair].linkA],
+                                               link_names[pairsToCheck[pair].linkB],
+                                               pair_linkA_pA[pair], pair_linkB_pB[pair],
+                                               pair_distances[pair]));
+    }
+
+    return results;
+}
+
+const std::string& ComputeLinksDistance::getLinkName(const unsigned int link) const
+{
+    return link_names[link];
+}
+
+bool ComputeLinksDistance::checkContinuousCollision(const yarp::sig::Vector& q0,
+                                                    const yarp::sig::Vector& q1,
+                                                    double& time_of_contact,
+                                                    LinkPairDistance::LinksPair* collidingPair,
+                                                    const double tolerance)
+{
+    assert(q0.size() == q1.size() && q0.size() == model.iDyn3_model.getNrOfDOFs());
+
+    time_of_contact = -1.0;
+
+    // upper bound of the displacement of any point of each link shape when t goes from 0 to 1
+    std::vector<double> link_motion(link_names.size(), 0.0);
+    for(unsigned int link = 0; link < link_names.size(); ++link)
+    {
+        const std::vector< std::pair<int,double> >& bounds = link_motion_bounds[link];
+        double motion = 0.0;
+        for(unsigned int i = 0; i < bounds.size(); ++i)
+            motion += std::fabs(q1[bounds[i].first] - q0[bounds[i].first]) * bounds[i].second;
+        link_motion[link] = motion;
+    }
+
+    IncrementalForwardKinematics fk(model);
+    yarp::sig::Vector q(q0);
+
+    typedef std::vector< ComputeLinksDistance::LinksPair >::iterator iter_pair;
+
+    double t = 0.0;
+    bool in_contact = false;
+    ccd_iterations = 0;
+    ccd_converged = true;
+    while(!in_contact && t <= 1.0)
+    {
+        if(ccd_iterations == ccd_max_iterations)
+        {
+            // we could not certify the motion is collision free: be conservative
+            std::cout << "Conservative advancement did not converge after " << ccd_max_iterations
+                      << " iterations, reporting contact at t=" << t << std::endl;
+            ccd_converged = false;
+            in_contact = true;
+            time_of_contact = t;
+            break;
+        }
+        ++ccd_iterations;
+
+        for(unsigned int i = 0; i < q.size(); ++i)
+            q[i] = q0[i] + t * (q1[i] - q0[i]);
+        fk.update(q);
+        updateCollisionObjects(fk);
+
+        // pair distances come from the same narrow phase, with the same shapes, of getLinkDistances
+        if(analytic_kernels)
+        {
+            updateCapsuleBatch();
+            capsule_batch.computeDistances();
+        }
+
+        double step = std::numeric_limits<double>::infinity();
+        for(iter_pair it = pairsToCheck.begin();
+            it != pairsToCheck.end() && !in_contact;
+            ++it)
+        {
+            double distance;
+            KDL::Frame linkA_pA, linkB_pB;
+            computeNarrowPhase(*it, tolerance, distance, linkA_pA, linkB_pB);
+
+            if(distance <= tolerance)
+            {
+                in_contact = true;
+                time_of_contact = t;
+                if(collidingPair != NULL)
+                    *collidingPair = LinkPairDistance::LinksPair(link_names[it->linkA], link_names[it->linkB]);
+            }
+            else
+            {
+                // the pair distance can not decrease faster than the sum of the link motion bounds
+                double motion = link_motion[it->linkA] + link_motion[it->linkB];
+                if(motion > 0.0)
+                    step = std::min(step, distance / motion);
+            }
+        }
+
+        if(step == std::numeric_limits<double>::infinity())
+            break;
+        t += step;
+    }
+
+    // collision objects are restored to the model state
+    updateCollisionObjects();
+
+    return in_contact;
+}
+
+void ComputeLinksDistance::setMaxContinuousCollisionIterations(const unsigned int max_iterations)
+{
+    ccd_max_iterations = max_iterations;
+}
+
+unsigned int ComputeLinksDistance::getMaxContinuousCollisionIterations() const
+{
+    return ccd_max_iterations;
+}
+
+unsigned int ComputeLinksDistance::getContinuousCollisionIterations() const
+{
+    return ccd_iterations;
+}
+
+bool ComputeLinksDistance::getContinuousCollisionConverged() const
+{
+    return ccd_converged;
+}
+
 bool ComputeLinksDistance::setCollisionWhiteList(std::list<LinkPairDistance::LinksPair> whiteList)
 {
     allowed_collision_matrix.reset(
@@ -406,10 +1798,10 @@ bool ComputeLinksDistance::setCollisionWhiteList(std::list<LinkPairDistance::Lin
         }
     }
 
-    model.loadDisabledCollisionsFromSRDF(this->robot_srdf, allowed_collision_matrix);
+    model.loadDisabledCollisionsFromSRDF(*this->robot_srdf, allowed_collision_matrix);
 
-    this->generateLinksToUpdate();
     this->generatePairsToCheck();
+    this->generateLinksToUpdate();
 
     //allowed_collision_matrix->print(std::cout);
     return true;
@@ -435,8 +1827,8 @@ bool ComputeLinksDistance::setCollisionBlackList(std::list<LinkPairDistance::Lin
 
     model.loadDisabledCollisionsFromSRDF(allowed_collision_matrix);
 
-    this->generateLinksToUpdate();
     this->generatePairsToCheck();
+    this->generateLinksToUpdate();
 
     //allowed_collision_matrix->print(std::cout);
     return true;
@@ -456,6 +1848,26 @@ LinkPairDistance::LinkPairDistance(const std::string &link1, const std::string &
 
 }
 
+LinkPairDistance::LinkPairDistance(const std::string &link1, const std::string &link2,
+                                   const KDL::Frame &link1_T_closestPoint1,
+                                   const KDL::Frame &link2_T_closestPoint2,
+                                   const double &distance,
+                                   const yarp::sig::Matrix &distance_jacobian) :
+    linksPair(link1 < link2 ? link1:link2,
+             link1 < link2 ? link2:link1),
+    link_T_closestPoint(link1 < link2 ? link1_T_closestPoint1:link2_T_closestPoint2,
+                        link1 < link2 ? link2_T_closestPoint2 :link1_T_closestPoint1),
+    distance(distance),
+    distance_jacobian(distance_jacobian)
+{
+
+}
+
+const yarp::sig::Matrix &LinkPairDistance::getDistanceJacobian() const
+{
+    return distance_jacobian;
+}
+
 const double &LinkPairDistance::getDistance() const
 {
     return distance;
@@ -76,6 +76,56 @@ bool convex_hull::getConvexHull(const std::list<KDL::Vector>& points,
     return true;
 }
 
+bool convex_hull::getConvexHull3D(const std::vector<KDL::Vector>& points,
+                                  std::vector<KDL::Vector>& vertices,
+                                  std::vector<unsigned int>& triangles)
+{
+    vertices.clear();
+    triangles.clear();
+    if(points.size() < 4)
+        return false;
+
+    for(unsigned int i = 0; i < points.size(); ++i)
+        _pointCloud->push_back(fromKDLVector2PCLPointXYZ(points[i]));
+
+    pcl::PointCloud<pcl::PointXYZ> pointsInConvexHull;
+    std::vector<pcl::Vertices> indicesOfVertexes;
+
+    // qhull triangulates the facets of 3D hulls
+    pcl::ConvexHull<pcl::PointXYZ> huller;
+    huller.setDimension(3);
+    huller.setInputCloud(_pointCloud);
+    huller.reconstruct(pointsInConvexHull, indicesOfVertexes);
+    _pointCloud->clear();
+
+    if(huller.getDimension() != 3 || indicesOfVertexes.empty())
+        return false;
+
+    KDL::Vector centroid = KDL::Vector::Zero();
+    for(unsigned int i = 0; i < pointsInConvexHull.size(); ++i)
+    {
+        vertices.push_back(fromPCLPointXYZ2KDLVector(pointsInConvexHull.at(i)));
+        centroid += vertices.back();
+    }
+    centroid = centroid / (double)vertices.size();
+
+    // facets orientation is not guaranteed, normals must point away from the centroid
+    for(unsigned int i = 0; i < indicesOfVertexes.size(); ++i)
+    {
+        const std::vector<uint32_t>& vs = indicesOfVertexes[i].vertices;
+        if(vs.size() != 3)
+            continue;
+
+        const KDL::Vector normal = (vertices[vs[1]] - vertices[vs[0]]) * (vertices[vs[2]] - vertices[vs[0]]);
+        const bool outward = KDL::dot(normal, vertices[vs[0]] - centroid) >= 0.0;
+        triangles.push_back(vs[0]);
+        triangles.push_back(outward ? vs[1] : vs[2]);
+        triangles.push_back(outward ? vs[2] : vs[1]);
+    }
+
+    return !triangles.empty();
+}
+
 pcl::PointXYZ convex_hull::fromKDLVector2PCLPointXYZ(const KDL::Vector &point)
 {
     pcl::PointXYZ p;
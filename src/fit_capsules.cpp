@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <idynutils/capsule_fitting.h>
+#include <iostream>
+
+/**
+ * fit_capsules generates the capsule models of a robot, which ComputeLinksDistance loads in place of the original ones.
+ * Usage: fit_capsules robot.urdf robot.srdf [robot_capsules.urdf robot_capsules.srdf]
+ */
+int main(int argc, char** argv)
+{
+    if(argc != 3 && argc != 5)
+    {
+        std::cout << "Usage: " << argv[0] << " robot.urdf robot.srdf [capsule.urdf capsule.srdf]" << std::endl;
+        return 1;
+    }
+
+    std::string capsule_urdf_path = argc == 5 ? argv[3] : CapsuleFitting::getCapsuleModelPath(argv[1]);
+    std::string capsule_srdf_path = argc == 5 ? argv[4] : CapsuleFitting::getCapsuleModelPath(argv[2]);
+
+    if(!CapsuleFitting::generateCapsuleModel(argv[1], argv[2], capsule_urdf_path, capsule_srdf_path))
+        return 1;
+
+    std::cout << "Written " << capsule_urdf_path << " and " << capsule_srdf_path << std::endl;
+    return 0;
+}
@@ -18,6 +18,7 @@
 */
 
 #include <idynutils/idynutils.h>
+#include <idynutils/incremental_kinematics.h>
 #include <iCub/iDynTree/yarp_kdl.h>
 #include <idynutils/yarp_single_chain_interface.h>
 #include <yarp/math/SVD.h>
@@ -25,6 +26,8 @@
 #include <moveit/robot_model/joint_model.h>
 #include <moveit/robot_state/conversions.h>
 #include <moveit/robot_state/robot_state.h>
+#include <yarp/os/Mutex.h>
+#include <yarp/os/Thread.h>
 
 using namespace iCub::iDynTree;
 using namespace yarp::math;
@@ -34,6 +37,29 @@ using namespace yarp::math;
 #define RED "\033[0;31m"
 #define DEFAULT "\033[0m"
 
+const unsigned int batch_kinematics::pose_size;
+
+KDL::Frame batch_kinematics::getPositionKDL(const unsigned int configuration, const unsigned int link) const
+{
+    assert(configuration < number_of_configurations && link < link_indices.size());
+    const unsigned int N = number_of_configurations;
+    const unsigned int offset = link*pose_size*N + configuration;
+
+    KDL::Frame world_T_link;
+    for(unsigned int c = 0; c < 3; ++c)
+        world_T_link.p.data[c] = poses[offset + c*N];
+    for(unsigned int c = 0; c < 9; ++c)
+        world_T_link.M.data[c] = poses[offset + (3+c)*N];
+    return world_T_link;
+}
+
+KDL::Vector batch_kinematics::getCOM(const unsigned int configuration) const
+{
+    assert(configuration < number_of_configurations);
+    const unsigned int N = number_of_configurations;
+    return KDL::Vector(com[configuration], com[N + configuration], com[2*N + configuration]);
+}
+
 iDynUtils::iDynUtils(const std::string robot_name_,
 		     const std::string urdf_path,
 		     const std::string srdf_path) :
@@ -45,8 +71,11 @@ iDynUtils::iDynUtils(const std::string robot_name_,
     head(walkman::robot::head),
     robot_name(robot_name_),
     g(3,0.0),
+    o(3,0.0),
     anchor_name(""),  // temporary value. Will get updated as soon as we load kinematic chains
-    world_is_inited(false)
+    world_is_inited(false),
+    stale_stages(UPDATE_ALL),
+    link_poses_are_stale(true)
 {
     worldT.resize(4,4);
     worldT.eye();
@@ -78,6 +107,9 @@ iDynUtils::iDynUtils(const std::string robot_name_,
 
     zeros.resize(iDyn3_model.getNrOfDOFs(),0.0);
 
+    link_poses.reset(new IncrementalForwardKinematics(*this));
+    link_poses_q = zeros;
+
     links_in_contact.push_back("l_foot_lower_left_link");
     links_in_contact.push_back("l_foot_lower_right_link");
     links_in_contact.push_back("l_foot_upper_left_link");
@@ -90,6 +122,63 @@ iDynUtils::iDynUtils(const std::string robot_name_,
     readForceTorqueSensorsNames();
 }
 
+iDynUtils::iDynUtils(const iDynUtils& other) :
+    left_leg(other.left_leg),
+    left_arm(other.left_arm),
+    right_leg(other.right_leg),
+    right_arm(other.right_arm),
+    torso(other.torso),
+    head(other.head),
+    urdf_model(other.urdf_model),
+    robot_srdf(other.robot_srdf),
+    moveit_robot_model(other.moveit_robot_model),
+    moveit_collision_robot(other.moveit_collision_robot),
+    zeros(other.zeros),
+    joint_names(other.joint_names),
+    fixed_joint_names(other.fixed_joint_names),
+    links_in_contact(other.links_in_contact),
+    robot_kdl_tree(other.robot_kdl_tree),
+    anchor_name(other.anchor_name),
+    anchor_T_world(other.anchor_T_world),
+    worldT(other.worldT),
+    g(other.g),
+    o(3,0.0),
+    base_link_name(other.base_link_name),
+    robot_name(other.robot_name),
+    robot_urdf_folder(other.robot_urdf_folder),
+    robot_srdf_folder(other.robot_srdf_folder),
+    world_is_inited(other.world_is_inited),
+    stale_stages(UPDATE_ALL),
+    link_poses_q(other.link_poses_q),
+    link_poses_are_stale(true),
+    _ft_sensor_frames(other._ft_sensor_frames)
+{
+    // urdf, srdf, moveit robot model and collision geometries are shared,
+    // the worker only owns its state buffers
+    moveit_robot_state.reset(new robot_state::RobotState(*other.moveit_robot_state));
+    allowed_collision_matrix.reset(
+        new collision_detection::AllowedCollisionMatrix(*other.allowed_collision_matrix));
+
+    bool iDyn3Model_loaded = initiDyn3Model();
+    if(!iDyn3Model_loaded){
+        std::cout<<"Problem Loading iDyn3Model"<<std::endl;
+        assert(iDyn3Model_loaded);}
+
+    // the worker starts from the same state of the original model
+    iDyn3_model.setFloatingBaseLink(other.iDyn3_model.getFloatingBaseLink());
+    iDyn3_model.setAng(other.iDyn3_model.getAng());
+    iDyn3_model.setDAng(other.iDyn3_model.getDAng());
+    iDyn3_model.setD2Ang(other.iDyn3_model.getD2Ang());
+    iDyn3_model.setWorldBasePose(worldT);
+
+    link_poses.reset(new IncrementalForwardKinematics(*this));
+}
+
+boost::shared_ptr<iDynUtils> iDynUtils::clone() const
+{
+    return boost::shared_ptr<iDynUtils>(new iDynUtils(*this));
+}
+
 const std::vector<std::string>& iDynUtils::getJointNames() const {
     return this->joint_names;
 }
@@ -240,10 +329,6 @@ bool iDynUtils::setJointNames()
 bool iDynUtils::iDyn3Model()
 {
     /// iDyn3 Model creation
-    // Giving name to references for FT sensors and IMU
-    std::vector<std::string> joint_ft_sensor_names;
-    std::vector<std::string> imu_link_names;
-
     urdf_model.reset(new urdf::Model());
     std::cout<<" - USING ROBOT "<<robot_name<<" - "<<std::endl;
 
@@ -279,7 +364,21 @@ bool iDynUtils::iDyn3Model()
             std::cout<<"ROBOT LOADED in MOVEIT!"<<std::endl;
         }
     }
-    
+
+    if (!kdl_parser::treeFromUrdfModel(*urdf_model, robot_kdl_tree)){
+        std::cout<<"Failed to construct kdl tree"<<std::endl;
+        return false;}
+    std::cout<<"ROBOT LOADED in KDL"<<std::endl;
+
+    return initiDyn3Model();
+}
+
+bool iDynUtils::initiDyn3Model()
+{
+    // Giving name to references for FT sensors and IMU
+    std::vector<std::string> joint_ft_sensor_names;
+    std::vector<std::string> imu_link_names;
+
     std::vector<srdf::Model::Group> groups = robot_srdf->getGroups();
 
     for(std::vector<srdf::Model::Group>::iterator it_groups = groups.begin();
@@ -312,11 +411,6 @@ bool iDynUtils::iDyn3Model()
             base_link_name=group.links_[0];
     }
     
-    if (!kdl_parser::treeFromUrdfModel(*urdf_model, robot_kdl_tree)){
-        std::cout<<"Failed to construct kdl tree"<<std::endl;
-        return false;}
-    std::cout<<"ROBOT LOADED in KDL"<<std::endl;
-    
     // Here the iDyn3 model of the robot is generated
     std::string imu_link_idyntree = "";
     if(!imu_link_names.empty())
@@ -474,23 +568,34 @@ KDL::Frame iDynUtils::setWorldPose(const std::string& anchor)
     }
 
     iDyn3_model.setWorldBasePose(worldT);
+    link_poses->setWorldBasePose(iDyn3_model.getWorldBasePoseKDL());
+
+    // world poses and gravity in base link coordinates depend on worldT,
+    // and the RNEA stages depend on gravity
+    stale_stages = UPDATE_ALL;
 
     return anchor_T_world;
 }
 
 void iDynUtils::setWorldPose(const KDL::Frame& anchor_T_world, const std::string& anchor)
 {
+    // worldT is filled in place, KDLtoYarp_position would allocate a new matrix
     if(iDyn3_model.getLinkIndex(anchor) != iDyn3_model.getFloatingBaseLink()) {
-        worldT =    KDLtoYarp_position(
+        cartesian_utils::fromKDLFrameToYARPMatrix(
                         anchor_T_world.Inverse()
                         *
-                        iDyn3_model.getPositionKDL(iDyn3_model.getLinkIndex(anchor),iDyn3_model.getFloatingBaseLink())
-                    );
+                        iDyn3_model.getPositionKDL(iDyn3_model.getLinkIndex(anchor),iDyn3_model.getFloatingBaseLink()),
+                        worldT);
     } else {
-        worldT = KDLtoYarp_position(anchor_T_world.Inverse());
+        cartesian_utils::fromKDLFrameToYARPMatrix(anchor_T_world.Inverse(), worldT);
     }
 
     iDyn3_model.setWorldBasePose(worldT);
+    link_poses->setWorldBasePose(iDyn3_model.getWorldBasePoseKDL());
+
+    // world poses and gravity in base link coordinates depend on worldT,
+    // and the RNEA stages depend on gravity
+    stale_stages = UPDATE_ALL;
 }
 
 bool iDynUtils::getWorldPose(KDL::Frame &anchor_T_world, std::string &anchor) const
@@ -527,6 +632,18 @@ void iDynUtils::updateiDyn3Model(const yarp::sig::Vector &q,
         updateForceTorqueMeasurement(force_torque_measurement[i]);
 }
 
+void iDynUtils::updateiDyn3Model(const yarp::sig::Vector &q,
+                                 const std::vector<int> &ft_indices,
+                                 const std::vector<yarp::sig::Vector> &ft_wrenches,
+                                 const bool set_world_pose)
+{
+    this->updateiDyn3Model(q, zeros, zeros, set_world_pose);
+
+    for(unsigned int i = 0; i < ft_indices.size() && i < ft_wrenches.size(); ++i)
+        if(ft_indices[i] >= 0)
+            updateForceTorqueMeasurement(ft_indices[i], ft_wrenches[i]);
+}
+
 void iDynUtils::updateiDyn3Model(const yarp::sig::Vector& q,
                                  const yarp::sig::Vector& dq,
                                  const bool set_world_pose) {
@@ -560,12 +677,36 @@ void iDynUtils::updateiDyn3Model(const yarp::sig::Vector& q,
                                  const yarp::sig::Vector& dq_ref,
                                  const yarp::sig::Vector& ddq_ref,
                                  const bool set_world_pose)
+{
+    this->updateiDyn3ModelStages(q, dq_ref, ddq_ref, UPDATE_ALL, set_world_pose);
+}
+
+void iDynUtils::updateiDyn3ModelStages(const yarp::sig::Vector& q,
+                                       const int update_stages,
+                                       const bool set_world_pose)
+{
+    this->updateiDyn3ModelStages(q, zeros, zeros, update_stages, set_world_pose);
+}
+
+void iDynUtils::updateiDyn3ModelStages(const yarp::sig::Vector& q,
+                                       const yarp::sig::Vector& dq_ref,
+                                       const yarp::sig::Vector& ddq_ref,
+                                       const int update_stages,
+                                       const bool set_world_pose)
 {
     // Here we set these values in our internal model
     iDyn3_model.setAng(q);
     iDyn3_model.setDAng(dq_ref);
     iDyn3_model.setD2Ang(ddq_ref);
 
+    // nothing has been computed yet for the new joint state
+    stale_stages = UPDATE_ALL;
+
+    // link poses are updated incrementally by getPositionKDL
+    for(unsigned int i = 0; i < q.size() && i < link_poses_q.size(); ++i)
+        link_poses_q[i] = q[i];
+    link_poses_are_stale = true;
+
     // setting the world pose
 
     if(set_world_pose) {
@@ -575,23 +716,168 @@ void iDynUtils::updateiDyn3Model(const yarp::sig::Vector& q,
             } this->updateWorldPose();
         }
 
-    // This is the fake Inertial Measure
-    g.zero();
-    g[2] = 9.81;
+    this->updateStaleStages(update_stages);
+}
 
-    // get the rotational part of worldT (w_R_b),
-    // compute the inverse (b_R_w = w_R_b^T) and multiply by w_g
-    // to obtain g expressed in base link coordinates, b_g
-    g = (worldT * iDyn3_model.getPosition(0,iDyn3_model.getFloatingBaseLink())).submatrix(0,2,0,2).transposed() * g;
+void iDynUtils::updateStaleStages(const int update_stages)
+{
+    int stages = update_stages;
 
-    yarp::sig::Vector o(3,0.0);
-    iDyn3_model.setInertialMeasure(o, o, g);
+    // kinematicRNEA propagates the inertial measure, dynamicRNEA needs kinematicRNEA
+    if(stages & UPDATE_DYNAMICS)
+        stages |= UPDATE_VELOCITIES;
+    if(stages & UPDATE_VELOCITIES)
+        stages |= UPDATE_GRAVITY;
 
-    iDyn3_model.kinematicRNEA();
+    stages &= stale_stages;
 
-    iDyn3_model.dynamicRNEA();
+    if(stages & UPDATE_GRAVITY)
+    {
+        // This is the fake Inertial Measure
+        // get the rotational part of worldT (w_R_b),
+        // compute the inverse (b_R_w = w_R_b^T) and multiply by w_g = [0 0 9.81]
+        // to obtain g expressed in base link coordinates, b_g.
+        // Since only the third row of w_R_b is needed, we compute it in place
+        // to avoid temporary matrices on the hot path
+        const KDL::Rotation R = iDyn3_model.getPositionKDL(0,iDyn3_model.getFloatingBaseLink()).M;
+        for(unsigned int i = 0; i < 3; ++i)
+            g[i] = 9.81 * ( worldT(2,0)*R(0,i) + worldT(2,1)*R(1,i) + worldT(2,2)*R(2,i) );
+
+        iDyn3_model.setInertialMeasure(o, o, g);
+        stale_stages &= ~UPDATE_GRAVITY;
+    }
 
-    iDyn3_model.computePositions();
+    if(stages & UPDATE_VELOCITIES)
+    {
+        iDyn3_model.kinematicRNEA();
+        stale_stages &= ~UPDATE_VELOCITIES;
+    }
+
+    if(stages & UPDATE_DYNAMICS)
+    {
+        iDyn3_model.dynamicRNEA();
+        stale_stages &= ~UPDATE_DYNAMICS;
+    }
+
+    if(stages & UPDATE_POSITIONS)
+    {
+        iDyn3_model.computePositions();
+        stale_stages &= ~UPDATE_POSITIONS;
+    }
+}
+
+int iDynUtils::getStaleStages() const
+{
+    return stale_stages;
+}
+
+void iDynUtils::updateLinkPoses()
+{
+    if(link_poses_are_stale)
+    {
+        link_poses->update(link_poses_q);
+        link_poses_are_stale = false;
+    }
+}
+
+KDL::Frame iDynUtils::getPositionKDL(const int link_index)
+{
+    this->updateLinkPoses();
+    return link_poses->getPositionKDL(link_index);
+}
+
+KDL::Frame iDynUtils::getPositionKDL(const int first_link, const int second_link)
+{
+    this->updateLinkPoses();
+    return link_poses->getPositionKDL(first_link, second_link);
+}
+
+yarp::sig::Vector iDynUtils::getCOM()
+{
+    this->updateStaleStages(UPDATE_POSITIONS);
+    return iDyn3_model.getCOM();
+}
+
+yarp::sig::Vector iDynUtils::getTorques()
+{
+    this->updateStaleStages(UPDATE_DYNAMICS);
+    return iDyn3_model.getTorques();
+}
+
+bool iDynUtils::computeBatchKinematics(const yarp::sig::Matrix& Q,
+                                       const std::vector<int>& link_indices,
+                                       batch_kinematics& result)
+{
+    if((unsigned int)Q.cols() != iDyn3_model.getNrOfDOFs()) {
+        std::cout << RED << "ERROR: batch configurations have " << Q.cols()
+                  << " columns, model has " << iDyn3_model.getNrOfDOFs() << " DOFs" << DEFAULT << std::endl;
+        return false;
+    }
+
+    // the tree tables are shared with the incremental forward kinematics,
+    // the model state is never touched
+    const std::vector<KDL::Segment>& segments = link_poses->getSegments();
+    const std::vector<int>& parents = link_poses->getParents();
+    const std::vector<int>& dof_indices = link_poses->getDOFIndices();
+
+    std::vector<int> link_segments(link_indices.size(), -1);
+    for(unsigned int l = 0; l < link_indices.size(); ++l)
+    {
+        link_segments[l] = link_poses->getSegmentIndex(link_indices[l]);
+        if(link_segments[l] < 0) {
+            std::cout << RED << "ERROR: invalid link index " << link_indices[l] << DEFAULT << std::endl;
+            return false;
+        }
+    }
+
+    const int fb_segment = link_poses->getSegmentIndex(iDyn3_model.getFloatingBaseLink());
+    const KDL::Frame world_T_fb = iDyn3_model.getWorldBasePoseKDL();
+    const double total_mass = link_poses->getTotalMass();
+
+    const unsigned int N = Q.rows();
+    result.number_of_configurations = N;
+    result.link_indices = link_indices;
+    result.poses.resize(link_indices.size()*batch_kinematics::pose_size*N);
+    result.com.resize(3*N);
+
+    std::vector<KDL::Frame> root_T_link(segments.size());
+    for(unsigned int n = 0; n < N; ++n)
+    {
+        for(unsigned int i = 0; i < segments.size(); ++i)
+        {
+            const double q_i = (dof_indices[i] >= 0 ? Q(n, dof_indices[i]) : 0.0);
+            if(parents[i] >= 0)
+                root_T_link[i] = root_T_link[parents[i]] * segments[i].pose(q_i);
+            else
+                root_T_link[i] = segments[i].pose(q_i);
+        }
+
+        // world_T_root = world_T_fb * fb_T_root
+        const KDL::Frame world_T_root = world_T_fb * root_T_link[fb_segment].Inverse();
+
+        for(unsigned int l = 0; l < link_segments.size(); ++l)
+        {
+            const KDL::Frame world_T_link = world_T_root * root_T_link[link_segments[l]];
+            const unsigned int offset = l*batch_kinematics::pose_size*N + n;
+            for(unsigned int c = 0; c < 3; ++c)
+                result.poses[offset + c*N] = world_T_link.p.data[c];
+            for(unsigned int c = 0; c < 9; ++c)
+                result.poses[offset + (3+c)*N] = world_T_link.M.data[c];
+        }
+
+        KDL::Vector root_com = KDL::Vector::Zero();
+        for(unsigned int i = 0; i < segments.size(); ++i)
+        {
+            const KDL::RigidBodyInertia& inertia = segments[i].getInertia();
+            if(inertia.getMass() > 0.0)
+                root_com += inertia.getMass() * (root_T_link[i] * inertia.getCOG());
+        }
+        const KDL::Vector world_com = world_T_root * (root_com / total_mass);
+        for(unsigned int c = 0; c < 3; ++c)
+            result.com[c*N + n] = world_com.data[c];
+    }
+
+    return true;
 }
 
 void iDynUtils::setJointNumbers(kinematic_chain& chain)
@@ -732,6 +1018,156 @@ bool iDynUtils::checkSelfCollisionAt(const yarp::sig::Vector& q,
 
 }
 
+namespace {
+/**
+ * @brief The SelfCollisionBatch struct holds the data shared by all the workers of checkSelfCollisionBatch
+ */
+struct SelfCollisionBatch
+{
+    const std::vector<yarp::sig::Vector>* configurations;
+    const std::vector<std::string>* joint_names;
+    std::vector<int> dof_indices;
+    const collision_detection::AllowedCollisionMatrix* acm;
+    bool stop_at_first_collision;
+
+    std::vector<int>* results;
+    std::vector< std::list< std::pair<std::string,std::string> > >* collisionPairs;
+
+    /* next_configuration and first_collision are protected by mutex */
+    yarp::os::Mutex mutex;
+    unsigned int next_configuration;
+    unsigned int first_collision;
+
+    /**
+     * @brief getNextConfiguration assigns the next configuration to check to a worker
+     * @param index the next configuration index
+     * @return false when there are no more configurations to check
+     */
+    bool getNextConfiguration(unsigned int& index)
+    {
+        mutex.lock();
+        index = next_configuration++;
+        bool has_next = index < configurations->size() &&
+                        (!stop_at_first_collision || index < first_collision);
+        mutex.unlock();
+        return has_next;
+    }
+
+    void setCollision(const unsigned int index)
+    {
+        mutex.lock();
+        if(index < first_collision)
+            first_collision = index;
+        mutex.unlock();
+    }
+};
+
+/**
+ * @brief The SelfCollisionWorker class checks configurations of a SelfCollisionBatch
+ *        using its own robot state and collision robot
+ */
+class SelfCollisionWorker : public yarp::os::Thread
+{
+public:
+    SelfCollisionWorker(SelfCollisionBatch& batch,
+                        const robot_state::RobotState& state,
+                        const collision_detection::CollisionRobotFCL& collision_robot) :
+        batch(batch), state(state), collision_robot(collision_robot)
+    {}
+
+    virtual void run()
+    {
+        unsigned int index;
+        while(batch.getNextConfiguration(index))
+        {
+            const yarp::sig::Vector& q = (*batch.configurations)[index];
+            for(unsigned int i = 0; i < batch.joint_names->size(); ++i)
+                state.setJointPositions((*batch.joint_names)[i], &q[batch.dof_indices[i]]);
+            state.updateCollisionBodyTransforms();
+
+            collision_detection::CollisionRequest req;
+            collision_detection::CollisionResult res;
+            if(batch.collisionPairs != NULL)
+            {
+                req.contacts = true;
+                req.max_contacts = 100;
+            }
+            collision_robot.checkSelfCollision(req, res, state, *batch.acm);
+
+            // every worker writes different elements of the results
+            (*batch.results)[index] = res.collision ? iDynUtils::SELF_COLLISION_DETECTED :
+                                                      iDynUtils::SELF_COLLISION_FREE;
+            if(batch.collisionPairs != NULL)
+            {
+                std::list< std::pair<std::string,std::string> >& pairs = (*batch.collisionPairs)[index];
+                for(collision_detection::CollisionResult::ContactMap::const_iterator it = res.contacts.begin();
+                    it != res.contacts.end();
+                    ++it)
+                    pairs.push_back(it->first);
+            }
+
+            if(res.collision)
+                batch.setCollision(index);
+        }
+    }
+
+private:
+    SelfCollisionBatch& batch;
+    robot_state::RobotState state;
+    collision_detection::CollisionRobotFCL collision_robot;
+};
+}
+
+int iDynUtils::checkSelfCollisionBatch(const std::vector<yarp::sig::Vector>& configurations,
+                                       std::vector<int>& results,
+                                       std::vector< std::list< std::pair<std::string,std::string> > >* collisionPairs,
+                                       const bool stop_at_first_collision,
+                                       const unsigned int number_of_threads)
+{
+    results.assign(configurations.size(), SELF_COLLISION_NOT_CHECKED);
+    if(collisionPairs != NULL) {
+        collisionPairs->clear();
+        collisionPairs->resize(configurations.size());
+    }
+
+    const collision_detection::CollisionRobotFCL* collision_robot =
+        dynamic_cast<const collision_detection::CollisionRobotFCL*>(moveit_collision_robot.get());
+    assert(collision_robot != NULL && "checkSelfCollisionBatch needs a FCL collision robot");
+
+    SelfCollisionBatch batch;
+    batch.configurations = &configurations;
+    batch.joint_names = &joint_names;
+    for(unsigned int i = 0; i < joint_names.size(); ++i)
+        batch.dof_indices.push_back(iDyn3_model.getDOFIndex(joint_names[i]));
+    batch.acm = allowed_collision_matrix.get();
+    batch.stop_at_first_collision = stop_at_first_collision;
+    batch.results = &results;
+    batch.collisionPairs = collisionPairs;
+    batch.next_configuration = 0;
+    batch.first_collision = configurations.size();
+
+    unsigned int n_threads = std::max(1u, std::min(number_of_threads, (unsigned int)configurations.size()));
+    std::vector< boost::shared_ptr<SelfCollisionWorker> > workers;
+    for(unsigned int t = 0; t < n_threads; ++t)
+        workers.push_back(boost::shared_ptr<SelfCollisionWorker>(
+            new SelfCollisionWorker(batch, *moveit_robot_state, *collision_robot)));
+
+    if(n_threads == 1)
+        workers[0]->run();
+    else
+    {
+        for(unsigned int t = 0; t < n_threads; ++t)
+            workers[t]->start();
+        for(unsigned int t = 0; t < n_threads; ++t)
+            workers[t]->stop();
+    }
+
+    for(unsigned int i = 0; i < results.size(); ++i)
+        if(results[i] == SELF_COLLISION_DETECTED)
+            return i;
+    return -1;
+}
+
 void iDynUtils::loadDisabledCollisionsFromSRDF(collision_detection::AllowedCollisionMatrixPtr acm)
 {
     loadDisabledCollisionsFromSRDF(*this->robot_srdf, acm);
@@ -841,18 +1277,29 @@ void iDynUtils::updateRobotState(const yarp::sig::Vector& q)
 
 bool iDynUtils::updateForceTorqueMeasurement(const ft_measure& force_torque_measurement)
 {
-    moveit::core::LinkModel* ft_link = moveit_robot_model->getLinkModel(
-                force_torque_measurement.first);
+    int ft_index = getFTSensorIndex(force_torque_measurement.first);
 
-    int ft_index = iDyn3_model.getFTSensorIndex(
-                ft_link->getParentJointModel()->getName());
+    return updateForceTorqueMeasurement(ft_index, force_torque_measurement.second);
+}
 
-    if(iDyn3_model.setSensorMeasurement(ft_index, force_torque_measurement.second))
+bool iDynUtils::updateForceTorqueMeasurement(const int ft_index,
+                                             const yarp::sig::Vector& wrench)
+{
+    if(iDyn3_model.setSensorMeasurement(ft_index, wrench))
         return true;
 
     return false;
 }
 
+int iDynUtils::getFTSensorIndex(const ft_reference_frame& ft_reference_frame)
+{
+    moveit::core::LinkModel* ft_link = moveit_robot_model->getLinkModel(ft_reference_frame);
+    if(ft_link == NULL || ft_link->getParentJointModel() == NULL)
+        return -1;
+
+    return iDyn3_model.getFTSensorIndex(ft_link->getParentJointModel()->getName());
+}
+
 bool iDynUtils::readForceTorqueSensorsNames()
 {
     std::vector<srdf::Model::Group> robot_groups = robot_srdf->getGroups();
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2014 Walkman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <idynutils/incremental_kinematics.h>
+#include <assert.h>
+
+IncrementalForwardKinematics::IncrementalForwardKinematics(iDynUtils &model) :
+    model(model),
+    total_mass(0.0),
+    last_q(model.iDyn3_model.getNrOfDOFs(), 0.0),
+    is_initialized(false),
+    recomputed_links(0)
+{
+    const KDL::Tree& tree = model.iDyn3_model.getKDLTree();
+    link_to_segment.resize(model.iDyn3_model.getNrOfLinks(), -1);
+
+    addSubtree(tree.getRootSegment(), -1);
+
+    root_T_link.resize(segments.size(), KDL::Frame::Identity());
+    dirty.resize(segments.size(), 1);
+
+    setWorldBasePose(model.iDyn3_model.getWorldBasePoseKDL());
+}
+
+void IncrementalForwardKinematics::setWorldBasePose(const KDL::Frame &world_T_fb)
+{
+    this->world_T_fb = world_T_fb;
+    fb_segment = link_to_segment[model.iDyn3_model.getFloatingBaseLink()];
+    assert(fb_segment >= 0);
+}
+
+void IncrementalForwardKinematics::addSubtree(const KDL::SegmentMap::const_iterator &segment,
+                                              const int parent)
+{
+    const KDL::Segment& kdl_segment = segment->second.segment;
+    int position = segments.size();
+
+    segments.push_back(kdl_segment);
+    parents.push_back(parent);
+    total_mass += kdl_segment.getInertia().getMass();
+    if(kdl_segment.getJoint().getType() == KDL::Joint::None)
+        dof_indices.push_back(-1);
+    else
+        dof_indices.push_back(model.iDyn3_model.getDOFIndex(kdl_segment.getJoint().getName()));
+
+    int link_index = model.iDyn3_model.getLinkIndex(kdl_segment.getName());
+    if(link_index >= 0 && link_index < (int)link_to_segment.size())
+        link_to_segment[link_index] = position;
+
+    typedef std::vector<KDL::SegmentMap::const_iterator>::const_iterator iter_children;
+    for(iter_children it = segment->second.children.begin();
+        it != segment->second.children.end();
+        ++it)
+        addSubtree(*it, position);
+}
+
+unsigned int IncrementalForwardKinematics::update(const yarp::sig::Vector &q)
+{
+    assert(q.size() == last_q.size());
+
+    recomputed_links = 0;
+    for(unsigned int i = 0; i < segments.size(); ++i)
+    {
+        const int dof = dof_indices[i];
+        const int parent = parents[i];
+
+        // a link is dirty if its joint moved or if its parent is dirty
+        bool is_dirty = !is_initialized ||
+                        (dof >= 0 && q[dof] != last_q[dof]) ||
+                        (parent >= 0 && dirty[parent]);
+        dirty[i] = is_dirty;
+
+        if(is_dirty)
+        {
+            const double q_i = (dof >= 0 ? q[dof] : 0.0);
+            if(parent >= 0)
+                root_T_link[i] = root_T_link[parent] * segments[i].pose(q_i);
+            else
+                root_T_link[i] = segments[i].pose(q_i);
+            ++recomputed_links;
+        }
+    }
+
+    for(unsigned int i = 0; i < q.size(); ++i)
+        last_q[i] = q[i];
+    is_initialized = true;
+
+    return recomputed_links;
+}
+
+void IncrementalForwardKinematics::invalidate()
+{
+    is_initialized = false;
+}
+
+const KDL::Frame& IncrementalForwardKinematics::getRoot_T_Link(const int link_index) const
+{
+    assert(link_index >= 0 && link_index < (int)link_to_segment.size());
+    assert(link_to_segment[link_index] >= 0);
+    return root_T_link[link_to_segment[link_index]];
+}
+
+KDL::Frame IncrementalForwardKinematics::getPositionKDL(const int link_index) const
+{
+    // world_T_link = world_T_fb * fb_T_root * root_T_link
+    return world_T_fb * root_T_link[fb_segment].Inverse() * getRoot_T_Link(link_index);
+}
+
+KDL::Frame IncrementalForwardKinematics::getPositionKDL(const int first_link, const int second_link) const
+{
+    return getRoot_T_Link(first_link).Inverse() * getRoot_T_Link(second_link);
+}
+
+unsigned int IncrementalForwardKinematics::getNrOfRecomputedLinks() const
+{
+    return recomputed_links;
+}
+
+unsigned int IncrementalForwardKinematics::getNrOfLinks() const
+{
+    return segments.size();
+}
+
+const std::vector<KDL::Segment>& IncrementalForwardKinematics::getSegments() const
+{
+    return segments;
+}
+
+const std::vector<int>& IncrementalForwardKinematics::getParents() const
+{
+    return parents;
+}
+
+const std::vector<int>& IncrementalForwardKinematics::getDOFIndices() const
+{
+    return dof_indices;
+}
+
+int IncrementalForwardKinematics::getSegmentIndex(const int link_index) const
+{
+    if(link_index < 0 || link_index >= (int)link_to_segment.size())
+        return -1;
+    return link_to_segment[link_index];
+}
+
+double IncrementalForwardKinematics::getTotalMass() const
+{
+    return total_mass;
+}
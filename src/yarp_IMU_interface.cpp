@@ -82,6 +82,18 @@ yarp::sig::Vector yarp_IMU_interface::sense()
     return _output;
 }
 
+bool yarp_IMU_interface::sense(yarp::sig::Vector &output)
+{
+    this->_sense();
+
+    if(output.size() != _output.size())
+        output.resize(_output.size());
+    for(unsigned int i = 0; i < _output.size(); ++i)
+        output[i] = _output[i];
+
+    return _ok;
+}
+
 void yarp_IMU_interface::sense(yarp::sig::Vector &orientation,
                                yarp::sig::Vector &linearAcceleration,
                                yarp::sig::Vector &angularVelocity)
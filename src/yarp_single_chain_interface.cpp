@@ -390,25 +390,83 @@ void yarp_single_chain_interface::move(const yarp::sig::Vector& u_d)
 {
     yarp::sig::Vector u_sent(u_d);
 
+    const double scale = getMotorCommandFromSIScale();
+    if(scale != 1.0)
+        for(unsigned int i = 0; i < u_sent.size(); ++i)
+            u_sent[i] *= scale;
+
+    moveRaw(u_sent.data());
+}
+
+bool yarp_single_chain_interface::sensePositionRaw(double* q_sensed) {
+    return encodersMotor->getEncoders(q_sensed);
+}
+
+bool yarp_single_chain_interface::senseVelocityRaw(double* velocity_sensed) {
+    return encodersMotor->getEncoderSpeeds(velocity_sensed);
+}
+
+bool yarp_single_chain_interface::senseTorqueRaw(double* tau_sensed) {
+    return torqueControl->getTorques(tau_sensed);
+}
+
+bool yarp_single_chain_interface::sensePositionRefFeedbackRaw(double* q_position_ref_feedback) {
+    return pidControl->getReferences(q_position_ref_feedback);
+}
+
+bool yarp_single_chain_interface::senseRaw(double* q_sensed,
+                                           double* velocity_sensed,
+                                           double* tau_sensed,
+                                           double* timestamps) {
+    bool success = encodersMotor->getEncodersTimed(q_sensed, timestamps);
+    success = encodersMotor->getEncoderSpeeds(velocity_sensed) && success;
+    success = torqueControl->getTorques(tau_sensed) && success;
+    return success;
+}
+
+double yarp_single_chain_interface::getEncoderToSIScale() const
+{
+    return _useSI ? M_PI / 180.0 : 1.0;
+}
+
+double yarp_single_chain_interface::getMotorCommandFromSIScale() const
+{
+    if(!_useSI)
+        return 1.0;
+
+    switch (_controlType.toYarp().first)
+    {
+        case VOCAB_CM_POSITION_DIRECT:
+        case VOCAB_CM_IMPEDANCE_POS:
+        case VOCAB_CM_POSITION:
+            return 180.0 / M_PI;
+        default:
+            return 1.0;
+    }
+}
+
+void yarp_single_chain_interface::moveRaw(const double* u_d)
+{
+    // some yarp versions take non-const pointers, but the commands are not modified
+    double* u_sent = const_cast<double*>(u_d);
+
     switch (_controlType.toYarp().first)
     {
         case VOCAB_CM_POSITION_DIRECT:
         case VOCAB_CM_IMPEDANCE_POS:
-            if(_useSI) convertMotorCommandFromSI(u_sent);
-            if(!positionDirect->setPositions(u_sent.data()))
+            if(!positionDirect->setPositions(u_sent))
                 std::cout<<"Cannot move "<< kinematic_chain <<" using Direct Position Ctrl"<<std::endl;
             break;
         case VOCAB_CM_POSITION:
-            if(_useSI) convertMotorCommandFromSI(u_sent);
-            if(!positionControl->positionMove(u_sent.data()))
+            if(!positionControl->positionMove(u_sent))
                 std::cout<<"Cannot move "<< kinematic_chain <<" using Position Ctrl"<<std::endl;
             break;
         case VOCAB_CM_TORQUE:
-            if(!torqueControl->setRefTorques(u_sent.data()))
+            if(!torqueControl->setRefTorques(u_sent))
                 std::cout<<"Cannot move "<< kinematic_chain <<" using Torque Ctrl"<<std::endl;
             break;
         case VOCAB_CM_VELOCITY:
-            if(!velocityControl->velocityMove(u_sent.data()))
+            if(!velocityControl->velocityMove(u_sent))
                 std::cout<<"Cannot move "<< kinematic_chain <<" using Velocity Ctrl"<<std::endl;
             break;
         /*case VOCAB_CM_MIXED:
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
+#include <idynutils/capsule_fitting.h>
+#include <idynutils/collision_geometry_cache.h>
 #include <idynutils/collision_utils.h>
+#include <idynutils/convex_hull.h>
 #include <idynutils/idynutils.h>
 #include <idynutils/tests_utils.h>
 #include <iCub/iDynTree/yarp_kdl.h>
@@ -7,7 +10,12 @@
 #include <yarp/math/SVD.h>
 #include <yarp/sig/Vector.h>
 #include <yarp/os/all.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
 #include <fcl/distance.h>
 #include <fcl/shape/geometric_shapes.h>
 
@@ -57,6 +65,47 @@ yarp::sig::Vector getGoodInitialPosition(iDynUtils& idynutils) {
     return q;
 }
 
+/**
+ * @brief writeCubesSTL writes an ASCII STL of two cubes along the x-axis, so that the mesh is not convex
+ * @param path the STL path
+ * @param half_size the half size of the cubes
+ * @param offset the distance of the cubes centers from the origin
+ */
+void writeCubesSTL(const std::string& path, const double half_size, const double offset)
+{
+    std::ofstream stl(path.c_str());
+    stl << "solid cubes" << std::endl;
+    for(int cube = -1; cube <= 1; cube += 2)
+    {
+        KDL::Vector center(cube*offset, 0.0, 0.0);
+        // two counterclockwise triangles for each face, seen from outside
+        for(unsigned int axis = 0; axis < 3; ++axis)
+            for(int sign = -1; sign <= 1; sign += 2)
+            {
+                KDL::Vector normal, u, v;
+                normal[axis] = sign;
+                u[(axis + 1) % 3] = half_size;
+                v[(axis + 2) % 3] = half_size;
+                if(sign < 0)
+                    std::swap(u, v);
+                KDL::Vector face_center = center + normal*half_size;
+                KDL::Vector corners[4] = { face_center - u - v, face_center + u - v,
+                                           face_center + u + v, face_center - u + v };
+                for(unsigned int t = 1; t < 3; ++t)
+                {
+                    stl << "facet normal " << normal.x() << " " << normal.y() << " " << normal.z() << std::endl;
+                    stl << "outer loop" << std::endl;
+                    stl << "vertex " << corners[0].x() << " " << corners[0].y() << " " << corners[0].z() << std::endl;
+                    stl << "vertex " << corners[t].x() << " " << corners[t].y() << " " << corners[t].z() << std::endl;
+                    stl << "vertex " << corners[t+1].x() << " " << corners[t+1].y() << " " << corners[t+1].z() << std::endl;
+                    stl << "endloop" << std::endl;
+                    stl << "endfacet" << std::endl;
+                }
+            }
+    }
+    stl << "endsolid cubes" << std::endl;
+}
+
 double dist3D_Segment_to_Segment (const Eigen::Vector3d & segment_A_endpoint_1,
                                   const Eigen::Vector3d & segment_A_endpoint_2,
                                   const Eigen::Vector3d & segment_B_endpoint_1,
@@ -390,6 +439,13 @@ TEST_F(testCollisionUtils, checkTimings)
     q = getGoodInitialPosition(robot);
     robot.updateiDyn3Model(q, false);
 
+    // construction reuses the models parsed by iDynUtils and the collision geometry cache
+    double constructor_tic = yarp::os::SystemClock::nowSystem();
+    {
+        ComputeLinksDistance compute_distance_benchmark(robot);
+    }
+    std::cout << "ComputeLinksDistance constructor t: " << yarp::os::SystemClock::nowSystem() - constructor_tic << std::endl;
+
     std::string linkA = "LSoftHandLink";
     std::string linkB = "RSoftHandLink";
 
@@ -425,6 +481,20 @@ TEST_F(testCollisionUtils, checkTimings)
     tic = yarp::os::SystemClock::nowSystem();
     compute_distance.getLinkDistances(0.05);
     std::cout << "getLinkDistances(0.05) t: " << yarp::os::SystemClock::nowSystem() - tic << std::endl;
+    std::cout << "broad phase culled " << compute_distance.getNrOfCulledPairs() << " pairs ("
+              << 100.0*compute_distance.getCullingRatio() << "%)" << std::endl;
+
+    compute_distance.setBroadPhase(false);
+    tic = yarp::os::SystemClock::nowSystem();
+    compute_distance.getLinkDistances(0.05);
+    std::cout << "getLinkDistances(0.05) without broad phase t: " << yarp::os::SystemClock::nowSystem() - tic << std::endl;
+    compute_distance.setBroadPhase(true);
+
+    compute_distance.setNumberOfThreads(8);
+    tic = yarp::os::SystemClock::nowSystem();
+    compute_distance.getLinkDistances();
+    std::cout << "getLinkDistances() with 8 threads t: " << yarp::os::SystemClock::nowSystem() - tic << std::endl;
+    compute_distance.setNumberOfThreads(1);
 
     {
         tic = yarp::os::SystemClock::nowSystem();
@@ -496,6 +566,916 @@ TEST_F(testCollisionUtils, checkTimings)
                                                     lefthand_CP,
                                                     righthand_CP);
     std::cout << "inline capsule-capsule t: " << yarp::os::SystemClock::nowSystem() - tic << std::endl;
+
+    tic = yarp::os::SystemClock::nowSystem();
+    KDL::Vector lefthand_CP_kdl, righthand_CP_kdl;
+    ComputeLinksDistance::capsuleCapsuleDistance(lefthand_capsule_ep1, lefthand_capsule_ep2, capsuleA->getRadius(),
+                                                 righthand_capsule_ep1, righthand_capsule_ep2, capsuleB->getRadius(),
+                                                 lefthand_CP_kdl, righthand_CP_kdl);
+    std::cout << "analytic kernel capsule-capsule t: " << yarp::os::SystemClock::nowSystem() - tic << std::endl;
+
+    compute_distance.setAnalyticKernels(false);
+    tic = yarp::os::SystemClock::nowSystem();
+    compute_distance.getLinkDistances();
+    std::cout << "getLinkDistances() without analytic kernels t: " << yarp::os::SystemClock::nowSystem() - tic << std::endl;
+    compute_distance.setAnalyticKernels(true);
+}
+
+TEST_F(testCollisionUtils, testAnalyticKernelsMatchFCL)
+{
+    EXPECT_TRUE(compute_distance.getAnalyticKernels());
+
+    for(unsigned int n = 0; n < 10; ++n)
+    {
+        q = getGoodInitialPosition(robot);
+        for(unsigned int i = 0; i < robot.left_arm.getNrOfDOFs(); ++i)
+        {
+            q[robot.left_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+            q[robot.right_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+        }
+        robot.updateiDyn3Model(q, false);
+
+        compute_distance.setAnalyticKernels(true);
+        std::list<LinkPairDistance> analytic_results = compute_distance.getLinkDistances();
+        compute_distance.setAnalyticKernels(false);
+        std::list<LinkPairDistance> fcl_results = compute_distance.getLinkDistances();
+        compute_distance.setAnalyticKernels(true);
+
+        ASSERT_EQ(analytic_results.size(), fcl_results.size());
+
+        std::map<LinkPairDistance::LinksPair, LinkPairDistance> fcl_results_map;
+        for(std::list<LinkPairDistance>::iterator it = fcl_results.begin(); it != fcl_results.end(); ++it)
+            fcl_results_map.insert(std::make_pair(it->getLinkNames(), *it));
+
+        TestCapsuleLinksDistance compute_distance_observer(compute_distance);
+        std::map<std::string,boost::shared_ptr<fcl::CollisionObject> > collision_objects =
+            compute_distance_observer.getcollision_objects();
+
+        for(std::list<LinkPairDistance>::iterator it = analytic_results.begin(); it != analytic_results.end(); ++it)
+        {
+            const LinkPairDistance::LinksPair& links = it->getLinkNames();
+            // only capsule-capsule pairs are computed by both, and FCL does not give distances when in collision
+            if(collision_objects[links.first]->getNodeType() != fcl::GEOM_CAPSULE ||
+               collision_objects[links.second]->getNodeType() != fcl::GEOM_CAPSULE ||
+               it->getDistance() <= 0.0)
+                continue;
+
+            ASSERT_EQ(fcl_results_map.count(links), 1);
+            const LinkPairDistance& fcl_result = fcl_results_map.find(links)->second;
+            EXPECT_NEAR(it->getDistance(), fcl_result.getDistance(), 1E-6)
+                << links.first << " - " << links.second;
+
+            // the closest points are consistent with the distance
+            KDL::Frame w_T_A = robot.iDyn3_model.getPositionKDL(robot.iDyn3_model.getLinkIndex(links.first));
+            KDL::Frame w_T_B = robot.iDyn3_model.getPositionKDL(robot.iDyn3_model.getLinkIndex(links.second));
+            double points_distance = ((w_T_A * it->getLink_T_closestPoint().first).p -
+                                      (w_T_B * it->getLink_T_closestPoint().second).p).Norm();
+            EXPECT_NEAR(it->getDistance(), points_distance, 1E-8);
+        }
+    }
+}
+
+TEST_F(testCollisionUtils, testSphereKernelsMatchFCL)
+{
+    fcl::DistanceRequest distance_request;
+#if FCL_MINOR_VERSION > 2
+    distance_request.gjk_solver_type = fcl::GST_INDEP;
+#endif
+    distance_request.enable_nearest_points = true;
+
+    for(unsigned int n = 0; n < 100; ++n)
+    {
+        KDL::Vector centerA(tests_utils::getRandomAngle(-1.0, 1.0),
+                            tests_utils::getRandomAngle(-1.0, 1.0),
+                            tests_utils::getRandomAngle(-1.0, 1.0));
+        KDL::Vector centerB(tests_utils::getRandomAngle(-1.0, 1.0),
+                            tests_utils::getRandomAngle(-1.0, 1.0),
+                            tests_utils::getRandomAngle(-1.0, 1.0));
+        KDL::Rotation rotationA = KDL::Rotation::RPY(tests_utils::getRandomAngle(),
+                                                     tests_utils::getRandomAngle(),
+                                                     tests_utils::getRandomAngle());
+        double radiusA = tests_utils::getRandomAngle(0.01, 0.1);
+        double radiusB = tests_utils::getRandomAngle(0.01, 0.1);
+        double lengthA = tests_utils::getRandomAngle(0.05, 0.5);
+
+        boost::shared_ptr<fcl::CollisionGeometry> sphereA(new fcl::Sphere(radiusA));
+        boost::shared_ptr<fcl::CollisionGeometry> sphereB(new fcl::Sphere(radiusB));
+        boost::shared_ptr<fcl::CollisionGeometry> capsuleA(new fcl::Capsule(radiusA, lengthA));
+        fcl::CollisionObject sphereA_object(sphereA, fcl::Transform3f(fcl::Vec3f(centerA.x(), centerA.y(), centerA.z())));
+        fcl::CollisionObject sphereB_object(sphereB, fcl::Transform3f(fcl::Vec3f(centerB.x(), centerB.y(), centerB.z())));
+        double x,y,z,w;
+        rotationA.GetQuaternion(x,y,z,w);
+        // fcl capsules are centered in their reference frame
+        fcl::CollisionObject capsuleA_object(capsuleA, fcl::Transform3f(fcl::Quaternion3f(w,x,y,z),
+                                                                        fcl::Vec3f(centerA.x(), centerA.y(), centerA.z())));
+        KDL::Vector endPointA1 = centerA - 0.5*lengthA*rotationA.UnitZ();
+        KDL::Vector endPointA2 = centerA + 0.5*lengthA*rotationA.UnitZ();
+
+        KDL::Vector pA, pB;
+        double sphere_sphere = ComputeLinksDistance::sphereSphereDistance(centerA, radiusA, centerB, radiusB, pA, pB);
+        EXPECT_NEAR(sphere_sphere, (pA - pB).Norm() * (sphere_sphere < 0.0 ? -1.0 : 1.0), 1E-10);
+        double capsule_sphere = ComputeLinksDistance::capsuleSphereDistance(endPointA1, endPointA2, radiusA,
+                                                                            centerB, radiusB, pA, pB);
+        EXPECT_NEAR(capsule_sphere, (pA - pB).Norm() * (capsule_sphere < 0.0 ? -1.0 : 1.0), 1E-10);
+
+        if(sphere_sphere > 0.0)
+        {
+            fcl::DistanceResult distance_result;
+            fcl::distance(&sphereA_object, &sphereB_object, distance_request, distance_result);
+            EXPECT_NEAR(sphere_sphere, distance_result.min_distance, 1E-5);
+        }
+
+        if(capsule_sphere > 0.0)
+        {
+            fcl::DistanceResult distance_result;
+            fcl::distance(&capsuleA_object, &sphereB_object, distance_request, distance_result);
+            EXPECT_NEAR(capsule_sphere, distance_result.min_distance, 1E-5);
+        }
+    }
+}
+
+TEST_F(testCollisionUtils, testMixedPairsAnalyticKernelsMatchFCL)
+{
+    // a model where every other capsule of bigman_capsules is replaced by a sphere
+    const std::string robots_dir = std::string(IDYNUTILS_TESTS_ROBOTS_DIR) + "bigman/";
+    const std::string urdf_path = robots_dir + "bigman_spheres.urdf";
+    const std::string srdf_path = robots_dir + "bigman_spheres.srdf";
+    {
+        std::ifstream capsules_urdf((robots_dir + "bigman_capsules.urdf").c_str());
+        std::string urdf_content((std::istreambuf_iterator<char>(capsules_urdf)),
+                                 std::istreambuf_iterator<char>());
+        std::string::size_type cylinder = urdf_content.find("<cylinder");
+        for(unsigned int n = 0; cylinder != std::string::npos; ++n)
+        {
+            std::string::size_type end = urdf_content.find("/>", cylinder);
+            std::string::size_type length = urdf_content.find(" length=", cylinder);
+            if(n % 2 == 0 && length < end)
+            {
+                urdf_content.replace(length, end - length, " ");
+                urdf_content.replace(cylinder, std::string("<cylinder").size(), "<sphere");
+            }
+            cylinder = urdf_content.find("<cylinder", cylinder + 1);
+        }
+        std::ofstream spheres_urdf(urdf_path.c_str());
+        spheres_urdf << urdf_content;
+
+        std::ifstream srdf((robots_dir + "bigman.srdf").c_str());
+        std::ofstream spheres_srdf(srdf_path.c_str());
+        spheres_srdf << srdf.rdbuf();
+    }
+
+    {
+        iDynUtils spheres_robot("bigman", urdf_path, srdf_path);
+        ComputeLinksDistance spheres_distance(spheres_robot);
+
+        TestCapsuleLinksDistance compute_distance_observer(spheres_distance);
+        std::map<std::string,boost::shared_ptr<fcl::CollisionObject> > collision_objects =
+            compute_distance_observer.getcollision_objects();
+
+        unsigned int mixed_pairs = 0;
+        for(unsigned int n = 0; n < 10; ++n)
+        {
+            yarp::sig::Vector q = getGoodInitialPosition(spheres_robot);
+            for(unsigned int i = 0; i < spheres_robot.left_arm.getNrOfDOFs(); ++i)
+            {
+                q[spheres_robot.left_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+                q[spheres_robot.right_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+            }
+            spheres_robot.updateiDyn3Model(q, false);
+
+            spheres_distance.setAnalyticKernels(true);
+            std::list<LinkPairDistance> analytic_results = spheres_distance.getLinkDistances();
+            spheres_distance.setAnalyticKernels(false);
+            std::list<LinkPairDistance> fcl_results = spheres_distance.getLinkDistances();
+
+            ASSERT_EQ(analytic_results.size(), fcl_results.size());
+
+            std::map<LinkPairDistance::LinksPair, double> fcl_distances;
+            for(std::list<LinkPairDistance>::iterator it = fcl_results.begin(); it != fcl_results.end(); ++it)
+                fcl_distances[it->getLinkNames()] = it->getDistance();
+
+            for(std::list<LinkPairDistance>::iterator it = analytic_results.begin(); it != analytic_results.end(); ++it)
+            {
+                const LinkPairDistance::LinksPair& links = it->getLinkNames();
+                const fcl::NODE_TYPE typeA = collision_objects[links.first]->getNodeType();
+                const fcl::NODE_TYPE typeB = collision_objects[links.second]->getNodeType();
+                // FCL does not give distances when in collision
+                if(it->getDistance() <= 0.0 || (typeA != fcl::GEOM_SPHERE && typeB != fcl::GEOM_SPHERE))
+                    continue;
+
+                ++mixed_pairs;
+                ASSERT_EQ(fcl_distances.count(links), 1);
+                EXPECT_NEAR(it->getDistance(), fcl_distances[links], 1E-5)
+                    << links.first << " - " << links.second;
+            }
+        }
+        EXPECT_GT(mixed_pairs, 0u);
+    }
+
+    std::remove(urdf_path.c_str());
+    std::remove(srdf_path.c_str());
+    std::remove(CollisionGeometryCache::getCachePath(urdf_path).c_str());
+}
+
+TEST_F(testCollisionUtils, testCapsuleBatch)
+{
+    CapsuleBatch batch;
+    std::vector<KDL::Vector> endPoints1, endPoints2;
+    std::vector<double> radii;
+    // an odd number of capsules, so that the pairs are not a multiple of the SIMD width
+    for(unsigned int i = 0; i < 7; ++i)
+    {
+        KDL::Vector ep1(tests_utils::getRandomAngle(-1.0, 1.0),
+                        tests_utils::getRandomAngle(-1.0, 1.0),
+                        tests_utils::getRandomAngle(-1.0, 1.0));
+        KDL::Vector ep2 = ep1 + KDL::Vector(tests_utils::getRandomAngle(-0.3, 0.3),
+                                            tests_utils::getRandomAngle(-0.3, 0.3),
+                                            tests_utils::getRandomAngle(-0.3, 0.3));
+        // degenerate capsule (a sphere)
+        if(i == 3) ep2 = ep1;
+        radii.push_back(tests_utils::getRandomAngle(0.01, 0.1));
+        endPoints1.push_back(ep1);
+        endPoints2.push_back(ep2);
+        EXPECT_EQ(batch.addCapsule(radii.back()), i);
+        batch.setEndPoints(i, ep1, ep2);
+    }
+    EXPECT_EQ(batch.getNrOfCapsules(), 7);
+
+    for(unsigned int a = 0; a < 7; ++a)
+        for(unsigned int b = a+1; b < 7; ++b)
+            batch.addPair(a, b);
+    EXPECT_EQ(batch.getNrOfPairs(), 21);
+
+    batch.computeDistancesScalar();
+    std::vector<double> scalar_distances;
+    for(unsigned int i = 0; i < batch.getNrOfPairs(); ++i)
+        scalar_distances.push_back(batch.getDistance(i));
+
+    batch.computeDistances();
+    unsigned int pair = 0;
+    for(unsigned int a = 0; a < 7; ++a)
+    {
+        for(unsigned int b = a+1; b < 7; ++b, ++pair)
+        {
+            KDL::Vector pA, pB, batch_pA, batch_pB;
+            double reference = ComputeLinksDistance::capsuleCapsuleDistance(endPoints1[a], endPoints2[a], radii[a],
+                                                                            endPoints1[b], endPoints2[b], radii[b],
+                                                                            pA, pB);
+            batch.getClosestPoints(pair, batch_pA, batch_pB);
+
+            EXPECT_NEAR(batch.getDistance(pair), scalar_distances[pair], 1E-12);
+            EXPECT_NEAR(batch.getDistance(pair), reference, 1E-10);
+
+            // the shared scalar segment-segment kernel against an independent implementation
+            Eigen::Vector3d A1, A2, B1, B2, cA, cB;
+            vectorKDLToEigen(endPoints1[a], A1);
+            vectorKDLToEigen(endPoints2[a], A2);
+            vectorKDLToEigen(endPoints1[b], B1);
+            vectorKDLToEigen(endPoints2[b], B2);
+            KDL::Vector segment_pA, segment_pB;
+            EXPECT_NEAR(CapsuleBatch::segmentsDistance(endPoints1[a], endPoints2[a], endPoints1[b], endPoints2[b],
+                                                       segment_pA, segment_pB),
+                        dist3D_Segment_to_Segment(A1, A2, B1, B2, cA, cB), 1E-9);
+            EXPECT_NEAR(reference, (segment_pA - segment_pB).Norm() - radii[a] - radii[b], 1E-10);
+            EXPECT_NEAR(batch.getDistance(pair),
+                        (batch_pA - batch_pB).Norm() * (batch.getDistance(pair) < 0.0 ? -1.0 : 1.0), 1E-10);
+        }
+    }
+
+    batch.clearPairs();
+    EXPECT_EQ(batch.getNrOfPairs(), 0);
+    EXPECT_EQ(batch.getNrOfCapsules(), 7);
+}
+
+TEST_F(testCollisionUtils, testCapsuleFitting)
+{
+    for(unsigned int n = 0; n < 5; ++n)
+    {
+        // points on the surface of a random capsule
+        KDL::Vector ep1(tests_utils::getRandomAngle(-1.0, 1.0),
+                        tests_utils::getRandomAngle(-1.0, 1.0),
+                        tests_utils::getRandomAngle(-1.0, 1.0));
+        KDL::Vector ep2 = ep1 + KDL::Vector(tests_utils::getRandomAngle(-0.3, 0.3),
+                                            tests_utils::getRandomAngle(-0.3, 0.3),
+                                            tests_utils::getRandomAngle(-0.3, 0.3));
+        CapsuleFitting::Capsule capsule(ep1, ep2, tests_utils::getRandomAngle(0.01, 0.1));
+
+        std::vector<KDL::Vector> points;
+        for(unsigned int i = 0; i < 2000; ++i)
+        {
+            KDL::Vector direction(tests_utils::getRandomAngle(-1.0, 1.0),
+                                  tests_utils::getRandomAngle(-1.0, 1.0),
+                                  tests_utils::getRandomAngle(-1.0, 1.0));
+            direction.Normalize();
+            const double t = tests_utils::getRandomAngle(-0.1, 1.1);
+            KDL::Vector axis_point = ep1 + std::min(std::max(t, 0.0), 1.0)*(ep2 - ep1);
+            points.push_back(axis_point + capsule.radius*direction);
+        }
+
+        CapsuleFitting::Capsule fitted_capsule;
+        ASSERT_TRUE(CapsuleFitting::fitCapsule(points, fitted_capsule));
+        for(unsigned int i = 0; i < points.size(); ++i)
+            EXPECT_TRUE(fitted_capsule.contains(points[i]));
+        EXPECT_LT(fitted_capsule.getVolume(), 1.05*capsule.getVolume());
+
+        // the URDF cylinder origin is in the middle of the axis, with z-axis along the axis
+        KDL::Frame origin = fitted_capsule.getOrigin();
+        KDL::Vector half_axis = fitted_capsule.getLength()/2.0 * origin.M.UnitZ();
+        EXPECT_TRUE(KDL::Equal(origin.p - half_axis, fitted_capsule.endPoint1, 1E-9) ||
+                    KDL::Equal(origin.p - half_axis, fitted_capsule.endPoint2, 1E-9));
+    }
+
+    // a long box is fitted along its longest side
+    std::vector<KDL::Vector> corners;
+    for(unsigned int i = 0; i < 8; ++i)
+        corners.push_back(KDL::Vector(i & 1 ? 0.05 : -0.05, i & 2 ? 0.05 : -0.05, i & 4 ? 0.5 : -0.5));
+    CapsuleFitting::Capsule box_capsule;
+    ASSERT_TRUE(CapsuleFitting::fitCapsule(corners, box_capsule));
+    KDL::Vector box_axis = box_capsule.endPoint2 - box_capsule.endPoint1;
+    box_axis.Normalize();
+    EXPECT_NEAR(std::fabs(box_axis.z()), 1.0, 1E-3);
+    for(unsigned int i = 0; i < corners.size(); ++i)
+        EXPECT_TRUE(box_capsule.contains(corners[i]));
+
+    EXPECT_EQ(CapsuleFitting::getCapsuleModelPath("/robots/bigman/bigman.urdf"),
+              "/robots/bigman/bigman_capsules.urdf");
+    EXPECT_EQ(CapsuleFitting::getCapsuleModelPath("/robots/bigman/bigman.srdf"),
+              "/robots/bigman/bigman_capsules.srdf");
+}
+
+TEST_F(testCollisionUtils, testConvexHull3D)
+{
+    // the corners of a box, plus points inside it
+    std::vector<KDL::Vector> points;
+    for(unsigned int i = 0; i < 8; ++i)
+        points.push_back(KDL::Vector(i & 1 ? 0.1 : -0.1, i & 2 ? 0.2 : -0.2, i & 4 ? 0.3 : -0.3));
+    for(unsigned int i = 0; i < 100; ++i)
+        points.push_back(KDL::Vector(tests_utils::getRandomAngle(-0.09, 0.09),
+                                     tests_utils::getRandomAngle(-0.19, 0.19),
+                                     tests_utils::getRandomAngle(-0.29, 0.29)));
+
+    idynutils::convex_hull huller;
+    std::vector<KDL::Vector> vertices;
+    std::vector<unsigned int> triangles;
+    ASSERT_TRUE(huller.getConvexHull3D(points, vertices, triangles));
+    EXPECT_EQ(vertices.size(), 8u);
+    EXPECT_EQ(triangles.size(), 12u*3u);
+
+    // all points are inside every face
+    for(unsigned int i = 0; i + 2 < triangles.size(); i += 3)
+    {
+        KDL::Vector normal = (vertices[triangles[i+1]] - vertices[triangles[i]]) *
+                             (vertices[triangles[i+2]] - vertices[triangles[i]]);
+        normal.Normalize();
+        for(unsigned int j = 0; j < points.size(); ++j)
+            EXPECT_LE(KDL::dot(normal, points[j] - vertices[triangles[i]]), 1E-6);
+    }
+}
+
+TEST_F(testCollisionUtils, testConvexHulls)
+{
+    // a model where every other capsule of bigman_capsules is replaced by a mesh of two cubes
+    const std::string robots_dir = std::string(IDYNUTILS_TESTS_ROBOTS_DIR) + "bigman/";
+    const std::string urdf_path = robots_dir + "bigman_meshes.urdf";
+    const std::string srdf_path = robots_dir + "bigman_meshes.srdf";
+    const std::string stl_path = robots_dir + "bigman_meshes_cubes.stl";
+    writeCubesSTL(stl_path, 0.01, 0.03);
+    {
+        std::ifstream capsules_urdf((robots_dir + "bigman_capsules.urdf").c_str());
+        std::string urdf_content((std::istreambuf_iterator<char>(capsules_urdf)),
+                                 std::istreambuf_iterator<char>());
+        std::string::size_type cylinder = urdf_content.find("<cylinder");
+        for(unsigned int n = 0; cylinder != std::string::npos; ++n)
+        {
+            std::string::size_type end = urdf_content.find("/>", cylinder);
+            if(n % 2 == 0)
+                urdf_content.replace(cylinder, end - cylinder,
+                                     "<mesh filename=\"file://" + stl_path + "\"");
+            cylinder = urdf_content.find("<cylinder", cylinder + 1);
+        }
+        std::ofstream meshes_urdf(urdf_path.c_str());
+        meshes_urdf << urdf_content;
+
+        std::ifstream srdf((robots_dir + "bigman.srdf").c_str());
+        std::ofstream meshes_srdf(srdf_path.c_str());
+        meshes_srdf << srdf.rdbuf();
+    }
+
+    // the second time the cubes are bigger, so a stale hull would be farther than the mesh
+    for(unsigned int n = 0; n < 2; ++n)
+    {
+        if(n == 1)
+            writeCubesSTL(stl_path, 0.02, 0.05);
+
+        iDynUtils meshes_robot("bigman", urdf_path, srdf_path);
+        ComputeLinksDistance mesh_distance(meshes_robot);
+        ComputeLinksDistance hull_distance(meshes_robot, true, true);
+        // the second time hulls are loaded from the cache
+        ComputeLinksDistance cached_hull_distance(meshes_robot, true);
+        EXPECT_TRUE(mesh_distance.getConvexHullsReport().empty());
+        EXPECT_TRUE(cached_hull_distance.getConvexHullsReport().empty());
+
+        // probes near the faces between the cubes are closer to the hull than to the mesh
+        const std::vector<ComputeLinksDistance::ConvexHullReport>& report = hull_distance.getConvexHullsReport();
+        ASSERT_FALSE(report.empty());
+        for(unsigned int i = 0; i < report.size(); ++i)
+        {
+            EXPECT_EQ(report[i].meshTriangles, 24u);
+            EXPECT_GT(report[i].hullTriangles, 0u);
+            EXPECT_LE(report[i].hullVertices, report[i].meshVertices);
+            EXPECT_GE(report[i].meanDistanceError, -1E-6);
+            EXPECT_GT(report[i].maxDistanceError, 0.005);
+        }
+
+        TestCapsuleLinksDistance mesh_distance_observer(mesh_distance);
+        std::map<std::string,boost::shared_ptr<fcl::CollisionObject> > collision_objects =
+            mesh_distance_observer.getcollision_objects();
+
+        unsigned int mesh_pairs = 0;
+        yarp::sig::Vector q = getGoodInitialPosition(meshes_robot);
+        for(unsigned int i = 0; i < meshes_robot.left_arm.getNrOfDOFs(); ++i)
+        {
+            q[meshes_robot.left_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+            q[meshes_robot.right_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+        }
+        meshes_robot.updateiDyn3Model(q, false);
+
+        std::list<LinkPairDistance> mesh_results = mesh_distance.getLinkDistances();
+        std::list<LinkPairDistance> hull_results = hull_distance.getLinkDistances();
+        std::list<LinkPairDistance> cached_hull_results = cached_hull_distance.getLinkDistances();
+        ASSERT_EQ(hull_results.size(), mesh_results.size());
+        ASSERT_EQ(cached_hull_results.size(), mesh_results.size());
+
+        std::map<LinkPairDistance::LinksPair, double> mesh_distances, cached_hull_distances;
+        for(std::list<LinkPairDistance>::iterator it = mesh_results.begin(); it != mesh_results.end(); ++it)
+            mesh_distances[it->getLinkNames()] = it->getDistance();
+        for(std::list<LinkPairDistance>::iterator it = cached_hull_results.begin(); it != cached_hull_results.end(); ++it)
+            cached_hull_distances[it->getLinkNames()] = it->getDistance();
+
+        for(std::list<LinkPairDistance>::iterator it = hull_results.begin(); it != hull_results.end(); ++it)
+        {
+            const LinkPairDistance::LinksPair& links = it->getLinkNames();
+            ASSERT_EQ(mesh_distances.count(links), 1);
+            ASSERT_EQ(cached_hull_distances.count(links), 1);
+            EXPECT_NEAR(cached_hull_distances[links], it->getDistance(), 1E-9);
+
+            // FCL does not give distances when in collision
+            if(it->getDistance() <= 0.0 || mesh_distances[links] <= 0.0 ||
+               (collision_objects[links.first]->getNodeType() != fcl::BV_OBBRSS &&
+                collision_objects[links.second]->getNodeType() != fcl::BV_OBBRSS))
+                continue;
+
+            // the hull contains the mesh
+            ++mesh_pairs;
+            EXPECT_LE(it->getDistance(), mesh_distances[links] + 1E-5)
+                << links.first << " - " << links.second;
+        }
+        EXPECT_GT(mesh_pairs, 0u);
+    }
+
+    std::remove(urdf_path.c_str());
+    std::remove(srdf_path.c_str());
+    std::remove(stl_path.c_str());
+    std::remove(CollisionGeometryCache::getCachePath(urdf_path).c_str());
+    boost::filesystem::remove_all(robots_dir + "bigman_meshes_convex_hulls");
+}
+
+TEST_F(testCollisionUtils, testCollisionGeometryCache)
+{
+    std::vector<fcl::Vec3f> vertices;
+    vertices.push_back(fcl::Vec3f(0.0, 0.0, 0.0));
+    vertices.push_back(fcl::Vec3f(0.1, 0.0, 0.0));
+    vertices.push_back(fcl::Vec3f(0.0, 0.2, 0.0));
+    vertices.push_back(fcl::Vec3f(0.0, 0.0, 0.3));
+    std::vector<fcl::Triangle> triangles;
+    triangles.push_back(fcl::Triangle(0, 2, 1));
+    triangles.push_back(fcl::Triangle(0, 1, 3));
+    triangles.push_back(fcl::Triangle(0, 3, 2));
+    triangles.push_back(fcl::Triangle(1, 2, 3));
+    KDL::Frame link_T_shape(KDL::Rotation::RPY(0.1, 0.2, 0.3), KDL::Vector(0.01, 0.02, 0.03));
+
+    std::string cache_path = std::string(IDYNUTILS_TESTS_ROBOTS_DIR) + "test_collision_geometry.cache";
+    {
+        CollisionGeometryCache cache;
+        cache.addMesh("mesh_link", link_T_shape, vertices, triangles);
+        EXPECT_EQ(cache.getNrOfAddedMeshes(), 1u);
+        ASSERT_TRUE(cache.save(cache_path, 42));
+    }
+
+    CollisionGeometryCache cache;
+    EXPECT_FALSE(cache.load(cache_path, 43));
+    ASSERT_TRUE(cache.load(cache_path, 42));
+
+    CollisionGeometryCache::Mesh mesh;
+    EXPECT_FALSE(cache.getMesh("another_link", mesh));
+    ASSERT_TRUE(cache.getMesh("mesh_link", mesh));
+    EXPECT_TRUE(KDL::Equal(mesh.link_T_shape, link_T_shape, 1E-12));
+    ASSERT_EQ(mesh.numberOfVertices, vertices.size());
+    ASSERT_EQ(mesh.numberOfTriangles, triangles.size());
+    for(unsigned int i = 0; i < vertices.size(); ++i)
+        for(unsigned int j = 0; j < 3; ++j)
+            EXPECT_EQ(mesh.vertices[3*i + j], vertices[i][j]);
+    for(unsigned int i = 0; i < triangles.size(); ++i)
+        for(unsigned int j = 0; j < 3; ++j)
+            EXPECT_EQ(mesh.triangles[3*i + j], triangles[i][j]);
+
+    // the key changes with the URDF content
+    urdf::Model robot_urdf, capsules_urdf;
+    robot_urdf.initFile(robot.getRobotURDFPath());
+    capsules_urdf.initFile(CapsuleFitting::getCapsuleModelPath(robot.getRobotURDFPath()));
+    uint64_t key = CollisionGeometryCache::computeKey(robot.getRobotURDFPath(), robot_urdf);
+    EXPECT_EQ(key, CollisionGeometryCache::computeKey(robot.getRobotURDFPath(), robot_urdf));
+    EXPECT_NE(key, CollisionGeometryCache::computeKey(CapsuleFitting::getCapsuleModelPath(robot.getRobotURDFPath()),
+                                                      capsules_urdf));
+
+    std::remove(cache_path.c_str());
+}
+
+TEST_F(testCollisionUtils, testBroadPhase)
+{
+    EXPECT_TRUE(compute_distance.getBroadPhase());
+
+    TestCapsuleLinksDistance compute_distance_observer(compute_distance);
+    std::map<std::string,boost::shared_ptr<fcl::CollisionObject> > collision_objects =
+        compute_distance_observer.getcollision_objects();
+    unsigned int gjk_pairs_in_threshold = 0;
+
+    for(unsigned int n = 0; n < 10; ++n)
+    {
+        q = getGoodInitialPosition(robot);
+        for(unsigned int i = 0; i < robot.left_arm.getNrOfDOFs(); ++i)
+        {
+            q[robot.left_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+            q[robot.right_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+        }
+        robot.updateiDyn3Model(q, false);
+
+        // with infinite threshold nothing is culled
+        compute_distance.getLinkDistances();
+        EXPECT_EQ(compute_distance.getNrOfCulledPairs(), 0);
+
+        for(double threshold = 0.01; threshold < 0.5; threshold *= 3.0)
+        {
+            compute_distance.setBroadPhase(true);
+            std::list<LinkPairDistance> culled_results = compute_distance.getLinkDistances(threshold);
+            double culling_ratio = compute_distance.getCullingRatio();
+            compute_distance.setBroadPhase(false);
+            std::list<LinkPairDistance> results = compute_distance.getLinkDistances(threshold);
+            EXPECT_EQ(compute_distance.getNrOfCulledPairs(), 0);
+            compute_distance.setBroadPhase(true);
+
+            EXPECT_GE(culling_ratio, 0.0);
+            EXPECT_LE(culling_ratio, 1.0);
+
+            // culling never removes a pair closer than the threshold
+            ASSERT_EQ(culled_results.size(), results.size()) << "threshold " << threshold;
+            std::map<LinkPairDistance::LinksPair, double> distances;
+            for(std::list<LinkPairDistance>::iterator it = results.begin(); it != results.end(); ++it)
+                distances[it->getLinkNames()] = it->getDistance();
+            for(std::list<LinkPairDistance>::iterator it = culled_results.begin(); it != culled_results.end(); ++it)
+            {
+                ASSERT_EQ(distances.count(it->getLinkNames()), 1);
+                EXPECT_DOUBLE_EQ(distances[it->getLinkNames()], it->getDistance());
+
+                // capsule-box and capsule-mesh pairs go through GJK, with the capsule centered in its frame
+                bool is_capsuleA = collision_objects[it->getLinkNames().first]->getNodeType() == fcl::GEOM_CAPSULE;
+                bool is_capsuleB = collision_objects[it->getLinkNames().second]->getNodeType() == fcl::GEOM_CAPSULE;
+                if(is_capsuleA != is_capsuleB)
+                    ++gjk_pairs_in_threshold;
+            }
+        }
+    }
+    EXPECT_GT(gjk_pairs_in_threshold, 0u);
+}
+
+TEST_F(testCollisionUtils, testDistanceCache)
+{
+    EXPECT_TRUE(compute_distance.getDistanceCache());
+
+    q = getGoodInitialPosition(robot);
+    robot.updateiDyn3Model(q, false);
+    compute_distance.resetDistanceCache();
+    compute_distance.getLinkDistances(0.05);
+    // the cache is empty
+    EXPECT_EQ(compute_distance.getCacheHitRate(), 0.0);
+
+    double hit_rate = 0.0;
+    for(unsigned int n = 0; n < 100; ++n)
+    {
+        // 1 kHz control ticks, small motions
+        for(unsigned int i = 0; i < robot.left_arm.getNrOfDOFs(); ++i)
+        {
+            q[robot.left_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.002, 0.002);
+            q[robot.right_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.002, 0.002);
+        }
+        robot.updateiDyn3Model(q, false);
+
+        std::list<LinkPairDistance> cached_results = compute_distance.getLinkDistances(0.05);
+        hit_rate += compute_distance.getCacheHitRate();
+        EXPECT_GE(compute_distance.getCacheTimeSaved(), 0.0);
+
+        compute_distance.setDistanceCache(false);
+        std::list<LinkPairDistance> results = compute_distance.getLinkDistances(0.05);
+        EXPECT_EQ(compute_distance.getCacheHitRate(), 0.0);
+        compute_distance.setDistanceCache(true);
+
+        // skipping never removes a pair closer than the threshold
+        ASSERT_EQ(cached_results.size(), results.size());
+        std::map<LinkPairDistance::LinksPair, double> distances;
+        for(std::list<LinkPairDistance>::iterator it = results.begin(); it != results.end(); ++it)
+            distances[it->getLinkNames()] = it->getDistance();
+        for(std::list<LinkPairDistance>::iterator it = cached_results.begin(); it != cached_results.end(); ++it)
+        {
+            ASSERT_EQ(distances.count(it->getLinkNames()), 1);
+            EXPECT_DOUBLE_EQ(distances[it->getLinkNames()], it->getDistance());
+        }
+    }
+
+    hit_rate /= 100.0;
+    std::cout << "distance cache average hit rate: " << 100.0*hit_rate << "%" << std::endl;
+    EXPECT_GT(hit_rate, 0.0);
+}
+
+TEST_F(testCollisionUtils, testLinkDistancesBuffer)
+{
+    std::vector<LinkPairDistanceRecord> records(compute_distance.getNrOfPairs());
+
+    for(unsigned int n = 0; n < 10; ++n)
+    {
+        q = getGoodInitialPosition(robot);
+        for(unsigned int i = 0; i < robot.left_arm.getNrOfDOFs(); ++i)
+        {
+            q[robot.left_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+            q[robot.right_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+        }
+        robot.updateiDyn3Model(q, false);
+
+        std::list<LinkPairDistance> results = compute_distance.getLinkDistances(0.1);
+        unsigned int size = compute_distance.getLinkDistances(&records[0], records.size(), 0.1);
+        ASSERT_EQ(size, results.size());
+
+        std::map<LinkPairDistance::LinksPair, LinkPairDistance> results_map;
+        for(std::list<LinkPairDistance>::iterator it = results.begin(); it != results.end(); ++it)
+            results_map.insert(std::make_pair(it->getLinkNames(), *it));
+
+        for(unsigned int i = 0; i < size; ++i)
+        {
+            if(i > 0)
+                EXPECT_LE(records[i-1].distance, records[i].distance);
+
+            const std::string& linkA = compute_distance.getLinkName(records[i].linkA);
+            const std::string& linkB = compute_distance.getLinkName(records[i].linkB);
+            LinkPairDistance::LinksPair links(linkA < linkB ? linkA : linkB,
+                                              linkA < linkB ? linkB : linkA);
+            ASSERT_EQ(results_map.count(links), 1);
+            const LinkPairDistance& result = results_map.find(links)->second;
+            EXPECT_DOUBLE_EQ(records[i].distance, result.getDistance());
+
+            const KDL::Vector& linkA_pA = linkA < linkB ? result.getLink_T_closestPoint().first.p :
+                                                          result.getLink_T_closestPoint().second.p;
+            for(unsigned int j = 0; j < 3; ++j)
+                EXPECT_DOUBLE_EQ(records[i].linkA_closestPoint[j], linkA_pA[j]);
+        }
+
+        // top-k: the k closest pairs are returned
+        const unsigned int k = 3;
+        unsigned int top_size = compute_distance.getLinkDistances(&records[0], k, 0.1);
+        EXPECT_EQ(top_size, std::min<unsigned int>(k, results.size()));
+        std::vector<double> distances;
+        for(std::list<LinkPairDistance>::iterator it = results.begin(); it != results.end(); ++it)
+            distances.push_back(it->getDistance());
+        std::sort(distances.begin(), distances.end());
+        for(unsigned int i = 0; i < top_size; ++i)
+            EXPECT_DOUBLE_EQ(records[i].distance, distances[i]);
+    }
+}
+
+TEST_F(testCollisionUtils, testClosestLinkPairs)
+{
+    for(unsigned int n = 0; n < 10; ++n)
+    {
+        q = getGoodInitialPosition(robot);
+        for(unsigned int i = 0; i < robot.left_arm.getNrOfDOFs(); ++i)
+        {
+            q[robot.left_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+            q[robot.right_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+        }
+        robot.updateiDyn3Model(q, false);
+
+        std::list<LinkPairDistance> results = compute_distance.getLinkDistances();
+        std::vector<double> distances;
+        for(std::list<LinkPairDistance>::iterator it = results.begin(); it != results.end(); ++it)
+            distances.push_back(it->getDistance());
+        std::sort(distances.begin(), distances.end());
+
+        const unsigned int k = 10;
+        std::list<LinkPairDistance> closest_pairs = compute_distance.getClosestLinkPairs(k);
+        ASSERT_EQ(closest_pairs.size(), std::min<unsigned int>(k, distances.size()));
+        std::cout << "k closest pairs pruned " << compute_distance.getNrOfCulledPairs()
+                  << " pairs out of " << compute_distance.getNrOfPairs() << std::endl;
+
+        unsigned int i = 0;
+        for(std::list<LinkPairDistance>::iterator it = closest_pairs.begin(); it != closest_pairs.end(); ++it, ++i)
+            EXPECT_NEAR(it->getDistance(), distances[i], 1E-12);
+
+        // with a threshold, only closer pairs are returned
+        closest_pairs = compute_distance.getClosestLinkPairs(k, 0.05);
+        unsigned int closer_pairs = std::lower_bound(distances.begin(), distances.end(), 0.05) - distances.begin();
+        EXPECT_EQ(closest_pairs.size(), std::min(k, closer_pairs));
+        for(std::list<LinkPairDistance>::iterator it = closest_pairs.begin(); it != closest_pairs.end(); ++it)
+            EXPECT_LT(it->getDistance(), 0.05);
+    }
+}
+
+TEST_F(testCollisionUtils, testDistanceJacobians)
+{
+    EXPECT_FALSE(compute_distance.getDistanceJacobians());
+    compute_distance.setDistanceJacobians(true);
+
+    q = getGoodInitialPosition(robot);
+    for(unsigned int i = 0; i < robot.left_arm.getNrOfDOFs(); ++i)
+    {
+        q[robot.left_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+        q[robot.right_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+    }
+    robot.updateiDyn3Model(q, false);
+
+    std::list<LinkPairDistance> results = compute_distance.getLinkDistances(0.2);
+    std::list<LinkPairDistance> closest_pairs = compute_distance.getClosestLinkPairs(5, 0.2);
+    ASSERT_FALSE(closest_pairs.empty());
+    EXPECT_EQ(closest_pairs.front().getDistanceJacobian().cols(), robot.iDyn3_model.getNrOfDOFs());
+
+    // central finite differences of the distance
+    const double h = 1E-6;
+    unsigned int checked_pairs = 0;
+    for(std::list<LinkPairDistance>::iterator it = results.begin(); it != results.end() && checked_pairs < 3; ++it)
+    {
+        if(it->getDistance() < 1E-3)
+            continue;
+        ++checked_pairs;
+
+        const yarp::sig::Matrix& J = it->getDistanceJacobian();
+        ASSERT_EQ(J.rows(), 1);
+        ASSERT_EQ(J.cols(), robot.iDyn3_model.getNrOfDOFs());
+
+        for(unsigned int j = 0; j < q.size(); ++j)
+        {
+            double distances[2];
+            for(unsigned int k = 0; k < 2; ++k)
+            {
+                yarp::sig::Vector q_h(q);
+                q_h[j] += k == 0 ? h : -h;
+                robot.updateiDyn3Model(q_h, false);
+                compute_distance.setDistanceJacobians(false);
+                std::list<LinkPairDistance> results_h = compute_distance.getLinkDistances();
+                compute_distance.setDistanceJacobians(true);
+                distances[k] = std::numeric_limits<double>::quiet_NaN();
+                for(std::list<LinkPairDistance>::iterator it_h = results_h.begin(); it_h != results_h.end(); ++it_h)
+                    if(it_h->getLinkNames() == it->getLinkNames())
+                        distances[k] = it_h->getDistance();
+            }
+            EXPECT_NEAR(J(0,j), (distances[0] - distances[1]) / (2.0*h), 1E-4)
+                << it->getLinkNames().first << " - " << it->getLinkNames().second << ", joint " << j;
+        }
+    }
+
+    robot.updateiDyn3Model(q, false);
+    compute_distance.setDistanceJacobians(false);
+}
+
+TEST_F(testCollisionUtils, testMultithreadedNarrowPhase)
+{
+    ComputeLinksDistance compute_distance_mt(robot);
+    EXPECT_EQ(compute_distance_mt.getNumberOfThreads(), 1u);
+    compute_distance_mt.setNumberOfThreads(4);
+    EXPECT_EQ(compute_distance_mt.getNumberOfThreads(), 4u);
+
+    std::vector<LinkPairDistanceRecord> records(compute_distance.getNrOfPairs());
+    std::vector<LinkPairDistanceRecord> records_mt(compute_distance_mt.getNrOfPairs());
+
+    for(unsigned int n = 0; n < 10; ++n)
+    {
+        q = getGoodInitialPosition(robot);
+        for(unsigned int i = 0; i < robot.left_arm.getNrOfDOFs(); ++i)
+        {
+            q[robot.left_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+            q[robot.right_arm.joint_numbers[i]] += tests_utils::getRandomAngle(-0.3, 0.3);
+        }
+        robot.updateiDyn3Model(q, false);
+
+        // results are the same, in the same order
+        const double thresholds[2] = { 0.1, std::numeric_limits<double>::infinity() };
+        for(unsigned int t = 0; t < 2; ++t)
+        {
+            std::list<LinkPairDistance> results = compute_distance.getLinkDistances(thresholds[t]);
+            std::list<LinkPairDistance> results_mt = compute_distance_mt.getLinkDistances(thresholds[t]);
+            ASSERT_EQ(results.size(), results_mt.size());
+
+            std::list<LinkPairDistance>::iterator it_mt = results_mt.begin();
+            for(std::list<LinkPairDistance>::iterator it = results.begin(); it != results.end(); ++it, ++it_mt)
+            {
+                EXPECT_TRUE(it->getLinkNames() == it_mt->getLinkNames());
+                EXPECT_DOUBLE_EQ(it->getDistance(), it_mt->getDistance());
+                EXPECT_TRUE(KDL::Equal(it->getLink_T_closestPoint().first, it_mt->getLink_T_closestPoint().first, 0.0));
+                EXPECT_TRUE(KDL::Equal(it->getLink_T_closestPoint().second, it_mt->getLink_T_closestPoint().second, 0.0));
+            }
+        }
+
+        unsigned int size = compute_distance.getLinkDistances(&records[0], records.size(), 0.1);
+        unsigned int size_mt = compute_distance_mt.getLinkDistances(&records_mt[0], records_mt.size(), 0.1);
+        ASSERT_EQ(size, size_mt);
+        for(unsigned int i = 0; i < size; ++i)
+        {
+            EXPECT_EQ(records[i].pairId, records_mt[i].pairId);
+            EXPECT_DOUBLE_EQ(records[i].distance, records_mt[i].distance);
+        }
+    }
+
+    compute_distance_mt.setNumberOfThreads(1);
+    EXPECT_EQ(compute_distance_mt.getNumberOfThreads(), 1u);
+}
+
+TEST_F(testCollisionUtils, testContinuousCollision)
+{
+    std::string linkA = "LSoftHandLink";
+    std::string linkB = "RSoftHandLink";
+
+    std::list<std::pair<std::string,std::string> > whiteList;
+    whiteList.push_back(std::pair<std::string,std::string>(linkA,linkB));
+    compute_distance.setCollisionWhiteList(whiteList);
+
+    yarp::sig::Vector q0 = getGoodInitialPosition(robot);
+    robot.updateiDyn3Model(q0, false);
+
+    double time_of_contact;
+    EXPECT_EQ(compute_distance.getMaxContinuousCollisionIterations(), 1000u);
+    EXPECT_FALSE(compute_distance.checkContinuousCollision(q0, q0, time_of_contact));
+    EXPECT_EQ(time_of_contact, -1.0);
+    EXPECT_TRUE(compute_distance.getContinuousCollisionConverged());
+
+    // swing both arms towards each other, so that the hands cross
+    yarp::sig::Vector q1(q0);
+    yarp::sig::Vector arm(robot.left_arm.getNrOfDOFs(), 0.0);
+    robot.fromIDynToRobot(q0, arm, robot.left_arm);
+    arm[0] = -60.0 * M_PI/180.0;
+    arm[1] = -40.0 * M_PI/180.0;
+    robot.fromRobotToIDyn(arm, q1, robot.left_arm);
+    arm[1] = -arm[1];
+    robot.fromRobotToIDyn(arm, q1, robot.right_arm);
+
+    LinkPairDistance::LinksPair colliding_pair;
+    double tic = yarp::os::SystemClock::nowSystem();
+    bool in_contact = compute_distance.checkContinuousCollision(q0, q1, time_of_contact, &colliding_pair);
+    std::cout << "checkContinuousCollision t: " << yarp::os::SystemClock::nowSystem() - tic << std::endl;
+    EXPECT_TRUE(compute_distance.getContinuousCollisionConverged());
+    EXPECT_LT(compute_distance.getContinuousCollisionIterations(),
+              compute_distance.getMaxContinuousCollisionIterations());
+    const unsigned int iterations = compute_distance.getContinuousCollisionIterations();
+
+    // the model state is untouched
+    yarp::sig::Vector q_model = robot.iDyn3_model.getAng();
+    for(unsigned int i = 0; i < q0.size(); ++i)
+        EXPECT_EQ(q_model[i], q0[i]);
+
+    // no sampled configuration before the time of contact is in contact
+    double t_end = in_contact ? time_of_contact : 1.0;
+    yarp::sig::Vector q_t(q0);
+    for(unsigned int n = 0; n < 100; ++n)
+    {
+        double t = t_end * n / 100.0;
+        for(unsigned int i = 0; i < q_t.size(); ++i)
+            q_t[i] = q0[i] + t * (q1[i] - q0[i]);
+        robot.updateiDyn3Model(q_t, false);
+        std::list<LinkPairDistance> results = compute_distance.getLinkDistances();
+        ASSERT_FALSE(results.empty());
+        EXPECT_GT(results.front().getDistance(), 0.0) << "contact at t=" << t;
+    }
+
+    if(in_contact)
+    {
+        EXPECT_GE(time_of_contact, 0.0);
+        EXPECT_LE(time_of_contact, 1.0);
+        EXPECT_TRUE((colliding_pair.first == linkA && colliding_pair.second == linkB) ||
+                    (colliding_pair.first == linkB && colliding_pair.second == linkA));
+
+        // at the time of contact the links are within tolerance
+        for(unsigned int i = 0; i < q_t.size(); ++i)
+            q_t[i] = q0[i] + time_of_contact * (q1[i] - q0[i]);
+        robot.updateiDyn3Model(q_t, false);
+        EXPECT_LE(compute_distance.getLinkDistances().front().getDistance(), 1e-3);
+    }
+
+    // hitting the iteration cap is reported to the caller, with a conservative contact
+    if(iterations > 1)
+    {
+        robot.updateiDyn3Model(q0, false);
+        compute_distance.setMaxContinuousCollisionIterations(1);
+        EXPECT_TRUE(compute_distance.checkContinuousCollision(q0, q1, time_of_contact));
+        EXPECT_FALSE(compute_distance.getContinuousCollisionConverged());
+        EXPECT_EQ(compute_distance.getContinuousCollisionIterations(), 1u);
+        EXPECT_GE(time_of_contact, 0.0);
+        compute_distance.setMaxContinuousCollisionIterations(1000);
+    }
 }
 
 TEST_F(testCollisionUtils, testGlobalToLinkCoordinates)
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <idynutils/idynutils.h>
+#include <idynutils/tests_utils.h>
+#include <yarp/math/Math.h>
+
+#include <cstdlib>
+#include <new>
+
+using namespace yarp::math;
+
+/* global allocation hooks: every call to operator new is counted while
+   count_allocations is true. This file is compiled in its own executable
+   so that the hooks do not interfere with the other tests */
+static bool count_allocations = false;
+static unsigned int number_of_allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    if(count_allocations) ++number_of_allocations;
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* p)
+{
+    std::free(p);
+}
+
+void operator delete[](void* p)
+{
+    std::free(p);
+}
+
+namespace {
+
+class testIDynUtilsAllocations: public ::testing::Test, public iDynUtils
+{
+protected:
+    testIDynUtilsAllocations():
+        iDynUtils("coman",
+                  std::string(IDYNUTILS_TESTS_ROBOTS_DIR)+"coman/coman.urdf",
+                  std::string(IDYNUTILS_TESTS_ROBOTS_DIR) + "coman/coman.srdf"),
+        q(iDyn3_model.getNrOfDOFs(),0.0),
+        dq(iDyn3_model.getNrOfDOFs(),0.0),
+        ddq(iDyn3_model.getNrOfDOFs(),0.0)
+    {
+
+    }
+
+    virtual ~testIDynUtilsAllocations() {
+
+    }
+
+    virtual void SetUp() {
+        number_of_allocations = 0;
+        count_allocations = false;
+    }
+
+    virtual void TearDown() {
+        count_allocations = false;
+    }
+
+    yarp::sig::Vector q;
+    yarp::sig::Vector dq;
+    yarp::sig::Vector ddq;
+};
+
+TEST_F(testIDynUtilsAllocations, testUpdateiDyn3ModelDoesNotAllocate)
+{
+    for(unsigned int i = 0; i < q.size(); ++i) {
+        q[i] = tests_utils::getRandomAngle();
+        dq[i] = 0.1;
+    }
+
+    // the first update initializes the world pose, and is allowed to allocate
+    this->updateiDyn3Model(q, dq, ddq, true);
+
+    count_allocations = true;
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        q[0] += 0.001;
+        this->updateiDyn3Model(q, dq, ddq, true);
+        this->updateiDyn3Model(q, dq, ddq, false);
+        this->updateiDyn3Model(q, true);
+    }
+    count_allocations = false;
+
+    EXPECT_EQ(number_of_allocations, 0u);
+}
+
+TEST_F(testIDynUtilsAllocations, testUpdateiDyn3ModelWithFTTableDoesNotAllocate)
+{
+    std::vector<std::string> ft_frames = getForceTorqueFrameNames();
+    std::vector<int> ft_indices;
+    std::vector<yarp::sig::Vector> ft_wrenches;
+    for(unsigned int i = 0; i < ft_frames.size(); ++i)
+    {
+        ft_indices.push_back(getFTSensorIndex(ft_frames[i]));
+        EXPECT_TRUE(ft_indices.back() >= 0);
+        ft_wrenches.push_back(yarp::sig::Vector(6, 1.0));
+    }
+    EXPECT_EQ(getFTSensorIndex("not_a_link"), -1);
+
+    this->updateiDyn3Model(q, ft_indices, ft_wrenches, true);
+
+    count_allocations = true;
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        q[0] += 0.001;
+        this->updateiDyn3Model(q, ft_indices, ft_wrenches, true);
+    }
+    count_allocations = false;
+
+    EXPECT_EQ(number_of_allocations, 0u);
+}
+
+TEST_F(testIDynUtilsAllocations, testSetWorldPoseDoesNotAllocate)
+{
+    this->updateiDyn3Model(q, true);
+
+    KDL::Frame anchor_T_world;
+    std::string anchor;
+    ASSERT_TRUE(this->getWorldPose(anchor_T_world, anchor));
+
+    count_allocations = true;
+    this->setWorldPose(anchor_T_world, anchor);
+    count_allocations = false;
+
+    EXPECT_EQ(number_of_allocations, 0u);
+}
+
+TEST_F(testIDynUtilsAllocations, testGravityIsUnchanged)
+{
+    for(unsigned int i = 0; i < q.size(); ++i)
+        q[i] = tests_utils::getRandomAngle();
+
+    KDL::Frame anchor_T_world;
+    anchor_T_world.M.DoRotX(0.3);
+    anchor_T_world.M.DoRotY(-0.2);
+    this->updateiDyn3Model(q, true);
+    this->setAnchor_T_World(anchor_T_world);
+    this->updateiDyn3Model(q, true);
+
+    // reference computation, with temporaries
+    yarp::sig::Vector w_g(3, 0.0);
+    w_g[2] = 9.81;
+    yarp::sig::Vector b_g = (worldT * iDyn3_model.getPosition(0,iDyn3_model.getFloatingBaseLink())).submatrix(0,2,0,2).transposed() * w_g;
+
+    for(unsigned int i = 0; i < 3; ++i)
+        EXPECT_NEAR(g[i], b_g[i], 1e-12);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
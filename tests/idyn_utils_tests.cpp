@@ -1,9 +1,11 @@
 #include <gtest/gtest.h>
 #include <idynutils/idynutils.h>
 #include <idynutils/cartesian_utils.h>
+#include <idynutils/incremental_kinematics.h>
 #include <idynutils/tests_utils.h>
 #include <yarp/math/Math.h>
 #include <yarp/math/SVD.h>
+#include <yarp/os/Thread.h>
 #include <yarp/os/Time.h>
 #include <kdl/frames_io.hpp>
 
@@ -579,6 +581,249 @@ TEST_F(testIDynUtils, testUpdateIdyn3ModelFT)
 
 }
 
+TEST_F(testIDynUtils, testUpdateIdyn3ModelStages)
+{
+    iDynUtils full_model("coman",
+                         std::string(IDYNUTILS_TESTS_ROBOTS_DIR)+"coman/coman.urdf",
+                         std::string(IDYNUTILS_TESTS_ROBOTS_DIR) + "coman/coman.srdf");
+
+    yarp::sig::Vector q(this->iDyn3_model.getNrOfDOFs(), 0.0);
+    for(unsigned int i = 0; i < q.size(); ++i)
+        q[i] = tests_utils::getRandomAngle();
+
+    full_model.updateiDyn3Model(q, true);
+    EXPECT_EQ(full_model.getStaleStages(), 0);
+
+    this->updateiDyn3ModelStages(q, UPDATE_POSITIONS, true);
+    EXPECT_EQ(this->getStaleStages(), UPDATE_VELOCITIES | UPDATE_GRAVITY | UPDATE_DYNAMICS);
+
+    int r_wrist = this->iDyn3_model.getLinkIndex("r_wrist");
+    EXPECT_TRUE(this->getPositionKDL(r_wrist) ==
+                full_model.iDyn3_model.getPositionKDL(r_wrist));
+
+    yarp::sig::Vector CoM = this->getCOM();
+    yarp::sig::Vector CoM_full = full_model.iDyn3_model.getCOM();
+    for(unsigned int i = 0; i < 3; ++i)
+        EXPECT_DOUBLE_EQ(CoM[i], CoM_full[i]);
+    EXPECT_EQ(this->getStaleStages(), UPDATE_VELOCITIES | UPDATE_GRAVITY | UPDATE_DYNAMICS);
+
+    // torques are computed lazily
+    yarp::sig::Vector tau = this->getTorques();
+    yarp::sig::Vector tau_full = full_model.iDyn3_model.getTorques();
+    EXPECT_EQ(this->getStaleStages(), 0);
+    for(unsigned int i = 0; i < tau.size(); ++i)
+        EXPECT_DOUBLE_EQ(tau[i], tau_full[i]) << "joint " << i;
+
+    // a world pose change invalidates world poses, gravity and the RNEA stages
+    this->updateWorldPose();
+    EXPECT_EQ(this->getStaleStages(), UPDATE_ALL);
+    this->updateStaleStages();
+    EXPECT_EQ(this->getStaleStages(), 0);
+}
+
+TEST_F(testIDynUtils, testIncrementalForwardKinematics)
+{
+    IncrementalForwardKinematics incremental_fk(*this);
+
+    yarp::sig::Vector q(this->iDyn3_model.getNrOfDOFs(), 0.0);
+    for(unsigned int i = 0; i < q.size(); ++i)
+        q[i] = tests_utils::getRandomAngle();
+    this->updateiDyn3Model(q, true);
+
+    EXPECT_EQ(incremental_fk.update(q), incremental_fk.getNrOfLinks());
+    EXPECT_EQ(incremental_fk.update(q), 0);
+
+    // moving a single wrist joint only dirties the links downstream of it
+    q[this->left_arm.joint_numbers.back()] += 0.1;
+    this->updateiDyn3Model(q, true);
+    unsigned int recomputed_links = incremental_fk.update(q);
+    EXPECT_GT(recomputed_links, 0);
+    EXPECT_LT(recomputed_links, incremental_fk.getNrOfLinks());
+    EXPECT_EQ(recomputed_links, incremental_fk.getNrOfRecomputedLinks());
+
+    IncrementalForwardKinematics full_fk(*this);
+    full_fk.update(q);
+
+    // bit-identical to a full update, regardless of which links were dirty
+    for(unsigned int i = 0; i < this->iDyn3_model.getNrOfLinks(); ++i)
+    {
+        EXPECT_TRUE(incremental_fk.getRoot_T_Link(i) == full_fk.getRoot_T_Link(i));
+        for(unsigned int r = 0; r < 3; ++r)
+            EXPECT_EQ(incremental_fk.getRoot_T_Link(i).p[r], full_fk.getRoot_T_Link(i).p[r]);
+    }
+
+    // iDynUtils::getPositionKDL uses the incremental forward kinematics,
+    // which must match iDyn3 after a full update of another model
+    iDynUtils full_model("coman",
+                         std::string(IDYNUTILS_TESTS_ROBOTS_DIR)+"coman/coman.urdf",
+                         std::string(IDYNUTILS_TESTS_ROBOTS_DIR) + "coman/coman.srdf");
+    for(unsigned int k = 0; k < 3; ++k)
+    {
+        q[this->right_arm.joint_numbers.back()] += 0.1;
+        q[this->left_leg.joint_numbers.front()] -= 0.05;
+        this->updateiDyn3ModelStages(q, 0, true);
+        full_model.updateiDyn3Model(q, true);
+
+        for(unsigned int i = 0; i < this->iDyn3_model.getNrOfLinks(); ++i)
+        {
+            KDL::Frame w_T_link = this->getPositionKDL(i);
+            KDL::Frame w_T_link_idyn = full_model.iDyn3_model.getPositionKDL(i);
+            for(unsigned int r = 0; r < 3; ++r)
+            {
+                EXPECT_NEAR(w_T_link.p[r], w_T_link_idyn.p[r], 1E-12) << "link " << i;
+                for(unsigned int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(w_T_link.M(r,c), w_T_link_idyn.M(r,c), 1E-12) << "link " << i;
+            }
+        }
+        // link poses do not need the UPDATE_POSITIONS stage
+        EXPECT_TRUE(this->getStaleStages() & UPDATE_POSITIONS);
+    }
+}
+
+TEST_F(testIDynUtils, testBatchKinematics)
+{
+    const unsigned int N = 10;
+    const unsigned int nDOF = this->iDyn3_model.getNrOfDOFs();
+
+    yarp::sig::Vector q0(nDOF, 0.0);
+    this->updateiDyn3Model(q0, true);
+
+    yarp::sig::Matrix Q(N, nDOF);
+    for(unsigned int n = 0; n < N; ++n)
+        for(unsigned int i = 0; i < nDOF; ++i)
+            Q(n,i) = tests_utils::getRandomAngle();
+
+    std::vector<int> link_indices;
+    link_indices.push_back(this->left_arm.end_effector_index);
+    link_indices.push_back(this->right_leg.end_effector_index);
+    link_indices.push_back(this->iDyn3_model.getLinkIndex("torso"));
+
+    batch_kinematics result;
+    EXPECT_TRUE(this->computeBatchKinematics(Q, link_indices, result));
+    EXPECT_EQ(result.number_of_configurations, N);
+    EXPECT_EQ(result.poses.size(), link_indices.size()*batch_kinematics::pose_size*N);
+    EXPECT_EQ(result.com.size(), 3*N);
+
+    // the model state is not touched
+    yarp::sig::Vector q_model = this->iDyn3_model.getAng();
+    for(unsigned int i = 0; i < nDOF; ++i)
+        EXPECT_EQ(q_model[i], q0[i]);
+
+    for(unsigned int n = 0; n < N; ++n)
+    {
+        this->updateiDyn3Model(Q.getRow(n), false);
+        for(unsigned int l = 0; l < link_indices.size(); ++l)
+        {
+            KDL::Frame w_T_link = result.getPositionKDL(n, l);
+            KDL::Frame w_T_link_idyn = this->iDyn3_model.getPositionKDL(link_indices[l]);
+            for(unsigned int r = 0; r < 3; ++r)
+            {
+                EXPECT_NEAR(w_T_link.p[r], w_T_link_idyn.p[r], 1E-10);
+                for(unsigned int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(w_T_link.M(r,c), w_T_link_idyn.M(r,c), 1E-10);
+            }
+        }
+
+        KDL::Vector com = result.getCOM(n);
+        yarp::sig::Vector com_idyn = this->iDyn3_model.getCOM();
+        for(unsigned int r = 0; r < 3; ++r)
+            EXPECT_NEAR(com[r], com_idyn[r], 1E-10);
+    }
+
+    yarp::sig::Matrix wrong_Q(N, nDOF+1);
+    EXPECT_FALSE(this->computeBatchKinematics(wrong_Q, link_indices, result));
+    link_indices.push_back(-1);
+    EXPECT_FALSE(this->computeBatchKinematics(Q, link_indices, result));
+}
+
+class CoMWorker : public yarp::os::Thread
+{
+public:
+    CoMWorker(const boost::shared_ptr<iDynUtils>& model,
+              const std::vector<yarp::sig::Vector>& configurations) :
+        model(model), configurations(configurations) {}
+
+    virtual void run()
+    {
+        for(unsigned int i = 0; i < configurations.size(); ++i)
+        {
+            model->updateiDyn3Model(configurations[i], false);
+            coms.push_back(model->getCOM());
+        }
+    }
+
+    boost::shared_ptr<iDynUtils> model;
+    std::vector<yarp::sig::Vector> configurations;
+    std::vector<yarp::sig::Vector> coms;
+};
+
+TEST_F(testIDynUtils, testClone)
+{
+    for(unsigned int i = 0; i < q.size(); ++i)
+        q[i] = tests_utils::getRandomAngle();
+    this->updateiDyn3Model(q, true);
+
+    boost::shared_ptr<iDynUtils> worker = this->clone();
+
+    // immutable data is shared, state is not
+    EXPECT_EQ(worker->urdf_model.get(), this->urdf_model.get());
+    EXPECT_EQ(worker->moveit_robot_model.get(), this->moveit_robot_model.get());
+    EXPECT_NE(worker->moveit_robot_state.get(), this->moveit_robot_state.get());
+    EXPECT_NE(worker->allowed_collision_matrix.get(), this->allowed_collision_matrix.get());
+    EXPECT_EQ(worker->left_arm.index, worker->left_arm.end_effector_index);
+    EXPECT_NE(&(worker->left_arm.index), &(this->left_arm.end_effector_index));
+
+    // the worker starts from the same state
+    worker->updateStaleStages();
+    for(unsigned int i = 0; i < this->iDyn3_model.getNrOfLinks(); ++i)
+    {
+        KDL::Frame w_T_link = this->iDyn3_model.getPositionKDL(i);
+        KDL::Frame w_T_link_worker = worker->iDyn3_model.getPositionKDL(i);
+        for(unsigned int r = 0; r < 3; ++r)
+            EXPECT_NEAR(w_T_link.p[r], w_T_link_worker.p[r], 1E-12);
+    }
+
+    // updating the worker does not touch the original model
+    yarp::sig::Vector q_worker(q.size(), 0.0);
+    worker->updateiDyn3Model(q_worker, false);
+    yarp::sig::Vector q_model = this->iDyn3_model.getAng();
+    for(unsigned int i = 0; i < q.size(); ++i)
+        EXPECT_EQ(q_model[i], q[i]);
+
+    // workers evaluated in parallel give the same results as the serial evaluation
+    const unsigned int number_of_workers = 4;
+    std::vector< std::vector<yarp::sig::Vector> > configurations(number_of_workers);
+    for(unsigned int w = 0; w < number_of_workers; ++w)
+        for(unsigned int n = 0; n < 10; ++n)
+        {
+            yarp::sig::Vector q_n(q.size(), 0.0);
+            for(unsigned int i = 0; i < q_n.size(); ++i)
+                q_n[i] = tests_utils::getRandomAngle();
+            configurations[w].push_back(q_n);
+        }
+
+    std::vector< boost::shared_ptr<CoMWorker> > workers;
+    for(unsigned int w = 0; w < number_of_workers; ++w)
+        workers.push_back(boost::shared_ptr<CoMWorker>(
+            new CoMWorker(this->clone(), configurations[w])));
+    for(unsigned int w = 0; w < number_of_workers; ++w)
+        workers[w]->start();
+    for(unsigned int w = 0; w < number_of_workers; ++w)
+        workers[w]->stop();
+
+    for(unsigned int w = 0; w < number_of_workers; ++w)
+    {
+        ASSERT_EQ(workers[w]->coms.size(), configurations[w].size());
+        for(unsigned int n = 0; n < configurations[w].size(); ++n)
+        {
+            this->updateiDyn3Model(configurations[w][n], false);
+            yarp::sig::Vector com = this->getCOM();
+            for(unsigned int r = 0; r < 3; ++r)
+                EXPECT_NEAR(workers[w]->coms[n][r], com[r], 1E-12);
+        }
+    }
+}
+
 TEST_F(testIDynUtils, testCheckSelfCollision)
 {
     std::string urdf_file = std::string(IDYNUTILS_TESTS_ROBOTS_DIR)+"coman/coman.urdf";
@@ -604,6 +849,53 @@ TEST_F(testIDynUtils, testCheckSelfCollision)
               << yarp::os::Time::now() - begin << std::endl;
 }
 
+TEST_F(testIDynUtils, testCheckSelfCollisionBatch)
+{
+    yarp::sig::Vector q_collision(this->iDyn3_model.getNrOfDOFs(), 0.0);
+    q_collision[this->iDyn3_model.getDOFIndex("RShLat")] = 0.15;
+    q_collision[this->iDyn3_model.getDOFIndex("LShLat")] = -0.15;
+    yarp::sig::Vector q_free(this->iDyn3_model.getNrOfDOFs(), 0.0);
+    q_free[this->iDyn3_model.getDOFIndex("RShLat")] = -0.15;
+    q_free[this->iDyn3_model.getDOFIndex("LShLat")] = 0.15;
+
+    std::vector<yarp::sig::Vector> configurations;
+    for(unsigned int i = 0; i < 40; ++i)
+        configurations.push_back((i % 7 == 5) ? q_collision : q_free);
+
+    this->updateiDyn3Model(q_free, true);
+
+    std::vector<int> results;
+    std::vector< std::list< std::pair<std::string,std::string> > > collisionPairs;
+    double begin = yarp::os::Time::now();
+    EXPECT_EQ(this->checkSelfCollisionBatch(configurations, results, &collisionPairs), 5);
+    std::cout << "Batch self-collision detection of " << configurations.size()
+              << " configurations took " << yarp::os::Time::now() - begin << std::endl;
+
+    ASSERT_EQ(results.size(), configurations.size());
+    ASSERT_EQ(collisionPairs.size(), configurations.size());
+    for(unsigned int i = 0; i < configurations.size(); ++i)
+    {
+        std::list< std::pair<std::string,std::string> > pairs;
+        bool collision = this->checkSelfCollisionAt(configurations[i], &pairs);
+        EXPECT_EQ(results[i], collision ? SELF_COLLISION_DETECTED : SELF_COLLISION_FREE);
+        EXPECT_EQ(collisionPairs[i].size(), pairs.size());
+    }
+
+    // the same results are obtained in the calling thread
+    std::vector<int> serial_results;
+    EXPECT_EQ(this->checkSelfCollisionBatch(configurations, serial_results, NULL, false, 1), 5);
+    EXPECT_TRUE(serial_results == results);
+
+    // early stop: everything before the first collision is checked
+    EXPECT_EQ(this->checkSelfCollisionBatch(configurations, results, NULL, true), 5);
+    for(unsigned int i = 0; i < 5; ++i)
+        EXPECT_EQ(results[i], SELF_COLLISION_FREE);
+    EXPECT_EQ(results[5], SELF_COLLISION_DETECTED);
+
+    configurations.assign(10, q_free);
+    EXPECT_EQ(this->checkSelfCollisionBatch(configurations, results), -1);
+}
+
 TEST_F(testIDynUtils, testGerenicRotationUpdateIdyn3Model)
 {
     yarp::sig::Vector q(this->iDyn3_model.getNrOfDOFs(), 0.0);
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <idynutils/RobotUtils.h>
+#include <idynutils/RobotSensingThread.h>
 #include <yarp/math/Math.h>
 #include <kdl/frames_io.hpp>
 
@@ -77,6 +78,7 @@ namespace {
             coman->sense(q, q_dot, tau);
         }
         senseTime = yarp::os::Time::now() - t;
+        std::cout << "sense skew between chain reads: " << coman->getSenseSkew() << " [s]" << std::endl;
         ASSERT_TRUE(senseTime < 20e-6*iterations) <<
             "each sense should take less than 20microsec" <<
             "but " << iterations << " iterations of sense take "
@@ -108,6 +110,201 @@ namespace {
     }
 
 
+    TEST_F(testRobotUtils, checkJointPermutation)
+    {
+        yarp::sig::Vector q_right_arm, q_left_arm, q_torso, q_right_leg, q_left_leg, q_head;
+        coman->right_arm.sensePosition(q_right_arm);
+        coman->left_arm.sensePosition(q_left_arm);
+        coman->torso.sensePosition(q_torso);
+        coman->right_leg.sensePosition(q_right_leg);
+        coman->left_leg.sensePosition(q_left_leg);
+        if(coman->head.isAvailable) coman->head.sensePosition(q_head);
+
+        yarp::sig::Vector q_chains(coman->getNumberOfJoints(), 0.0);
+        coman->fromRobotToIdyn(q_right_arm, q_left_arm, q_torso,
+                               q_right_leg, q_left_leg, q_head,
+                               q_chains);
+
+        yarp::sig::Vector q = coman->sensePosition();
+        ASSERT_EQ(q.size(), q_chains.size());
+        for(unsigned int i = 0; i < q.size(); ++i)
+            EXPECT_NEAR(q[i], q_chains[i], 1E-3) << "joint " << coman->getJointNames()[i];
+    }
+
+    TEST_F(testRobotUtils, checkFusedSense)
+    {
+        yarp::sig::Vector q, q_dot, tau;
+        coman->sense(q, q_dot, tau);
+        ASSERT_EQ(q.size(), coman->getNumberOfJoints());
+        ASSERT_EQ(q_dot.size(), coman->getNumberOfJoints());
+        ASSERT_EQ(tau.size(), coman->getNumberOfJoints());
+        EXPECT_TRUE(coman->getSenseSkew() >= 0.0);
+
+        yarp::sig::Vector q_separate = coman->sensePosition();
+        for(unsigned int i = 0; i < q.size(); ++i)
+            EXPECT_NEAR(q[i], q_separate[i], 1E-3) << "joint " << coman->getJointNames()[i];
+    }
+
+    TEST_F(testRobotUtils, checkParallelChainIO)
+    {
+        const unsigned int iterations = 1000;
+        EXPECT_EQ(coman->getNumberOfIOThreads(), 1u);
+
+        yarp::sig::Vector q, q_dot, tau;
+        double t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+            coman->sense(q, q_dot, tau);
+        double serialTime = (yarp::os::Time::now() - t)/iterations;
+
+        coman->setNumberOfIOThreads(8);
+        EXPECT_TRUE(coman->getNumberOfIOThreads() > 1);
+        EXPECT_TRUE(coman->getNumberOfIOThreads() <= 6);
+
+        yarp::sig::Vector q_parallel, q_dot_parallel, tau_parallel;
+        t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+            coman->sense(q_parallel, q_dot_parallel, tau_parallel);
+        double parallelTime = (yarp::os::Time::now() - t)/iterations;
+
+        ASSERT_EQ(q.size(), q_parallel.size());
+        for(unsigned int i = 0; i < q.size(); ++i)
+            EXPECT_NEAR(q[i], q_parallel[i], 1E-3) << "joint " << coman->getJointNames()[i];
+
+        coman->setPositionDirectMode();
+        for(unsigned int i = 0; i < 10; ++i)
+            coman->move(q_parallel);
+        coman->setIdleMode();
+
+        std::cout << "sense with " << coman->getNumberOfIOThreads() << " I/O threads: "
+                  << parallelTime*1E6 << " [us] per call, with 1 I/O thread: "
+                  << serialTime*1E6 << " [us] per call" << std::endl;
+
+        coman->setNumberOfIOThreads(1);
+        EXPECT_EQ(coman->getNumberOfIOThreads(), 1u);
+    }
+
+    TEST_F(testRobotUtils, checkSensingThread)
+    {
+        RobotSensingThread sensing(*coman, 1);
+        RobotStateSnapshot snapshot;
+        EXPECT_FALSE(sensing.getSnapshot(snapshot));
+
+        ASSERT_TRUE(sensing.start());
+        yarp::os::Time::delay(0.1);
+        ASSERT_TRUE(sensing.getSnapshot(snapshot));
+        EXPECT_TRUE(snapshot.sequence > 0);
+        EXPECT_EQ(snapshot.q.size(), coman->getNumberOfJoints());
+        EXPECT_EQ(snapshot.qdot.size(), coman->getNumberOfJoints());
+        EXPECT_EQ(snapshot.tau.size(), coman->getNumberOfJoints());
+        EXPECT_EQ(snapshot.ft_readings.size(), coman->getftSensors().size());
+        EXPECT_EQ(snapshot.imu.size(), coman->hasIMU() ? RobotSensingThread::IMU_OUTPUT_SIZE : 0u);
+
+        // readers get newer snapshots, without blocking the sensing thread
+        const unsigned long first_sequence = snapshot.sequence;
+        const unsigned int iterations = 1000;
+        double t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+            sensing.getSnapshot(snapshot);
+        double readTime = (yarp::os::Time::now() - t)/iterations;
+        yarp::os::Time::delay(0.1);
+        ASSERT_TRUE(sensing.getSnapshot(snapshot));
+        EXPECT_TRUE(snapshot.sequence > first_sequence);
+        EXPECT_TRUE(snapshot.sequence <= sensing.getNumberOfSnapshots());
+        sensing.stop();
+
+        std::cout << "getSnapshot: " << readTime*1E6 << " [us] per call" << std::endl;
+        EXPECT_TRUE(readTime < 5e-6);
+    }
+
+    TEST_F(testRobotUtils, checkftTable)
+    {
+        const std::vector<yarp::sig::Vector>& readings = coman->senseftTable();
+        ASSERT_EQ(readings.size(), coman->ft_reference_frames.size());
+        const double* data = readings.empty() ? NULL : readings[0].data();
+
+        RobotUtils::ftReadings& ft_readings = coman->senseftSensors();
+        EXPECT_EQ(ft_readings.size(), readings.size());
+        for(unsigned int i = 0; i < readings.size(); ++i)
+        {
+            EXPECT_EQ(readings[i].size(), 6u);
+            EXPECT_EQ(coman->getftIndex(coman->ft_reference_frames[i]), (int)i);
+            EXPECT_TRUE(ft_readings.count(coman->ft_reference_frames[i]) == 1);
+        }
+        EXPECT_EQ(coman->getftIndex("not_a_frame"), -1);
+        EXPECT_EQ(coman->senseftSensors().size(), readings.size());
+
+        // readings are filled in place
+        coman->senseftTable();
+        if(!readings.empty())
+            EXPECT_EQ(readings[0].data(), data);
+
+        const unsigned int iterations = 1000;
+        yarp::sig::Vector q(coman->getNumberOfJoints(), 0.0);
+        double t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+            coman->updateiDyn3Model(q);
+        double fusedTime = (yarp::os::Time::now() - t)/iterations;
+
+        t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+        {
+            RobotUtils::ftReadings& readings_map = coman->senseftSensors();
+            std::vector<iDynUtils::ft_measure> ft_measurements;
+            for(RobotUtils::ftReadings::iterator it = readings_map.begin(); it != readings_map.end(); ++it)
+                ft_measurements.push_back(iDynUtils::ft_measure(it->first, it->second));
+            coman->idynutils.updateiDyn3Model(q, ft_measurements);
+        }
+        double measuresTime = (yarp::os::Time::now() - t)/iterations;
+
+        std::cout << "updateiDyn3Model with ft table: " << fusedTime*1E6
+                  << " [us] per call, with ft_measure: " << measuresTime*1E6
+                  << " [us] per call" << std::endl;
+    }
+
+    TEST_F(testRobotUtils, checkPerCallTimings)
+    {
+        const unsigned int iterations = 1000;
+
+        double t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+            coman->sensePosition();
+        double sensePositionTime = (yarp::os::Time::now() - t)/iterations;
+
+        t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+            coman->senseVelocity();
+        double senseVelocityTime = (yarp::os::Time::now() - t)/iterations;
+
+        t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+            coman->senseTorque();
+        double senseTorqueTime = (yarp::os::Time::now() - t)/iterations;
+
+        t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+            coman->sensePositionRefFeedback();
+        double sensePositionRefFeedbackTime = (yarp::os::Time::now() - t)/iterations;
+
+        yarp::sig::Vector q = coman->sensePosition();
+        coman->setPositionDirectMode();
+        t = yarp::os::Time::now();
+        for(unsigned int i = 0; i < iterations; ++i)
+            coman->move(q);
+        double moveTime = (yarp::os::Time::now() - t)/iterations;
+        coman->setIdleMode();
+
+        std::cout << "sensePosition: " << sensePositionTime*1E6 << " [us] per call" << std::endl;
+        std::cout << "senseVelocity: " << senseVelocityTime*1E6 << " [us] per call" << std::endl;
+        std::cout << "senseTorque: " << senseTorqueTime*1E6 << " [us] per call" << std::endl;
+        std::cout << "sensePositionRefFeedback: " << sensePositionRefFeedbackTime*1E6 << " [us] per call" << std::endl;
+        std::cout << "move: " << moveTime*1E6 << " [us] per call" << std::endl;
+
+        EXPECT_TRUE(sensePositionTime < 20e-6);
+        EXPECT_TRUE(senseVelocityTime < 20e-6);
+        EXPECT_TRUE(senseTorqueTime < 20e-6);
+        EXPECT_TRUE(moveTime < 150e-6);
+    }
+
 } //namespace
 
 int main(int argc, char **argv) {